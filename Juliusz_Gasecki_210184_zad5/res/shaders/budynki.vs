@@ -1,18 +1,21 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aColor;
-layout (location = 2) in vec3 aOffset;
+// aPos, aColor: ColoredVertexLayout::declarations(), inserted when the shader is compiled
 
 out vec3 FragPos;
 out vec3 fColor;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;
+};
 
 void main()
 {
-	FragPos = vec3(model * vec4(aPos + aOffset, 1.0));
+	FragPos = vec3(model * vec4(aPos, 1.0));
     fColor = aColor;
     gl_Position = projection * view * vec4(FragPos, 1.0);
 } 
\ No newline at end of file
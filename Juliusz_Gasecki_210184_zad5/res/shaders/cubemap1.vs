@@ -1,17 +1,27 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+// aPos, aNormal, aTexCoords, ...: ModelVertexLayout::declarations(), inserted when the shader is compiled
 
 out vec3 Normal;
 out vec3 Position;
+out vec2 TexCoords;
+flat out uint MaterialIndex;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;
+};
+// row of the Materials block, set per mesh
+uniform int materialIndex;
 
 void main()
 {
     Normal = mat3(transpose(inverse(model))) * aNormal;
     Position = vec3(model * vec4(aPos, 1.0));
+    TexCoords = aTexCoords;
+    MaterialIndex = uint(materialIndex);
     gl_Position = projection * view * model * vec4(aPos, 1.0);
 }
\ No newline at end of file
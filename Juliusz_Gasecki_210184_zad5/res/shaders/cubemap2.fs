@@ -3,14 +3,62 @@ out vec4 FragColor;
 
 in vec3 Normal;
 in vec3 Position;
+in vec2 TexCoords;
+flat in uint MaterialIndex;
 
-uniform vec3 cameraPos;
+#define MAX_MATERIALS 256
+
+// GpuMaterial in material.h, a map is (texture array, layer), x < 0 = none
+struct MaterialData {
+    vec4 diffuse;
+    vec4 specular;
+    ivec4 diffuseSpecularMaps;
+    ivec4 normalHeightMaps;
+};
+
+layout (std140) uniform Materials {
+    MaterialData materials[MAX_MATERIALS];
+};
+
+uniform sampler2DArray materialTextures[4];
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;
+};
 uniform samplerCube skybox;
 
+// sampler arrays only take constant indices here; the gradients are taken outside the branches
+vec4 sampleMap(ivec2 map, vec2 uv)
+{
+    vec2 dx = dFdx(uv);
+    vec2 dy = dFdy(uv);
+    vec3 coord = vec3(uv, float(map.y));
+    switch (map.x)
+    {
+    case 0: return textureGrad(materialTextures[0], coord, dx, dy);
+    case 1: return textureGrad(materialTextures[1], coord, dx, dy);
+    case 2: return textureGrad(materialTextures[2], coord, dx, dy);
+    case 3: return textureGrad(materialTextures[3], coord, dx, dy);
+    }
+    return vec4(1.0);
+}
+
+// the environment tinted by the material's diffuse map, untextured materials keep the plain environment
+vec3 surfaceColor(vec3 environment)
+{
+    ivec2 diffuseMap = materials[MaterialIndex].diffuseSpecularMaps.xy;
+    if (diffuseMap.x < 0)
+        return environment;
+    return environment * sampleMap(diffuseMap, TexCoords).rgb;
+}
+
 void main()
     {             
         float ratio = 1.00 / 1.52;
         vec3 I = normalize(Position - cameraPos);
         vec3 R = refract(I, normalize(Normal), ratio);
-        FragColor = vec4(texture(skybox, R).rgb, 1.0);
+        FragColor = vec4(surfaceColor(texture(skybox, R).rgb), 1.0);
     }  
\ No newline at end of file
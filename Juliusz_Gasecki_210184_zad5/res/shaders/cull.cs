@@ -0,0 +1,122 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+struct ObjectData {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    mat4 model;
+    uint mesh;
+    uint bucket;
+    uint materialIndex;
+    uint animationIndex;
+};
+
+struct MeshData {
+    uint count;
+    uint firstIndex;
+    int baseVertex;
+    uint pad;
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+struct DrawData {
+    mat4 model;
+    uint materialIndex;
+    uint animationIndex;
+};
+
+layout (std430, binding = 0) writeonly buffer DrawBuffer { DrawData draws[]; };
+layout (std430, binding = 1) readonly buffer ObjectBuffer { ObjectData objects[]; };
+layout (std430, binding = 2) readonly buffer MeshBuffer { MeshData meshes[]; };
+layout (std430, binding = 3) writeonly buffer CommandBuffer { DrawCommand commands[]; };
+layout (std430, binding = 4) buffer CounterBuffer { uint drawCounts[]; };
+layout (std430, binding = 5) writeonly buffer VisibilityBuffer { uint visibility[]; };
+
+uniform uint objectCount;
+uniform uint bucketCapacity;
+uniform vec4 frustumPlanes[6];
+uniform mat4 previousViewProjection;
+uniform bool useHiZ;
+uniform vec2 hiZSize;
+uniform int hiZLevels;
+uniform sampler2D hiZ;
+
+bool insideFrustum(vec3 center, vec3 extents)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        vec4 plane = frustumPlanes[i];
+        float d = dot(plane.xyz, center) + plane.w;
+        float r = dot(abs(plane.xyz), extents);
+        if (d + r < 0.0)
+            return false;
+    }
+    return true;
+}
+
+// the pyramid holds last frame's farthest depth per texel, so it is tested with last frame's matrices
+bool occludedByHiZ(vec3 boundsMin, vec3 boundsMax)
+{
+    vec2 screenMin = vec2(1.0);
+    vec2 screenMax = vec2(0.0);
+    float minZ = 1.0;
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boundsMax.x : boundsMin.x,
+                           (i & 2) != 0 ? boundsMax.y : boundsMin.y,
+                           (i & 4) != 0 ? boundsMax.z : boundsMin.z);
+        vec4 clip = previousViewProjection * vec4(corner, 1.0);
+        if (clip.w <= 0.0001 || clip.z < -clip.w)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        screenMin = min(screenMin, ndc.xy * 0.5 + 0.5);
+        screenMax = max(screenMax, ndc.xy * 0.5 + 0.5);
+        minZ = min(minZ, ndc.z * 0.5 + 0.5);
+    }
+    screenMin = clamp(screenMin, 0.0, 1.0);
+    screenMax = clamp(screenMax, 0.0, 1.0);
+
+    // the level where the rectangle covers at most 2x2 texels
+    vec2 size = (screenMax - screenMin) * hiZSize;
+    float level = clamp(ceil(log2(max(max(size.x, size.y), 1.0))), 0.0, float(hiZLevels - 1));
+    float farthest = max(max(textureLod(hiZ, screenMin, level).r, textureLod(hiZ, vec2(screenMax.x, screenMin.y), level).r),
+                         max(textureLod(hiZ, vec2(screenMin.x, screenMax.y), level).r, textureLod(hiZ, screenMax, level).r));
+    return minZ > farthest;
+}
+
+void main()
+{
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= objectCount)
+        return;
+
+    ObjectData object = objects[id];
+    // Arvo: world box of the transformed object space box
+    vec3 center = 0.5 * (object.boundsMin.xyz + object.boundsMax.xyz);
+    vec3 extents = 0.5 * (object.boundsMax.xyz - object.boundsMin.xyz);
+    vec3 worldCenter = vec3(object.model * vec4(center, 1.0));
+    mat3 absModel = mat3(abs(object.model[0].xyz), abs(object.model[1].xyz), abs(object.model[2].xyz));
+    vec3 worldExtents = absModel * extents;
+
+    bool visible = insideFrustum(worldCenter, worldExtents);
+    if (visible && useHiZ)
+        visible = !occludedByHiZ(worldCenter - worldExtents, worldCenter + worldExtents);
+    visibility[id] = visible ? 1u : 0u;
+    if (!visible)
+        return;
+
+    // append into this bucket's region, baseInstance points the vertex shader at the matching draw data
+    uint slot = object.bucket * bucketCapacity + atomicAdd(drawCounts[object.bucket], 1u);
+    MeshData mesh = meshes[object.mesh];
+    commands[slot] = DrawCommand(mesh.count, 1u, mesh.firstIndex, mesh.baseVertex, slot);
+    draws[slot].model = object.model;
+    draws[slot].materialIndex = object.materialIndex;
+    draws[slot].animationIndex = object.animationIndex;
+}
@@ -0,0 +1,12 @@
+#version 330 core
+// aPos: PositionVertexLayout::declarations(), inserted when the shader is compiled
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// position-only pass: bound with GeometryArena::positionVAO, nothing but the position stream is fetched
+void main()
+{
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
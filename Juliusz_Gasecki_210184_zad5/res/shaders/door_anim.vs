@@ -0,0 +1,130 @@
+#version 460 core
+// aPos, aNormal, aTexCoords, ...: ModelVertexLayout::declarations(), inserted when the shader is compiled
+
+struct DrawData {
+    mat4 model;
+    uint materialIndex;
+    uint animationIndex;
+};
+
+// GpuDoorAnimation in door_animation.h
+struct DoorAnimation {
+    vec4 closedTranslation;     // w = easing curve
+    vec4 openTranslation;       // w = clip duration
+    vec4 closedScale;           // w = clip time at the anchor
+    vec4 openScale;             // w = playback speed from the anchor on
+    vec4 baseRotation;          // quaternion when closed
+    vec4 axisAngle;             // rotation from closed to open
+    vec4 pivot;                 // w = simulation time of the anchor
+};
+
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawData draws[];
+};
+
+// GeometryArena vertex streams, both the same buffer when the arena is interleaved
+layout (std430, binding = 7) readonly buffer PositionPool {
+    float positionData[];
+};
+
+layout (std430, binding = 8) readonly buffer AttributePool {
+    float attributeData[];
+};
+
+layout (std430, binding = 6) readonly buffer DoorAnimationBuffer {
+    DoorAnimation doors[];
+};
+
+out vec3 Normal;
+out vec3 Position;
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;    // simulation clock the anchors were taken on, shared by every door
+};
+
+// position stride, attribute stride, normal and texCoords offsets in floats (VertexFormat in geometry_arena.h);
+// position stride 0 = vertex attributes
+uniform uvec4 vertexFormat;
+
+vec3 pullPosition()
+{
+    uint base = uint(gl_VertexID) * vertexFormat.x;
+    return vec3(positionData[base], positionData[base + 1u], positionData[base + 2u]);
+}
+
+vec3 pullVec3(uint offset)
+{
+    uint base = uint(gl_VertexID) * vertexFormat.y + offset;
+    return vec3(attributeData[base], attributeData[base + 1u], attributeData[base + 2u]);
+}
+
+vec2 pullVec2(uint offset)
+{
+    uint base = uint(gl_VertexID) * vertexFormat.y + offset;
+    return vec2(attributeData[base], attributeData[base + 1u]);
+}
+
+// applyEasing() in animation.h
+float ease(float x, int curve)
+{
+    if (curve == 1)
+        return x * x * (3.0 - 2.0 * x);
+    if (curve == 2)
+        return x < 0.5 ? 4.0 * x * x * x : 1.0 - 4.0 * (1.0 - x) * (1.0 - x) * (1.0 - x);
+    return x;
+}
+
+vec4 quatMultiply(vec4 a, vec4 b)
+{
+    return vec4(a.w * b.xyz + b.w * a.xyz + cross(a.xyz, b.xyz), a.w * b.w - dot(a.xyz, b.xyz));
+}
+
+mat3 quatToMat3(vec4 q)
+{
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    return mat3(1.0 - 2.0 * (yy + zz), 2.0 * (xy + wz), 2.0 * (xz - wy),
+                2.0 * (xy - wz), 1.0 - 2.0 * (xx + zz), 2.0 * (yz + wx),
+                2.0 * (xz + wy), 2.0 * (yz - wx), 1.0 - 2.0 * (xx + yy));
+}
+
+// the door's local matrix is a pure function of its anchor and the clock, the CPU never writes it per frame
+mat4 doorTransform(DoorAnimation door)
+{
+    float duration = door.openTranslation.w;
+    float clipTime = clamp(door.closedScale.w + door.openScale.w * (animationTime - door.pivot.w), 0.0, duration);
+    float amount = ease(duration > 0.0 ? clipTime / duration : 1.0, int(door.closedTranslation.w));
+
+    vec3 translation = mix(door.closedTranslation.xyz, door.openTranslation.xyz, amount);
+    vec3 scale = mix(door.closedScale.xyz, door.openScale.xyz, amount);
+    float halfAngle = 0.5 * door.axisAngle.w * amount;
+    vec4 rotation = quatMultiply(vec4(door.axisAngle.xyz * sin(halfAngle), cos(halfAngle)), door.baseRotation);
+    mat3 r = quatToMat3(rotation);
+    // translate * (rotate about the pivot) * scale
+    return mat4(vec4(r[0] * scale.x, 0.0), vec4(r[1] * scale.y, 0.0), vec4(r[2] * scale.z, 0.0),
+                vec4(translation + door.pivot.xyz - r * door.pivot.xyz, 1.0));
+}
+
+void main()
+{
+    DrawData draw = draws[gl_BaseInstance + gl_InstanceID];
+    // animated instances carry their parent's world matrix, the local part is evaluated here
+    mat4 model = draw.model;
+    if (draw.animationIndex != 0u)
+        model = model * doorTransform(doors[draw.animationIndex - 1u]);
+    bool pulled = vertexFormat.x != 0u;
+    vec3 position = pulled ? pullPosition() : aPos;
+    vec3 normal = pulled ? pullVec3(vertexFormat.z) : aNormal;
+    Normal = mat3(transpose(inverse(model))) * normal;
+    Position = vec3(model * vec4(position, 1.0));
+    TexCoords = pulled ? pullVec2(vertexFormat.w) : aTexCoords;
+    MaterialIndex = draw.materialIndex;
+    gl_Position = projection * view * vec4(Position, 1.0);
+}
@@ -0,0 +1,43 @@
+#version 430 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (r32f, binding = 0) readonly uniform image2D srcLevel;
+layout (r32f, binding = 1) writeonly uniform image2D dstLevel;
+
+uniform sampler2D depthTexture;
+uniform bool copyDepth;
+uniform ivec2 srcSize;
+uniform ivec2 dstSize;
+
+float fetch(ivec2 p)
+{
+    return imageLoad(srcLevel, min(p, srcSize - 1)).r;
+}
+
+void main()
+{
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, dstSize)))
+        return;
+
+    float depth;
+    if (copyDepth)
+    {
+        depth = texelFetch(depthTexture, p, 0).r;
+    }
+    else
+    {
+        // farthest of the 2x2 footprint, the last row/column of an odd sized level also takes the third texel
+        ivec2 s = p * 2;
+        depth = max(max(fetch(s), fetch(s + ivec2(1, 0))), max(fetch(s + ivec2(0, 1)), fetch(s + ivec2(1, 1))));
+        bool oddX = (srcSize.x & 1) != 0 && p.x == dstSize.x - 1;
+        bool oddY = (srcSize.y & 1) != 0 && p.y == dstSize.y - 1;
+        if (oddX)
+            depth = max(depth, max(fetch(s + ivec2(2, 0)), fetch(s + ivec2(2, 1))));
+        if (oddY)
+            depth = max(depth, max(fetch(s + ivec2(0, 2)), fetch(s + ivec2(1, 2))));
+        if (oddX && oddY)
+            depth = max(depth, fetch(s + ivec2(2, 2)));
+    }
+    imageStore(dstLevel, p, vec4(depth));
+}
@@ -0,0 +1,71 @@
+#version 460 core
+// aPos, aNormal, aTexCoords, ...: ModelVertexLayout::declarations(), inserted when the shader is compiled
+
+struct DrawData {
+    mat4 model;
+    uint materialIndex;
+    uint animationIndex;
+};
+
+layout (std430, binding = 0) readonly buffer DrawBuffer {
+    DrawData draws[];
+};
+
+// GeometryArena vertex streams, both the same buffer when the arena is interleaved
+layout (std430, binding = 7) readonly buffer PositionPool {
+    float positionData[];
+};
+
+layout (std430, binding = 8) readonly buffer AttributePool {
+    float attributeData[];
+};
+
+out vec3 Normal;
+out vec3 Position;
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;
+};
+
+// position stride, attribute stride, normal and texCoords offsets in floats (VertexFormat in geometry_arena.h);
+// position stride 0 = vertex attributes
+uniform uvec4 vertexFormat;
+
+vec3 pullPosition()
+{
+    uint base = uint(gl_VertexID) * vertexFormat.x;
+    return vec3(positionData[base], positionData[base + 1u], positionData[base + 2u]);
+}
+
+vec3 pullVec3(uint offset)
+{
+    uint base = uint(gl_VertexID) * vertexFormat.y + offset;
+    return vec3(attributeData[base], attributeData[base + 1u], attributeData[base + 2u]);
+}
+
+vec2 pullVec2(uint offset)
+{
+    uint base = uint(gl_VertexID) * vertexFormat.y + offset;
+    return vec2(attributeData[base], attributeData[base + 1u]);
+}
+
+void main()
+{
+    // every indirect command points its baseInstance at its own slot in the draw buffer
+    DrawData draw = draws[gl_BaseInstance + gl_InstanceID];
+    // gl_VertexID already includes the command's baseVertex
+    bool pulled = vertexFormat.x != 0u;
+    vec3 position = pulled ? pullPosition() : aPos;
+    vec3 normal = pulled ? pullVec3(vertexFormat.z) : aNormal;
+    Normal = mat3(transpose(inverse(draw.model))) * normal;
+    Position = vec3(draw.model * vec4(position, 1.0));
+    TexCoords = pulled ? pullVec2(vertexFormat.w) : aTexCoords;
+    MaterialIndex = draw.materialIndex;
+    gl_Position = projection * view * vec4(Position, 1.0);
+}
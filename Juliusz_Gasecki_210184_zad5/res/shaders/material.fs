@@ -43,16 +43,26 @@ struct SpotLight {
     vec3 specular;       
 };
 
-#define NR_SPOT_LIGHTS 2
+#define NR_SPOT_LIGHTS 2	// GpuLighting::SPOT_LIGHTS
 
 in vec3 FragPos;
 in vec3 Normal;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLight;
-uniform SpotLight spotLights[NR_SPOT_LIGHTS];
-uniform Material material;
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;
+};
+
+// GpuLighting in uniform_blocks.h: the surface and every light, one buffer write
+layout (std140) uniform Lighting {
+    Material material;
+    DirLight dirLight;
+    PointLight pointLight;
+    SpotLight spotLights[NR_SPOT_LIGHTS];
+};
 
 // function prototypes
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
@@ -63,7 +73,7 @@ void main()
 {    
     // properties
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(cameraPos - FragPos);
     
     // == =====================================================
     // Our lighting is set up in 3 phases: directional, point lights and an optional flashlight
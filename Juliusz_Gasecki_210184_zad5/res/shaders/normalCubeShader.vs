@@ -1,14 +1,18 @@
 
 
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aColor;
+// aPos, aColor: ColoredVertexLayout::declarations(), inserted when the shader is compiled
 
 out vec3 ourColor;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// GpuFrame in uniform_blocks.h, written once per frame
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+    float animationTime;
+};
 
 void main()
 {
@@ -1,5 +1,5 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+// aPos: PositionVertexLayout::declarations(), inserted when the shader is compiled
 
 out vec3 TexCoords;
 
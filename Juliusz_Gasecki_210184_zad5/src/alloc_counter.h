@@ -0,0 +1,40 @@
+#pragma once
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+// Optional count of global heap allocations (cmake -DPAG_COUNT_ALLOCATIONS=ON). It replaces the global
+// operator new/delete, so only one translation unit (main.cpp) may include it. Memory taken with malloc,
+// e.g. by the GL driver or GLFW, is not counted.
+#ifdef PAG_COUNT_ALLOCATIONS
+inline atomic<unsigned long long> &allocationCounter()
+{
+	static atomic<unsigned long long> counter(0);
+	return counter;
+}
+
+void *operator new(size_t size)
+{
+	allocationCounter().fetch_add(1, memory_order_relaxed);
+	void *memory = malloc(size ? size : 1);
+	if (!memory)
+		throw bad_alloc();
+	return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+	free(memory);
+}
+
+inline bool countingAllocations() { return true; }
+inline unsigned long long allocationCount() { return allocationCounter().load(memory_order_relaxed); }
+#else
+inline bool countingAllocations() { return false; }
+inline unsigned long long allocationCount() { return 0; }
+#endif
+#endif
@@ -0,0 +1,455 @@
+#pragma once
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+enum AnimationChannel {
+	CHANNEL_TRANSLATION,
+	CHANNEL_ROTATION,
+	CHANNEL_SCALE
+};
+
+// how clip time maps to sampling time, the same curves are evaluated in door_anim.vs
+enum AnimationEasing {
+	EASE_LINEAR = 0,
+	EASE_SMOOTHSTEP = 1,
+	EASE_IN_OUT_CUBIC = 2
+};
+
+// x is the played fraction of the clip, 0..1
+inline float applyEasing(AnimationEasing easing, float x)
+{
+	if (easing == EASE_SMOOTHSTEP)
+		return x * x * (3.0f - 2.0f * x);
+	if (easing == EASE_IN_OUT_CUBIC)
+		return x < 0.5f ? 4.0f * x * x * x : 1.0f - 4.0f * (1.0f - x) * (1.0f - x) * (1.0f - x);
+	return x;
+}
+
+// keys of one channel of one node; values are xyz for translation/scale and a quaternion (x, y, z, w) for rotation
+struct AnimationTrack {
+	string target;
+	AnimationChannel channel;
+	vector<float> times;
+	vector<glm::vec4> values;
+};
+
+struct AnimationClip {
+	string name;
+	float duration;
+	AnimationEasing easing;
+	vector<AnimationTrack> tracks;
+};
+
+// where a playing clip is, handed from the simulation to whoever mirrors it (door_animation.h)
+struct AnimationPlayback {
+	float time;
+	float speed;
+};
+
+// local transform of an animated node, kept as TRS so two poses can be blended
+struct AnimationPose {
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+
+	AnimationPose() : translation(0.0f), rotation(1.0f, 0.0f, 0.0f, 0.0f), scale(1.0f) {}
+
+	// translate * rotate * scale
+	glm::mat4 matrix() const
+	{
+		glm::mat3 r = glm::mat3_cast(rotation);
+		return glm::mat4(glm::vec4(r[0] * scale.x, 0.0f), glm::vec4(r[1] * scale.y, 0.0f),
+			glm::vec4(r[2] * scale.z, 0.0f), glm::vec4(translation, 1.0f));
+	}
+
+	bool operator==(const AnimationPose &other) const
+	{
+		return translation == other.translation && rotation == other.rotation && scale == other.scale;
+	}
+	bool operator!=(const AnimationPose &other) const { return !(*this == other); }
+};
+
+inline AnimationPose mixPose(const AnimationPose &a, const AnimationPose &b, float t)
+{
+	AnimationPose pose;
+	pose.translation = glm::mix(a.translation, b.translation, t);
+	pose.rotation = glm::slerp(a.rotation, b.rotation, t);
+	pose.scale = glm::mix(a.scale, b.scale, t);
+	return pose;
+}
+
+// Reads clips from the text format described in res/animations/tram_doors.anim. Broken lines are reported and
+// skipped, a missing file gives an empty list.
+inline vector<AnimationClip> loadAnimationClips(const char *path)
+{
+	vector<AnimationClip> clips;
+	ifstream file(path);
+	if (!file.is_open())
+	{
+		cout << "ERROR::ANIMATION::FILE_NOT_SUCCESFULLY_READ " << path << endl;
+		return clips;
+	}
+	string line;
+	unsigned int lineNumber = 0;
+	AnimationTrack *track = NULL;
+	while (getline(file, line))
+	{
+		lineNumber++;
+		istringstream in(line);
+		string word;
+		if (!(in >> word) || word[0] == '#')
+			continue;
+		bool ok = true;
+		if (word == "clip")
+		{
+			AnimationClip clip;
+			clip.easing = EASE_LINEAR;
+			ok = (bool)(in >> clip.name >> clip.duration) && clip.duration >= 0.0f;
+			string easing;
+			if (ok && in >> easing)
+			{
+				if (easing == "smoothstep")
+					clip.easing = EASE_SMOOTHSTEP;
+				else if (easing == "cubic")
+					clip.easing = EASE_IN_OUT_CUBIC;
+				else if (easing != "linear")
+					ok = false;
+			}
+			if (ok)
+				clips.push_back(clip);
+			track = NULL;
+		}
+		else if (word == "track")
+		{
+			AnimationTrack t;
+			string channel;
+			ok = !clips.empty() && (bool)(in >> t.target >> channel);
+			if (ok && channel == "translation")
+				t.channel = CHANNEL_TRANSLATION;
+			else if (ok && channel == "rotation")
+				t.channel = CHANNEL_ROTATION;
+			else if (ok && channel == "scale")
+				t.channel = CHANNEL_SCALE;
+			else
+				ok = false;
+			if (ok)
+			{
+				clips.back().tracks.push_back(t);
+				track = &clips.back().tracks.back();
+			}
+		}
+		else if (word == "key")
+		{
+			float time;
+			glm::vec4 value(0.0f);
+			ok = track != NULL && (bool)(in >> time >> value.x >> value.y >> value.z);
+			if (ok && track->channel == CHANNEL_ROTATION)
+			{
+				float degrees;
+				ok = (bool)(in >> degrees) && glm::length(glm::vec3(value)) > 0.0f;
+				if (ok)
+				{
+					glm::quat q = glm::angleAxis(glm::radians(degrees), glm::normalize(glm::vec3(value)));
+					value = glm::vec4(q.x, q.y, q.z, q.w);
+					// neighbouring keys on the same hemisphere, so blending never has to flip a sign
+					if (!track->values.empty() && glm::dot(value, track->values.back()) < 0.0f)
+						value = -value;
+				}
+			}
+			if (ok && !track->times.empty() && time <= track->times.back())
+				ok = false;
+			if (ok)
+			{
+				track->times.push_back(time);
+				track->values.push_back(value);
+			}
+		}
+		else
+			ok = false;
+		if (!ok)
+			cout << "ERROR::ANIMATION:: " << path << ":" << lineNumber << " can't parse \"" << line << "\"" << endl;
+	}
+	// a track without keys would have nothing to sample
+	for (unsigned int i = 0; i < clips.size(); i++)
+		for (unsigned int j = clips[i].tracks.size(); j-- > 0;)
+			if (clips[i].tracks[j].times.empty())
+				clips[i].tracks.erase(clips[i].tracks.begin() + j);
+	return clips;
+}
+
+// Plays clips on named targets. Every target is bound once to a TransformHierarchy handle and owns one pose slot;
+// update() advances the playing instances by time and then samples all of their channels in one pass. The pass
+// first gathers each channel's two surrounding keys into flat per-component arrays, then blends them in
+// branch-free loops the compiler can vectorize, so the cost follows the number of moving channels.
+// Nothing here touches the hierarchy: whoever owns it copies poses()/targets() into it.
+class Animator
+{
+public:
+	Animator() : sampling(true), evaluated(0) {}
+
+	// returns the pose slot, binding the same name again just moves it to another handle
+	int bindTarget(const string &name, int transformHandle, const AnimationPose &rest = AnimationPose())
+	{
+		int slot = findTarget(name);
+		if (slot < 0)
+		{
+			slot = (int)names.size();
+			names.push_back(name);
+			handles.push_back(transformHandle);
+			posesBySlot.push_back(rest);
+		}
+		handles[slot] = transformHandle;
+		return slot;
+	}
+
+	// starts clip paused at time 0 when speed is 0; the clip has to outlive the animator. -1 when a target is unbound
+	int play(const AnimationClip &clip, float speed = 1.0f, bool loop = false)
+	{
+		Instance instance;
+		instance.clip = &clip;
+		instance.time = 0.0f;
+		instance.speed = speed;
+		instance.loop = loop;
+		instance.dirty = true;
+		instance.firstChannel = (unsigned int)channels.size();
+		for (unsigned int i = 0; i < clip.tracks.size(); i++)
+		{
+			Channel channel;
+			channel.track = &clip.tracks[i];
+			channel.slot = findTarget(clip.tracks[i].target);
+			channel.key = 0;
+			if (channel.slot < 0)
+			{
+				cout << "ERROR::ANIMATION:: clip " << clip.name << " animates unbound target " << clip.tracks[i].target << endl;
+				channels.resize(instance.firstChannel);
+				return -1;
+			}
+			channels.push_back(channel);
+		}
+		instance.channelCount = (unsigned int)channels.size() - instance.firstChannel;
+		instances.push_back(instance);
+		return (int)instances.size() - 1;
+	}
+
+	// negative speeds play backwards, 0 holds the current pose
+	void setSpeed(int instance, float speed) { instances[instance].speed = speed; }
+	float getSpeed(int instance) const { return instances[instance].speed; }
+	void setTime(int instance, float time)
+	{
+		instances[instance].time = time;
+		instances[instance].dirty = true;
+	}
+	float getTime(int instance) const { return instances[instance].time; }
+	unsigned int instanceCount() const { return (unsigned int)instances.size(); }
+	const AnimationClip &getClip(int instance) const { return *instances[instance].clip; }
+	AnimationPlayback getPlayback(int instance) const
+	{
+		AnimationPlayback playback = { instances[instance].time, instances[instance].speed };
+		return playback;
+	}
+
+	// with sampling off update() only advances the clocks and poses() goes stale, for when poses are evaluated
+	// elsewhere (the GPU door path); turning it back on resamples every instance
+	void setSampling(bool enabled)
+	{
+		if (enabled && !sampling)
+			for (unsigned int i = 0; i < instances.size(); i++)
+				instances[i].dirty = true;
+		sampling = enabled;
+	}
+	bool isSampling() const { return sampling; }
+
+	// pose slot of a bound target, -1 if the name was never bound
+	int findTarget(const string &name) const
+	{
+		for (unsigned int i = 0; i < names.size(); i++)
+			if (names[i] == name)
+				return (int)i;
+		return -1;
+	}
+
+	void update(float deltaTime)
+	{
+		vectors.clear();
+		rotations.clear();
+		for (unsigned int i = 0; i < instances.size(); i++)
+		{
+			Instance &instance = instances[i];
+			float time = advance(instance, deltaTime);
+			if (time == instance.time && !instance.dirty)
+				continue;
+			instance.time = time;
+			if (!sampling)
+				continue;
+			instance.dirty = false;
+			float duration = instance.clip->duration;
+			if (instance.clip->easing != EASE_LINEAR && duration > 0.0f)
+				time = duration * applyEasing(instance.clip->easing, time / duration);
+			for (unsigned int c = instance.firstChannel; c < instance.firstChannel + instance.channelCount; c++)
+				gather(channels[c], time);
+		}
+		evaluated = vectors.size() + rotations.size();
+		blendVectors();
+		blendRotations();
+	}
+
+	// pose per slot and the hierarchy handle it belongs to, same order
+	const vector<AnimationPose> &poses() const { return posesBySlot; }
+	const vector<int> &targets() const { return handles; }
+	// channels sampled by the last update()
+	unsigned int evaluatedChannels() const { return (unsigned int)evaluated; }
+
+private:
+	struct Channel {
+		const AnimationTrack *track;
+		int slot;
+		unsigned int key;	// segment found last time, playback rarely jumps so the search starts here
+	};
+
+	struct Instance {
+		const AnimationClip *clip;
+		float time;
+		float speed;
+		bool loop;
+		bool dirty;
+		unsigned int firstChannel;
+		unsigned int channelCount;
+	};
+
+	// two keys and a blend factor per lane, one array per component
+	struct Batch {
+		vector<float> ax, ay, az, aw, bx, by, bz, bw, t;
+		vector<float*> out;
+
+		void clear()
+		{
+			ax.clear(); ay.clear(); az.clear(); aw.clear();
+			bx.clear(); by.clear(); bz.clear(); bw.clear();
+			t.clear(); out.clear();
+		}
+		size_t size() const { return t.size(); }
+		void push(const glm::vec4 &a, const glm::vec4 &b, float blend, float *target)
+		{
+			ax.push_back(a.x); ay.push_back(a.y); az.push_back(a.z); aw.push_back(a.w);
+			bx.push_back(b.x); by.push_back(b.y); bz.push_back(b.z); bw.push_back(b.w);
+			t.push_back(blend);
+			out.push_back(target);
+		}
+	};
+
+	vector<string> names;
+	vector<int> handles;
+	vector<AnimationPose> posesBySlot;
+	vector<Channel> channels;
+	vector<Instance> instances;
+	Batch vectors;
+	Batch rotations;
+	bool sampling;
+	size_t evaluated;
+
+	static float advance(const Instance &instance, float deltaTime)
+	{
+		float duration = instance.clip->duration;
+		float time = instance.time + instance.speed * deltaTime;
+		if (instance.loop && duration > 0.0f)
+		{
+			time = fmodf(time, duration);
+			if (time < 0.0f)
+				time += duration;
+		}
+		return glm::clamp(time, 0.0f, duration);
+	}
+
+	void gather(Channel &channel, float time)
+	{
+		const vector<float> &times = channel.track->times;
+		const vector<glm::vec4> &values = channel.track->values;
+		unsigned int last = (unsigned int)times.size() - 1;
+		unsigned int key = glm::min(channel.key, last);
+		while (key > 0 && times[key] > time)
+			key--;
+		while (key < last && times[key + 1] <= time)
+			key++;
+		channel.key = key;
+
+		unsigned int next = glm::min(key + 1, last);
+		float blend = 0.0f;
+		if (next != key)
+			blend = glm::clamp((time - times[key]) / (times[next] - times[key]), 0.0f, 1.0f);
+
+		AnimationPose &pose = posesBySlot[channel.slot];
+		if (channel.track->channel == CHANNEL_ROTATION)
+			rotations.push(values[key], values[next], blend, &pose.rotation.x);
+		else
+			vectors.push(values[key], values[next], blend, channel.track->channel == CHANNEL_TRANSLATION ? &pose.translation.x : &pose.scale.x);
+	}
+
+	void blendVectors()
+	{
+		size_t n = vectors.size();
+		float *ax = vectors.ax.data(), *ay = vectors.ay.data(), *az = vectors.az.data();
+		const float *bx = vectors.bx.data(), *by = vectors.by.data(), *bz = vectors.bz.data(), *t = vectors.t.data();
+		for (size_t i = 0; i < n; i++)
+		{
+			ax[i] += (bx[i] - ax[i]) * t[i];
+			ay[i] += (by[i] - ay[i]) * t[i];
+			az[i] += (bz[i] - az[i]) * t[i];
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			float *out = vectors.out[i];
+			out[0] = ax[i];
+			out[1] = ay[i];
+			out[2] = az[i];
+		}
+	}
+
+	// Normalized lerp with the blend factor bent towards slerp (Kapoulkine's polynomial fit), within ~3e-4 of a
+	// real slerp without any trigonometry. Keys were put on the same hemisphere when loading.
+	void blendRotations()
+	{
+		size_t n = rotations.size();
+		float *ax = rotations.ax.data(), *ay = rotations.ay.data(), *az = rotations.az.data(), *aw = rotations.aw.data();
+		const float *bx = rotations.bx.data(), *by = rotations.by.data(), *bz = rotations.bz.data(), *bw = rotations.bw.data();
+		const float *t = rotations.t.data();
+		for (size_t i = 0; i < n; i++)
+		{
+			float d = glm::min(ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i] + aw[i] * bw[i], 1.0f);
+			float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+			float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+			float h = t[i] - 0.5f;
+			float k = a * h * h + b;
+			float s = t[i] + t[i] * h * (t[i] - 1.0f) * k;
+			float x = ax[i] + (bx[i] - ax[i]) * s;
+			float y = ay[i] + (by[i] - ay[i]) * s;
+			float z = az[i] + (bz[i] - az[i]) * s;
+			float w = aw[i] + (bw[i] - aw[i]) * s;
+			float inv = 1.0f / sqrtf(x * x + y * y + z * z + w * w);
+			ax[i] = x * inv;
+			ay[i] = y * inv;
+			az[i] = z * inv;
+			aw[i] = w * inv;
+		}
+		// glm::quat stores x, y, z, w
+		for (size_t i = 0; i < n; i++)
+		{
+			float *out = rotations.out[i];
+			out[0] = ax[i];
+			out[1] = ay[i];
+			out[2] = az[i];
+			out[3] = aw[i];
+		}
+	}
+};
+#endif
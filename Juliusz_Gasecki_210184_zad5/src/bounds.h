@@ -0,0 +1,64 @@
+#pragma once
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cmath>
+
+// axis aligned bounding box, an empty box has min > max
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+	AABB(const glm::vec3 &min, const glm::vec3 &max) : min(min), max(max) {}
+
+	bool empty() const { return min.x > max.x; }
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+	glm::vec3 extents() const { return (max - min) * 0.5f; }
+
+	void expand(const glm::vec3 &point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+	void expand(const AABB &box)
+	{
+		if (box.empty())
+			return;
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+};
+
+struct BoundingSphere {
+	glm::vec3 center;
+	float radius;
+
+	BoundingSphere() : center(0.0f), radius(-1.0f) {}
+	BoundingSphere(const glm::vec3 &center, float radius) : center(center), radius(radius) {}
+};
+
+// Arvo's method: transform the center and take |M| * extents, so the result stays tight for rotations
+inline AABB transformAABB(const AABB &box, const glm::mat4 &m)
+{
+	if (box.empty())
+		return box;
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extents();
+	glm::vec3 worldCenter = glm::vec3(m * glm::vec4(c, 1.0f));
+	glm::vec3 worldExtents;
+	for (int i = 0; i < 3; i++)
+		worldExtents[i] = fabsf(m[0][i]) * e.x + fabsf(m[1][i]) * e.y + fabsf(m[2][i]) * e.z;
+	return AABB(worldCenter - worldExtents, worldCenter + worldExtents);
+}
+
+inline BoundingSphere transformSphere(const BoundingSphere &sphere, const glm::mat4 &m)
+{
+	glm::vec3 center = glm::vec3(m * glm::vec4(sphere.center, 1.0f));
+	float scale = glm::max(glm::length(glm::vec3(m[0])), glm::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+	return BoundingSphere(center, sphere.radius * scale);
+}
+#endif
@@ -0,0 +1,485 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "frustum.h"
+
+#include <vector>
+using namespace std;
+
+inline float surfaceArea(const AABB &box)
+{
+	glm::vec3 d = box.max - box.min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+inline AABB combine(const AABB &a, const AABB &b)
+{
+	return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+}
+
+inline bool contains(const AABB &outer, const AABB &inner)
+{
+	return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::greaterThanEqual(outer.max, inner.max));
+}
+
+inline bool overlaps(const AABB &a, const AABB &b)
+{
+	return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::greaterThanEqual(a.max, b.min));
+}
+
+enum FrustumTest {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+inline FrustumTest classifyAABB(const Frustum &frustum, const AABB &box)
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extents();
+	FrustumTest result = FRUSTUM_INSIDE;
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec4 &p = frustum.planes[i];
+		float d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+		float r = fabsf(p.x) * e.x + fabsf(p.y) * e.y + fabsf(p.z) * e.z;
+		if (d + r < 0.0f)
+			return FRUSTUM_OUTSIDE;
+		if (d - r < 0.0f)
+			result = FRUSTUM_INTERSECTS;
+	}
+	return result;
+}
+
+// Dynamic AABB tree for scene objects (after Box2D's b2DynamicTree).
+// Leaves store "fat" boxes grown by a margin, so an object that moves a little only needs a refit check and
+// nothing is touched in the tree. Inserts descend by the surface area cost of the combined box (the SAH
+// heuristic) and the tree is kept balanced with AVL style rotations. Every query prunes whole subtrees.
+class DynamicAabbTree
+{
+public:
+	static const int nullNode = -1;
+
+	DynamicAabbTree(float margin = 0.1f) : root(nullNode), freeList(nullNode), proxyCount(0), margin(margin) {}
+
+	// returns a proxy id that stays valid until destroyProxy
+	int createProxy(const AABB &box, int userData)
+	{
+		int proxy = allocateNode();
+		nodes[proxy].box = AABB(box.min - glm::vec3(margin), box.max + glm::vec3(margin));
+		nodes[proxy].userData = userData;
+		nodes[proxy].height = 0;
+		insertLeaf(proxy);
+		proxyCount++;
+		return proxy;
+	}
+
+	void destroyProxy(int proxy)
+	{
+		removeLeaf(proxy);
+		freeNode(proxy);
+		proxyCount--;
+	}
+
+	// Refit for a moved object. Returns false while the box still fits inside the fat box. Otherwise the leaf is
+	// reinserted with its fat box stretched along the displacement, so steady motion (the tram) is predicted.
+	bool moveProxy(int proxy, const AABB &box, const glm::vec3 &displacement = glm::vec3(0.0f))
+	{
+		if (contains(nodes[proxy].box, box))
+			return false;
+
+		removeLeaf(proxy);
+		AABB fat(box.min - glm::vec3(margin), box.max + glm::vec3(margin));
+		glm::vec3 d = displacement * 2.0f;
+		fat.min += glm::min(d, glm::vec3(0.0f));
+		fat.max += glm::max(d, glm::vec3(0.0f));
+		nodes[proxy].box = fat;
+		insertLeaf(proxy);
+		return true;
+	}
+
+	int getUserData(int proxy) const { return nodes[proxy].userData; }
+	const AABB &getFatAABB(int proxy) const { return nodes[proxy].box; }
+	int getHeight() const { return root == nullNode ? 0 : nodes[root].height; }
+	int getProxyCount() const { return proxyCount; }
+
+	// callback(int userData) -> bool, returning false stops the query
+	template <typename Callback>
+	void queryBox(const AABB &box, Callback callback) const
+	{
+		if (root == nullNode)
+			return;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int id = stack.back();
+			stack.pop_back();
+			const TreeNode &node = nodes[id];
+			if (!overlaps(node.box, box))
+				continue;
+			if (node.isLeaf())
+			{
+				if (!callback(node.userData))
+					return;
+			}
+			else
+			{
+				stack.push_back(node.child1);
+				stack.push_back(node.child2);
+			}
+		}
+	}
+
+	template <typename Callback>
+	void querySphere(const BoundingSphere &sphere, Callback callback) const
+	{
+		if (root == nullNode)
+			return;
+		float radius2 = sphere.radius * sphere.radius;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int id = stack.back();
+			stack.pop_back();
+			const TreeNode &node = nodes[id];
+			glm::vec3 closest = glm::clamp(sphere.center, node.box.min, node.box.max);
+			glm::vec3 d = closest - sphere.center;
+			if (glm::dot(d, d) > radius2)
+				continue;
+			if (node.isLeaf())
+			{
+				if (!callback(node.userData))
+					return;
+			}
+			else
+			{
+				stack.push_back(node.child1);
+				stack.push_back(node.child2);
+			}
+		}
+	}
+
+	// a subtree fully inside the frustum is reported without testing any of its planes again
+	template <typename Callback>
+	void queryFrustum(const Frustum &frustum, Callback callback) const
+	{
+		if (root == nullNode)
+			return;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int id = stack.back();
+			stack.pop_back();
+			const TreeNode &node = nodes[id];
+			FrustumTest test = classifyAABB(frustum, node.box);
+			if (test == FRUSTUM_OUTSIDE)
+				continue;
+			if (test == FRUSTUM_INSIDE)
+			{
+				if (!reportSubtree(id, callback))
+					return;
+			}
+			else if (node.isLeaf())
+			{
+				if (!callback(node.userData))
+					return;
+			}
+			else
+			{
+				stack.push_back(node.child1);
+				stack.push_back(node.child2);
+			}
+		}
+	}
+
+	// callback(int userData, float tEntry) -> float, the returned value becomes the new maximum distance
+	// (return tEntry to clip to the closest hit, maxT to keep going, a negative value to stop)
+	template <typename Callback>
+	void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, Callback callback) const
+	{
+		if (root == nullNode)
+			return;
+		glm::vec3 invDir = 1.0f / direction;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int id = stack.back();
+			stack.pop_back();
+			const TreeNode &node = nodes[id];
+			float tEntry;
+			if (!rayHitsBox(origin, invDir, node.box, maxT, tEntry))
+				continue;
+			if (node.isLeaf())
+			{
+				float t = callback(node.userData, tEntry);
+				if (t < 0.0f)
+					return;
+				maxT = glm::min(maxT, t);
+			}
+			else
+			{
+				stack.push_back(node.child1);
+				stack.push_back(node.child2);
+			}
+		}
+	}
+
+private:
+	struct TreeNode {
+		AABB box;
+		int parent;		// doubles as the next link while the node is on the free list
+		int child1;
+		int child2;
+		int height;		// leaf = 0, free node = -1
+		int userData;
+
+		bool isLeaf() const { return child1 == nullNode; }
+	};
+
+	vector<TreeNode> nodes;
+	int root;
+	int freeList;
+	int proxyCount;
+	float margin;
+	mutable vector<int> stack;
+
+	int allocateNode()
+	{
+		if (freeList == nullNode)
+		{
+			TreeNode node;
+			node.parent = nullNode;
+			nodes.push_back(node);
+			freeList = (int)nodes.size() - 1;
+		}
+		int id = freeList;
+		freeList = nodes[id].parent;
+		nodes[id].parent = nullNode;
+		nodes[id].child1 = nullNode;
+		nodes[id].child2 = nullNode;
+		nodes[id].height = 0;
+		nodes[id].userData = -1;
+		return id;
+	}
+
+	void freeNode(int id)
+	{
+		nodes[id].parent = freeList;
+		nodes[id].height = -1;
+		freeList = id;
+	}
+
+	template <typename Callback>
+	bool reportSubtree(int start, Callback &callback) const
+	{
+		// the caller's stack is still in use, so walk the subtree with a second one
+		subtreeStack.clear();
+		subtreeStack.push_back(start);
+		while (!subtreeStack.empty())
+		{
+			int id = subtreeStack.back();
+			subtreeStack.pop_back();
+			const TreeNode &node = nodes[id];
+			if (node.isLeaf())
+			{
+				if (!callback(node.userData))
+					return false;
+			}
+			else
+			{
+				subtreeStack.push_back(node.child1);
+				subtreeStack.push_back(node.child2);
+			}
+		}
+		return true;
+	}
+	mutable vector<int> subtreeStack;
+
+	static bool rayHitsBox(const glm::vec3 &origin, const glm::vec3 &invDir, const AABB &box, float maxT, float &tEntry)
+	{
+		glm::vec3 t0 = (box.min - origin) * invDir;
+		glm::vec3 t1 = (box.max - origin) * invDir;
+		glm::vec3 tMin = glm::min(t0, t1);
+		glm::vec3 tMax = glm::max(t0, t1);
+		float enter = glm::max(glm::max(tMin.x, tMin.y), glm::max(tMin.z, 0.0f));
+		float exit = glm::min(glm::min(tMax.x, tMax.y), glm::min(tMax.z, maxT));
+		tEntry = enter;
+		return enter <= exit;
+	}
+
+	void insertLeaf(int leaf)
+	{
+		if (root == nullNode)
+		{
+			root = leaf;
+			nodes[root].parent = nullNode;
+			return;
+		}
+
+		// find the best sibling: descend while creating a parent lower down is cheaper than creating it here
+		AABB leafBox = nodes[leaf].box;
+		int index = root;
+		while (!nodes[index].isLeaf())
+		{
+			int child1 = nodes[index].child1;
+			int child2 = nodes[index].child2;
+
+			float area = surfaceArea(nodes[index].box);
+			float combinedArea = surfaceArea(combine(nodes[index].box, leafBox));
+
+			// cost of pairing the leaf with this node, and the cost pushed down to either child
+			float cost = 2.0f * combinedArea;
+			float inheritanceCost = 2.0f * (combinedArea - area);
+
+			float cost1 = descendCost(child1, leafBox) + inheritanceCost;
+			float cost2 = descendCost(child2, leafBox) + inheritanceCost;
+
+			if (cost < cost1 && cost < cost2)
+				break;
+			index = cost1 < cost2 ? child1 : child2;
+		}
+		int sibling = index;
+
+		int oldParent = nodes[sibling].parent;
+		int newParent = allocateNode();
+		nodes[newParent].parent = oldParent;
+		nodes[newParent].box = combine(leafBox, nodes[sibling].box);
+		nodes[newParent].height = nodes[sibling].height + 1;
+		nodes[newParent].child1 = sibling;
+		nodes[newParent].child2 = leaf;
+		nodes[sibling].parent = newParent;
+		nodes[leaf].parent = newParent;
+
+		if (oldParent != nullNode)
+		{
+			if (nodes[oldParent].child1 == sibling)
+				nodes[oldParent].child1 = newParent;
+			else
+				nodes[oldParent].child2 = newParent;
+		}
+		else
+			root = newParent;
+
+		refitUpwards(nodes[leaf].parent);
+	}
+
+	float descendCost(int child, const AABB &leafBox) const
+	{
+		AABB box = combine(leafBox, nodes[child].box);
+		if (nodes[child].isLeaf())
+			return surfaceArea(box);
+		return surfaceArea(box) - surfaceArea(nodes[child].box);
+	}
+
+	void removeLeaf(int leaf)
+	{
+		if (leaf == root)
+		{
+			root = nullNode;
+			return;
+		}
+
+		int parent = nodes[leaf].parent;
+		int grandParent = nodes[parent].parent;
+		int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+		if (grandParent != nullNode)
+		{
+			// splice the sibling into the grandparent and drop the parent
+			if (nodes[grandParent].child1 == parent)
+				nodes[grandParent].child1 = sibling;
+			else
+				nodes[grandParent].child2 = sibling;
+			nodes[sibling].parent = grandParent;
+			freeNode(parent);
+			refitUpwards(grandParent);
+		}
+		else
+		{
+			root = sibling;
+			nodes[sibling].parent = nullNode;
+			freeNode(parent);
+		}
+	}
+
+	// walks to the root rebalancing and recomputing boxes and heights
+	void refitUpwards(int index)
+	{
+		while (index != nullNode)
+		{
+			index = balance(index);
+			int child1 = nodes[index].child1;
+			int child2 = nodes[index].child2;
+			nodes[index].height = 1 + glm::max(nodes[child1].height, nodes[child2].height);
+			nodes[index].box = combine(nodes[child1].box, nodes[child2].box);
+			index = nodes[index].parent;
+		}
+	}
+
+	// rotates the taller grandchild up when the children of A differ in height by more than one, returns the new subtree root
+	int balance(int iA)
+	{
+		TreeNode &A = nodes[iA];
+		if (A.isLeaf() || A.height < 2)
+			return iA;
+
+		int iB = A.child1;
+		int iC = A.child2;
+		int difference = nodes[iC].height - nodes[iB].height;
+		if (difference > 1)
+			return rotate(iA, iC, iB, true);
+		if (difference < -1)
+			return rotate(iA, iB, iC, false);
+		return iA;
+	}
+
+	// promotes the child "up" over A, "other" is A's remaining child, upIsChild2 tells which slot of A "up" occupied
+	int rotate(int iA, int iUp, int iOther, bool upIsChild2)
+	{
+		TreeNode &A = nodes[iA];
+		TreeNode &Up = nodes[iUp];
+		int iF = Up.child1;
+		int iG = Up.child2;
+		TreeNode &F = nodes[iF];
+		TreeNode &G = nodes[iG];
+
+		// Up takes A's place
+		Up.child1 = iA;
+		Up.parent = A.parent;
+		A.parent = iUp;
+		if (Up.parent != nullNode)
+		{
+			if (nodes[Up.parent].child1 == iA)
+				nodes[Up.parent].child1 = iUp;
+			else
+				nodes[Up.parent].child2 = iUp;
+		}
+		else
+			root = iUp;
+
+		// the taller of Up's children stays with Up, the shorter one moves under A
+		int iKeep = F.height > G.height ? iF : iG;
+		int iMove = F.height > G.height ? iG : iF;
+		Up.child2 = iKeep;
+		if (upIsChild2)
+			A.child2 = iMove;
+		else
+			A.child1 = iMove;
+		nodes[iMove].parent = iA;
+
+		A.box = combine(nodes[iOther].box, nodes[iMove].box);
+		Up.box = combine(A.box, nodes[iKeep].box);
+		A.height = 1 + glm::max(nodes[iOther].height, nodes[iMove].height);
+		Up.height = 1 + glm::max(A.height, nodes[iKeep].height);
+		return iUp;
+	}
+};
+#endif
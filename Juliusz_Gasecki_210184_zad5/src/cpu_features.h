@@ -0,0 +1,102 @@
+#pragma once
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+
+// Functions using wider instruction sets than the build baseline are tagged with these, so one binary
+// carries every path and picks at runtime. MSVC emits any intrinsic without a per-function switch.
+#if defined(_MSC_VER)
+#define PAG_TARGET_SSE41
+#define PAG_TARGET_AVX
+#define PAG_TARGET_AVX2
+#else
+#define PAG_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define PAG_TARGET_AVX __attribute__((target("avx")))
+#define PAG_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE41 = 1,
+	SIMD_AVX = 2,
+	SIMD_AVX2 = 3
+};
+
+struct CpuFeatures {
+	bool sse41;
+	bool avx;
+	bool avx2;
+	bool fma;
+};
+
+inline void cpuidQuery(int leaf, int subleaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, subleaf);
+	for (int i = 0; i < 4; i++)
+		regs[i] = (unsigned int)r[i];
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// reads the feature bits once, AVX is only reported when the OS also saves the YMM registers
+inline CpuFeatures detectCpuFeatures()
+{
+	CpuFeatures features = { false, false, false, false };
+	unsigned int regs[4];
+	cpuidQuery(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+	if (maxLeaf < 1)
+		return features;
+
+	cpuidQuery(1, 0, regs);
+	features.sse41 = (regs[2] & (1u << 19)) != 0;
+	bool osxsave = (regs[2] & (1u << 27)) != 0;
+	bool avx = (regs[2] & (1u << 28)) != 0;
+	features.fma = (regs[2] & (1u << 12)) != 0;
+	if (osxsave && avx)
+	{
+#if defined(_MSC_VER)
+		unsigned long long xcr0 = _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+		features.avx = (xcr0 & 0x6) == 0x6;
+	}
+	if (features.avx && maxLeaf >= 7)
+	{
+		cpuidQuery(7, 0, regs);
+		features.avx2 = (regs[1] & (1u << 5)) != 0;
+	}
+	features.fma = features.fma && features.avx;
+	return features;
+}
+
+inline const CpuFeatures &cpuFeatures()
+{
+	static const CpuFeatures features = detectCpuFeatures();
+	return features;
+}
+
+inline SimdLevel bestSimdLevel()
+{
+	const CpuFeatures &f = cpuFeatures();
+	if (f.avx2 && f.fma)
+		return SIMD_AVX2;
+	if (f.avx)
+		return SIMD_AVX;
+	if (f.sse41)
+		return SIMD_SSE41;
+	return SIMD_SCALAR;
+}
+#endif
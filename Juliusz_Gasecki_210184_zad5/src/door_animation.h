@@ -0,0 +1,207 @@
+#pragma once
+#ifndef DOOR_ANIMATION_H
+#define DOOR_ANIMATION_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "animation.h"
+#include "gl_handles.h"
+#include "bounds.h"
+
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// DoorAnimation in door_anim.vs, std430 (112 bytes). Everything but the anchor (the w of closedScale, openScale
+// and pivot) is written once; the anchor is rewritten only when the door's clip changes speed.
+struct GpuDoorAnimation {
+	glm::vec4 closedTranslation;	// w = easing curve
+	glm::vec4 openTranslation;		// w = clip duration
+	glm::vec4 closedScale;			// w = clip time at the anchor
+	glm::vec4 openScale;			// w = playback speed from the anchor on
+	glm::vec4 baseRotation;			// quaternion (x, y, z, w) when closed
+	glm::vec4 axisAngle;			// rotation from closed to open, axis + radians
+	glm::vec4 pivot;				// rotation centre in door space, w = simulation time of the anchor
+};
+
+// GPU evaluated door animation. Every Animator pose slot gets one GpuDoorAnimation built from the first and last
+// key of the clip animating it, door_anim.vs turns that and the shared animationTime uniform into the local
+// matrix. Between speed changes of a clip nothing is written: an opening door is "anchor time + speed * elapsed",
+// so a fleet of doors costs the CPU nothing per frame. Needs the 4.6 multi-draw path that feeds door_anim.vs.
+class GpuDoorAnimations
+{
+public:
+	static const GLuint BINDING = 6;
+	// slots written since creation, the initial upload included
+	unsigned int writes;
+
+	static bool supported()
+	{
+		return GLAD_GL_VERSION_4_6 != 0;
+	}
+
+	// the clips have to be two-key tracks spanning the whole clip (or constant), anything else is rejected
+	explicit GpuDoorAnimations(const Animator &animator) : writes(0), valid(true)
+	{
+		const vector<AnimationPose> &rest = animator.poses();
+		doors.resize(rest.size());
+		for (unsigned int slot = 0; slot < rest.size(); slot++)
+			doors[slot] = makeStatic(rest[slot]);
+		instanceSlots.resize(animator.instanceCount());
+		for (unsigned int i = 0; i < animator.instanceCount(); i++)
+		{
+			const AnimationClip &clip = animator.getClip(i);
+			for (unsigned int t = 0; t < clip.tracks.size(); t++)
+			{
+				const AnimationTrack &track = clip.tracks[t];
+				int slot = animator.findTarget(track.target);
+				if (slot < 0)
+					continue;
+				if (!addTrack(doors[slot], clip, track))
+				{
+					cout << "ERROR::DOOR_ANIMATION:: track " << track.target << " of clip " << clip.name
+						<< " needs one key or two keys at 0 and the clip duration" << endl;
+					valid = false;
+				}
+				doors[slot].closedTranslation.w = (float)clip.easing;
+				doors[slot].openTranslation.w = clip.duration;
+				if (instanceSlots[i].empty() || instanceSlots[i].back() != (unsigned int)slot)
+					instanceSlots[i].push_back(slot);
+			}
+		}
+		speeds.assign(animator.instanceCount(), 0.0f);
+		synced.assign(animator.instanceCount(), false);
+
+		buffer = GpuBuffer::create();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.id());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, glm::max(doors.size(), (size_t)1) * sizeof(GpuDoorAnimation), doors.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		writes += (unsigned int)doors.size();
+	}
+
+	bool isValid() const { return valid; }
+
+	// Re-anchors the doors of every clip whose speed changed since the last call. playback is indexed like the
+	// animator's instances and was taken at simulation time anchorTime. Returns the number of slots written.
+	unsigned int sync(const vector<AnimationPlayback> &playback, float anchorTime)
+	{
+		unsigned int written = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.id());
+		for (unsigned int i = 0; i < playback.size() && i < synced.size(); i++)
+		{
+			if (synced[i] && playback[i].speed == speeds[i])
+				continue;
+			synced[i] = true;
+			speeds[i] = playback[i].speed;
+			for (unsigned int s = 0; s < instanceSlots[i].size(); s++)
+			{
+				unsigned int slot = instanceSlots[i][s];
+				doors[slot].closedScale.w = playback[i].time;
+				doors[slot].openScale.w = playback[i].speed;
+				doors[slot].pivot.w = anchorTime;
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * sizeof(GpuDoorAnimation), sizeof(GpuDoorAnimation), &doors[slot]);
+				written++;
+			}
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		writes += written;
+		return written;
+	}
+
+	// the next sync() rewrites every anchor, e.g. after the CPU path was used for a while
+	void invalidate()
+	{
+		synced.assign(synced.size(), false);
+	}
+
+	void bind() const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, buffer.id());
+	}
+
+	// CPU copy of doorTransform() in door_anim.vs at a played fraction of the clip (before easing)
+	glm::mat4 localMatrix(unsigned int slot, float fraction) const
+	{
+		const GpuDoorAnimation &door = doors[slot];
+		float amount = applyEasing((AnimationEasing)(int)door.closedTranslation.w, fraction);
+		glm::vec3 translation = glm::mix(glm::vec3(door.closedTranslation), glm::vec3(door.openTranslation), amount);
+		glm::vec3 scale = glm::mix(glm::vec3(door.closedScale), glm::vec3(door.openScale), amount);
+		glm::quat base(door.baseRotation.w, door.baseRotation.x, door.baseRotation.y, door.baseRotation.z);
+		glm::quat rotation = glm::angleAxis(door.axisAngle.w * amount, glm::vec3(door.axisAngle)) * base;
+		glm::mat3 r = glm::mat3_cast(rotation);
+		glm::vec3 pivot(door.pivot);
+		return glm::mat4(glm::vec4(r[0] * scale.x, 0.0f), glm::vec4(r[1] * scale.y, 0.0f), glm::vec4(r[2] * scale.z, 0.0f),
+			glm::vec4(translation + pivot - r * pivot, 1.0f));
+	}
+
+	// bounds covering the door over its whole motion, in the parent's space; the CPU culls against these while the
+	// shader animates, so they never need updating
+	AABB sweptBounds(unsigned int slot, const AABB &bounds) const
+	{
+		AABB swept;
+		const int samples = 16;
+		for (int i = 0; i <= samples; i++)
+			swept.expand(transformAABB(bounds, localMatrix(slot, (float)i / samples)));
+		// rotation bulges slightly between samples
+		glm::vec3 margin = swept.extents() * 0.02f;
+		return AABB(swept.min - margin, swept.max + margin);
+	}
+
+	unsigned int slotCount() const { return (unsigned int)doors.size(); }
+
+private:
+	GpuBuffer buffer;
+	bool valid;
+	vector<GpuDoorAnimation> doors;
+	vector<vector<unsigned int> > instanceSlots;
+	vector<float> speeds;
+	vector<bool> synced;
+
+	static GpuDoorAnimation makeStatic(const AnimationPose &pose)
+	{
+		GpuDoorAnimation door;
+		door.closedTranslation = door.openTranslation = glm::vec4(pose.translation, 0.0f);
+		door.closedScale = door.openScale = glm::vec4(pose.scale, 0.0f);
+		door.baseRotation = glm::vec4(pose.rotation.x, pose.rotation.y, pose.rotation.z, pose.rotation.w);
+		door.axisAngle = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+		door.pivot = glm::vec4(0.0f);
+		return door;
+	}
+
+	static bool addTrack(GpuDoorAnimation &door, const AnimationClip &clip, const AnimationTrack &track)
+	{
+		const vector<float> &times = track.times;
+		if (times.size() > 2 || (times.size() == 2 && (times[0] != 0.0f || fabsf(times[1] - clip.duration) > 1e-4f)))
+			return false;
+		glm::vec4 first = track.values.front();
+		glm::vec4 last = track.values.back();
+		if (track.channel == CHANNEL_TRANSLATION)
+		{
+			door.closedTranslation = glm::vec4(glm::vec3(first), 0.0f);
+			door.openTranslation = glm::vec4(glm::vec3(last), 0.0f);
+		}
+		else if (track.channel == CHANNEL_SCALE)
+		{
+			door.closedScale = glm::vec4(glm::vec3(first), 0.0f);
+			door.openScale = glm::vec4(glm::vec3(last), 0.0f);
+		}
+		else
+		{
+			glm::quat from(first.w, first.x, first.y, first.z);
+			glm::quat to(last.w, last.x, last.y, last.z);
+			glm::quat delta = to * glm::inverse(from);
+			if (delta.w < 0.0f)
+				delta = -delta;
+			float sinHalf = glm::length(glm::vec3(delta.x, delta.y, delta.z));
+			door.baseRotation = first;
+			door.axisAngle = sinHalf > 1e-6f
+				? glm::vec4(glm::vec3(delta.x, delta.y, delta.z) / sinHalf, 2.0f * atan2f(sinHalf, delta.w))
+				: glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+		}
+		return true;
+	}
+};
+#endif
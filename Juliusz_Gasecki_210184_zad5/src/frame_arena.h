@@ -0,0 +1,136 @@
+#pragma once
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+// Bump allocator for data that lives at most until the end of the frame. Every thread has its own arena
+// (FrameArena::local()); FrameArena::beginFrame() starts a new frame for all of them, each arena rewinds the
+// first time its thread allocates afterwards. Freeing is a no-op, nothing allocated in a frame may be used
+// after the next beginFrame().
+class FrameArena
+{
+public:
+	static const size_t DEFAULT_CAPACITY = 4 << 20;
+
+	explicit FrameArena(size_t capacity = DEFAULT_CAPACITY)
+		: buffer((unsigned char *)::operator new(capacity)), capacity(capacity), used(0), peak(0), overflows(0), frame(0)
+	{
+	}
+
+	~FrameArena()
+	{
+		::operator delete(buffer);
+	}
+
+	void *allocate(size_t bytes, size_t alignment)
+	{
+		unsigned int current = frameCounter().load(memory_order_acquire);
+		if (current != frame)
+		{
+			frame = current;
+			used = 0;
+		}
+		size_t start = (used + alignment - 1) & ~(alignment - 1);
+		if (start + bytes > capacity)
+		{
+			// still correct, just not free: the block comes from the heap and deallocate() hands it back
+			if (overflows++ == 0)
+				cout << "ERROR::FRAME_ARENA:: " << capacity << " bytes exhausted, falling back to the heap" << endl;
+			return ::operator new(bytes);
+		}
+		used = start + bytes;
+		if (used > peak)
+			peak = used;
+		return buffer + start;
+	}
+
+	void deallocate(void *memory)
+	{
+		if (!owns(memory))
+			::operator delete(memory);
+	}
+
+	bool owns(const void *memory) const
+	{
+		return memory >= buffer && memory < buffer + capacity;
+	}
+
+	// bytes used this frame and the most any frame used so far
+	size_t bytesUsed() const { return used; }
+	size_t peakBytes() const { return peak; }
+	// allocations that did not fit and went to the heap
+	unsigned int overflowCount() const { return overflows; }
+
+	// the calling thread's arena
+	static FrameArena &local()
+	{
+		static thread_local FrameArena arena;
+		return arena;
+	}
+
+	// called once per frame by the main thread, before anything allocates for the frame
+	static void beginFrame()
+	{
+		frameCounter().fetch_add(1, memory_order_release);
+	}
+
+private:
+	unsigned char *buffer;
+	size_t capacity;
+	size_t used;
+	size_t peak;
+	unsigned int overflows;
+	unsigned int frame;
+
+	FrameArena(const FrameArena &);
+	FrameArena &operator=(const FrameArena &);
+
+	static atomic<unsigned int> &frameCounter()
+	{
+		static atomic<unsigned int> counter(0);
+		return counter;
+	}
+};
+
+// STL allocator on a FrameArena, by default the arena of the thread that creates the container. A container
+// using it must only grow on that thread and must not outlive the frame.
+template <typename T>
+struct FrameAllocator {
+	typedef T value_type;
+	typedef true_type propagate_on_container_copy_assignment;
+	typedef true_type propagate_on_container_move_assignment;
+	typedef true_type propagate_on_container_swap;
+
+	FrameArena *arena;
+
+	FrameAllocator() : arena(&FrameArena::local()) {}
+	explicit FrameAllocator(FrameArena &arena) : arena(&arena) {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U> &other) : arena(other.arena) {}
+
+	T *allocate(size_t count)
+	{
+		size_t alignment = alignof(T) > sizeof(void *) ? alignof(T) : sizeof(void *);
+		return (T *)arena->allocate(count * sizeof(T), alignment);
+	}
+	void deallocate(T *memory, size_t)
+	{
+		arena->deallocate(memory);
+	}
+};
+
+template <typename T, typename U>
+inline bool operator==(const FrameAllocator<T> &a, const FrameAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+inline bool operator!=(const FrameAllocator<T> &a, const FrameAllocator<U> &b) { return a.arena != b.arena; }
+
+template <typename T>
+using FrameVector = vector<T, FrameAllocator<T> >;
+#endif
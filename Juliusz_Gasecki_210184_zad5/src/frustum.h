@@ -0,0 +1,206 @@
+#pragma once
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "cpu_features.h"
+
+#include <vector>
+using namespace std;
+
+// six planes (left, right, bottom, top, near, far) as (n, d) with n pointing inside, n.p + d >= 0 means inside
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann extraction from the combined projection * view matrix, planes come out normalized
+inline Frustum extractFrustum(const glm::mat4 &viewProjection)
+{
+	const glm::mat4 &m = viewProjection;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+	for (int i = 0; i < 6; i++)
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	return frustum;
+}
+
+inline bool frustumContainsAABB(const Frustum &frustum, const AABB &box)
+{
+	glm::vec3 c = box.center();
+	glm::vec3 e = box.extents();
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec4 &p = frustum.planes[i];
+		float d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+		float r = fabsf(p.x) * e.x + fabsf(p.y) * e.y + fabsf(p.z) * e.z;
+		if (d + r < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+inline bool frustumContainsSphere(const Frustum &frustum, const BoundingSphere &sphere)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec4 &p = frustum.planes[i];
+		if (glm::dot(glm::vec3(p), sphere.center) + p.w < -sphere.radius)
+			return false;
+	}
+	return true;
+}
+
+struct CullStats {
+	unsigned int visible;
+	unsigned int culled;
+};
+
+// Bounds are kept as center/extent SoA streams padded to a multiple of 8, so the tests run 4 or 8 boxes
+// per plane per instruction. The widest path supported by the CPU is picked once at construction.
+class FrustumCuller
+{
+public:
+	CullStats stats;
+
+	FrustumCuller() : count(0), level(bestSimdLevel())
+	{
+		stats.visible = stats.culled = 0;
+	}
+
+	void clear()
+	{
+		count = 0;
+		cx.clear(); cy.clear(); cz.clear();
+		ex.clear(); ey.clear(); ez.clear();
+	}
+
+	// returns the slot to query with visible() after cull()
+	unsigned int add(const AABB &box)
+	{
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extents();
+		if (box.empty())
+		{
+			// never visible: pushed to infinity, one of each pair of opposing planes rejects it
+			c = glm::vec3(FLT_MAX);
+			e = glm::vec3(0.0f);
+		}
+		cx.push_back(c.x); cy.push_back(c.y); cz.push_back(c.z);
+		ex.push_back(e.x); ey.push_back(e.y); ez.push_back(e.z);
+		return count++;
+	}
+
+	void cull(const Frustum &frustum)
+	{
+		// pad the streams with empty boxes so the SIMD loops never need a tail
+		unsigned int padded = (count + 7) & ~7u;
+		for (unsigned int i = count; i < padded; i++)
+		{
+			cx.push_back(0.0f); cy.push_back(0.0f); cz.push_back(0.0f);
+			ex.push_back(0.0f); ey.push_back(0.0f); ez.push_back(0.0f);
+		}
+		results.assign(padded, 0);
+
+		if (level >= SIMD_AVX)
+			cullAVX(frustum, padded);
+		else if (level >= SIMD_SSE41)
+			cullSSE(frustum, padded);
+		else
+			cullScalar(frustum, padded);
+
+		// drop the padding again so add() keeps appending after the real boxes
+		cx.resize(count); cy.resize(count); cz.resize(count);
+		ex.resize(count); ey.resize(count); ez.resize(count);
+
+		stats.visible = 0;
+		for (unsigned int i = 0; i < count; i++)
+			stats.visible += results[i];
+		stats.culled = count - stats.visible;
+	}
+
+	bool visible(unsigned int slot) const { return results[slot] != 0; }
+	unsigned int size() const { return count; }
+	SimdLevel simdLevel() const { return level; }
+	void setSimdLevel(SimdLevel simd) { level = simd < bestSimdLevel() ? simd : bestSimdLevel(); }
+
+private:
+	unsigned int count;
+	SimdLevel level;
+	vector<float> cx, cy, cz, ex, ey, ez;
+	vector<unsigned char> results;
+
+	void cullScalar(const Frustum &frustum, unsigned int n)
+	{
+		for (unsigned int i = 0; i < n; i++)
+		{
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				const glm::vec4 &pl = frustum.planes[p];
+				float d = pl.x * cx[i] + pl.y * cy[i] + pl.z * cz[i] + pl.w;
+				float r = fabsf(pl.x) * ex[i] + fabsf(pl.y) * ey[i] + fabsf(pl.z) * ez[i];
+				inside = d + r >= 0.0f;
+			}
+			results[i] = inside ? 1 : 0;
+		}
+	}
+
+	PAG_TARGET_SSE41 void cullSSE(const Frustum &frustum, unsigned int n)
+	{
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		for (unsigned int i = 0; i < n; i += 4)
+		{
+			__m128 px = _mm_loadu_ps(&cx[i]), py = _mm_loadu_ps(&cy[i]), pz = _mm_loadu_ps(&cz[i]);
+			__m128 qx = _mm_loadu_ps(&ex[i]), qy = _mm_loadu_ps(&ey[i]), qz = _mm_loadu_ps(&ez[i]);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &pl = frustum.planes[p];
+				__m128 nx = _mm_set1_ps(pl.x), ny = _mm_set1_ps(pl.y), nz = _mm_set1_ps(pl.z);
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)), _mm_add_ps(_mm_mul_ps(nz, pz), _mm_set1_ps(pl.w)));
+				__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), qx), _mm_mul_ps(_mm_andnot_ps(signMask, ny), qy)),
+					_mm_mul_ps(_mm_andnot_ps(signMask, nz), qz));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for (int k = 0; k < 4; k++)
+				results[i + k] = (unsigned char)((mask >> k) & 1);
+		}
+	}
+
+	PAG_TARGET_AVX void cullAVX(const Frustum &frustum, unsigned int n)
+	{
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		for (unsigned int i = 0; i < n; i += 8)
+		{
+			__m256 px = _mm256_loadu_ps(&cx[i]), py = _mm256_loadu_ps(&cy[i]), pz = _mm256_loadu_ps(&cz[i]);
+			__m256 qx = _mm256_loadu_ps(&ex[i]), qy = _mm256_loadu_ps(&ey[i]), qz = _mm256_loadu_ps(&ez[i]);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &pl = frustum.planes[p];
+				__m256 nx = _mm256_set1_ps(pl.x), ny = _mm256_set1_ps(pl.y), nz = _mm256_set1_ps(pl.z);
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, px), _mm256_mul_ps(ny, py)), _mm256_add_ps(_mm256_mul_ps(nz, pz), _mm256_set1_ps(pl.w)));
+				__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), qx), _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), qy)),
+					_mm256_mul_ps(_mm256_andnot_ps(signMask, nz), qz));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			int mask = _mm256_movemask_ps(inside);
+			for (int k = 0; k < 8; k++)
+				results[i + k] = (unsigned char)((mask >> k) & 1);
+		}
+	}
+};
+#endif
@@ -0,0 +1,525 @@
+#pragma once
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include "mesh.h"
+#include "gl_handles.h"
+#include "gl_resources.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// the pulling shaders are the 4.6 multi-draw ones
+inline bool supportsVertexPulling()
+{
+	return GLAD_GL_VERSION_4_6 != 0;
+}
+
+// How a GeometryArena stores the Vertex data: as Vertex structs in one stream, or as a tightly packed position
+// stream plus a stream with everything else, so passes that only need positions read 12 bytes per vertex
+// instead of 56.
+enum VertexLayout {
+	LAYOUT_INTERLEAVED,
+	LAYOUT_SPLIT
+};
+
+// One vertex stream of a GeometryArena: the attributes of the mask packed in location order, so an attribute
+// no shader reads takes no space. Sizes and formats are ModelVertexLayout's, with every attribute it is exactly
+// the Vertex struct.
+struct StreamLayout {
+	static const GLuint ABSENT = ~0u;
+
+	GLuint stride;	// bytes per vertex, 0 for an unused stream
+	GLuint offsets[VERTEX_ATTRIBUTE_COUNT];	// ABSENT for attributes the stream does not hold
+
+	static StreamLayout pack(VertexAttributeMask attributes)
+	{
+		StreamLayout stream;
+		stream.stride = 0;
+		for (unsigned int a = 0; a < VERTEX_ATTRIBUTE_COUNT; a++)
+			if (attributes & (1u << a))
+			{
+				stream.offsets[a] = stream.stride;
+				stream.stride += ModelVertexLayout::size(a);
+			}
+			else
+				stream.offsets[a] = ABSENT;
+		return stream;
+	}
+
+	bool holds(unsigned int attribute) const { return offsets[attribute] != ABSENT; }
+};
+
+// Where the attributes sit in the pulled streams, in 32-bit words; the vertexFormat uniform of indirect.vs and
+// door_anim.vs. The position is at the start of its stream's vertex in both layouts. positionStride 0 tells the
+// shaders to read the classic vertex attributes instead. Missing attributes read from offset 0.
+struct VertexFormat {
+	GLuint positionStride;
+	GLuint attributeStride;
+	GLuint normal;
+	GLuint texCoords;
+
+	static VertexFormat of(const StreamLayout &positions, const StreamLayout &attributes)
+	{
+		VertexFormat format;
+		format.positionStride = positions.stride / 4;
+		format.attributeStride = attributes.stride / 4;
+		format.normal = attributes.holds(ATTRIBUTE_NORMAL) ? attributes.offsets[ATTRIBUTE_NORMAL] / 4 : 0;
+		format.texCoords = attributes.holds(ATTRIBUTE_TEXCOORDS) ? attributes.offsets[ATTRIBUTE_TEXCOORDS] / 4 : 0;
+		return format;
+	}
+};
+
+// First-fit free list over [0, capacity) in elements. Free blocks are kept sorted by offset and merged with their
+// neighbours when a range is freed, so the list stays as short as the holes are many.
+class RangeAllocator
+{
+public:
+	static const unsigned int INVALID = ~0u;
+
+	explicit RangeAllocator(unsigned int capacity = 0) : total(0)
+	{
+		reset(capacity, 0);
+	}
+
+	// everything below used is allocated, the rest is one free block
+	void reset(unsigned int capacity, unsigned int used)
+	{
+		total = capacity;
+		blocks.clear();
+		if (used < capacity)
+			blocks.push_back(Block(used, capacity - used));
+	}
+
+	// offset of size free elements, INVALID when no block is large enough
+	unsigned int allocate(unsigned int size)
+	{
+		if (size == 0)
+			return 0;
+		for (unsigned int b = 0; b < blocks.size(); b++)
+			if (blocks[b].size >= size)
+			{
+				unsigned int offset = blocks[b].offset;
+				blocks[b].offset += size;
+				blocks[b].size -= size;
+				if (blocks[b].size == 0)
+					blocks.erase(blocks.begin() + b);
+				return offset;
+			}
+		return INVALID;
+	}
+
+	void free(unsigned int offset, unsigned int size)
+	{
+		if (size == 0)
+			return;
+		unsigned int b = 0;
+		while (b < blocks.size() && blocks[b].offset < offset)
+			b++;
+		bool mergePrevious = b > 0 && blocks[b - 1].offset + blocks[b - 1].size == offset;
+		bool mergeNext = b < blocks.size() && offset + size == blocks[b].offset;
+		if (mergePrevious && mergeNext)
+		{
+			blocks[b - 1].size += size + blocks[b].size;
+			blocks.erase(blocks.begin() + b);
+		}
+		else if (mergePrevious)
+			blocks[b - 1].size += size;
+		else if (mergeNext)
+		{
+			blocks[b].offset = offset;
+			blocks[b].size += size;
+		}
+		else
+			blocks.insert(blocks.begin() + b, Block(offset, size));
+	}
+
+	// adds [capacity, newCapacity) as free space
+	void grow(unsigned int newCapacity)
+	{
+		unsigned int old = total;
+		total = newCapacity;
+		free(old, newCapacity - old);
+	}
+
+	unsigned int capacity() const { return total; }
+	unsigned int freeBlocks() const { return (unsigned int)blocks.size(); }
+
+	unsigned int freeElements() const
+	{
+		unsigned int sum = 0;
+		for (unsigned int b = 0; b < blocks.size(); b++)
+			sum += blocks[b].size;
+		return sum;
+	}
+
+	unsigned int largestFree() const
+	{
+		unsigned int largest = 0;
+		for (unsigned int b = 0; b < blocks.size(); b++)
+			largest = max(largest, blocks[b].size);
+		return largest;
+	}
+
+private:
+	struct Block {
+		unsigned int offset;
+		unsigned int size;
+
+		Block(unsigned int offset, unsigned int size) : offset(offset), size(size) {}
+	};
+
+	unsigned int total;
+	vector<Block> blocks;
+};
+
+// occupancy of one GeometryArena, in vertices and indices
+struct GeometryArenaStats {
+	unsigned int allocations;
+	unsigned int vertexCapacity, verticesUsed, vertexFreeBlocks, largestFreeVertices;
+	unsigned int indexCapacity, indicesUsed, indexFreeBlocks, largestFreeIndices;
+
+	// 0 while the free space is one block, towards 1 the more it is split into holes
+	float vertexFragmentation() const { return fragmentation(vertexCapacity - verticesUsed, largestFreeVertices); }
+	float indexFragmentation() const { return fragmentation(indexCapacity - indicesUsed, largestFreeIndices); }
+
+private:
+	static float fragmentation(unsigned int freeTotal, unsigned int largest)
+	{
+		return freeTotal ? 1.0f - (float)largest / (float)freeTotal : 0.0f;
+	}
+};
+
+// Vertex and index buffers of the Mesh vertex format, or the part of it the attribute mask keeps, suballocated between every mesh loaded into it.
+// A mesh is an allocation whose range is drawn with glDrawElementsBaseVertex (indices stay relative to the
+// mesh), so all of them share one VAO and can go into one multi-draw. Freed ranges go back to the free lists;
+// compact() packs the live ones to the front again, which moves them: ranges must be re-read afterwards
+// (generation() changes). The buffers only grow when an allocation does not fit, never per frame.
+//
+// Passes that only need positions (depth, shadows, picking) bind positionVAO, which sources just the position
+// stream. The mask is meant to be what the arena's shaders read (activeVertexAttributes), so e.g. tangents
+// only get memory when some shader does normal mapping; attributes outside it stay disabled in the VAO and read
+// as 0. With vertex pulling on, the streams are read as storage buffers by gl_VertexID and the VAO used only
+// carries the index buffer, so any vertex layout can share a multi-draw as long as its format is described.
+class GeometryArena
+{
+public:
+	static const GLuint POSITION_PULL_BINDING = 7;	// PositionPool block in indirect.vs/door_anim.vs
+	static const GLuint ATTRIBUTE_PULL_BINDING = 8;	// AttributePool block
+
+	VertexArray VAO;			// every attribute
+	VertexArray positionVAO;	// attribute 0 only
+	VertexArray pullVAO;		// index buffer only, created when the context can pull
+	VertexFormat format;
+	bool vertexPulling;
+
+	// the position is always kept, whatever the mask says
+	GeometryArena(VertexLayout layout = LAYOUT_SPLIT, VertexAttributeMask attributes = ALL_VERTEX_ATTRIBUTES,
+		unsigned int vertexCapacity = 1 << 16, unsigned int indexCapacity = 1 << 18)
+		: vertexPulling(false), layout(layout), attributeMask(attributes | (1u << ATTRIBUTE_POSITION)),
+		vertexSpace(vertexCapacity), indexSpace(indexCapacity), freeRecord(~0u), live(0), generationCount(0)
+	{
+		if (layout == LAYOUT_SPLIT)
+		{
+			streamLayouts[0] = StreamLayout::pack(1u << ATTRIBUTE_POSITION);
+			streamLayouts[1] = StreamLayout::pack(attributeMask & ~(1u << ATTRIBUTE_POSITION));
+			format = VertexFormat::of(streamLayouts[0], streamLayouts[1]);
+		}
+		else
+		{
+			streamLayouts[0] = StreamLayout::pack(attributeMask);
+			streamLayouts[1] = StreamLayout::pack(0);
+			format = VertexFormat::of(streamLayouts[0], streamLayouts[0]);
+		}
+		createBuffers(vertexCapacity, indexCapacity);
+	}
+
+	VertexLayout vertexLayout() const { return layout; }
+	VertexAttributeMask attributes() const { return attributeMask; }
+	// bytes a full vertex takes over all streams
+	unsigned int vertexSize() const { return streamStride(0) + streamStride(1); }
+	// bytes a position-only pass reads per vertex
+	unsigned int positionStride() const { return streamStride(0); }
+
+	// copies the mesh data into free ranges, growing the buffers when there are none large enough
+	unsigned int allocate(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+	{
+		unsigned int vertexCount = (unsigned int)vertices.size();
+		unsigned int indexCount = (unsigned int)indices.size();
+		unsigned int firstVertex = vertexSpace.allocate(vertexCount);
+		unsigned int firstIndex = indexSpace.allocate(indexCount);
+		if (firstVertex == RangeAllocator::INVALID || firstIndex == RangeAllocator::INVALID)
+		{
+			if (firstVertex != RangeAllocator::INVALID)
+				vertexSpace.free(firstVertex, vertexCount);
+			if (firstIndex != RangeAllocator::INVALID)
+				indexSpace.free(firstIndex, indexCount);
+			// doubling until the new tail alone fits, so loading many meshes grows a logarithmic number of times
+			unsigned int vertexCapacity = vertexSpace.capacity();
+			unsigned int indexCapacity = indexSpace.capacity();
+			if (firstVertex == RangeAllocator::INVALID)
+				while (vertexCapacity - vertexSpace.capacity() < vertexCount)
+					vertexCapacity = max(vertexCapacity * 2, 1024u);
+			if (firstIndex == RangeAllocator::INVALID)
+				while (indexCapacity - indexSpace.capacity() < indexCount)
+					indexCapacity = max(indexCapacity * 2, 1024u);
+			relocate(vertexCapacity, indexCapacity, false);
+			firstVertex = vertexSpace.allocate(vertexCount);
+			firstIndex = indexSpace.allocate(indexCount);
+		}
+
+		Record record;
+		record.firstVertex = firstVertex;
+		record.vertexCount = vertexCount;
+		record.firstIndex = firstIndex;
+		record.indexCount = indexCount;
+		record.live = true;
+		// the full Vertex already is the stream, anything narrower is packed attribute by attribute
+		for (unsigned int stream = 0; stream < 2; stream++)
+		{
+			const StreamLayout &streamLayout = streamLayouts[stream];
+			if (streamLayout.stride == sizeof(Vertex))
+			{
+				bufferSubData(streams[stream].id(), (GLintptr)firstVertex * sizeof(Vertex), vertexCount * sizeof(Vertex), vertices.data());
+				continue;
+			}
+			if (streamLayout.stride == 0)
+				continue;
+			vector<unsigned char> packed((size_t)vertexCount * streamLayout.stride);
+			for (unsigned int v = 0; v < vertexCount; v++)
+				for (unsigned int a = 0; a < VERTEX_ATTRIBUTE_COUNT; a++)
+					if (streamLayout.holds(a))
+						memcpy(&packed[(size_t)v * streamLayout.stride + streamLayout.offsets[a]],
+							(const unsigned char*)&vertices[v] + ModelVertexLayout::offset(a), ModelVertexLayout::size(a));
+			bufferSubData(streams[stream].id(), (GLintptr)firstVertex * streamLayout.stride, vertexCount * streamLayout.stride, packed.data());
+		}
+		bufferSubData(EBO.id(), (GLintptr)firstIndex * sizeof(unsigned int), indexCount * sizeof(unsigned int), indices.data());
+
+		unsigned int allocation;
+		if (freeRecord != ~0u)
+		{
+			allocation = freeRecord;
+			freeRecord = records[allocation].firstVertex;
+			records[allocation] = record;
+		}
+		else
+		{
+			allocation = (unsigned int)records.size();
+			records.push_back(record);
+		}
+		live++;
+		return allocation;
+	}
+
+	// gives the ranges back; the data stays in the buffers until something else is allocated over it
+	void release(unsigned int allocation)
+	{
+		if (allocation >= records.size() || !records[allocation].live)
+			return;
+		Record &record = records[allocation];
+		vertexSpace.free(record.firstVertex, record.vertexCount);
+		indexSpace.free(record.firstIndex, record.indexCount);
+		record.live = false;
+		record.firstVertex = freeRecord;
+		freeRecord = allocation;
+		live--;
+	}
+
+	// where the allocation is drawn from now
+	MeshRange range(unsigned int allocation) const
+	{
+		const Record &record = records[allocation];
+		MeshRange range;
+		range.count = record.indexCount;
+		range.firstIndex = record.firstIndex;
+		range.baseVertex = (GLint)record.firstVertex;
+		return range;
+	}
+
+	// packs every live allocation to the front of the buffers, e.g. after unloading a level; returns whether
+	// anything moved. Copies go through fresh buffers, glCopyBufferSubData does not allow overlapping ranges.
+	bool compact()
+	{
+		if (isPacked())
+			return false;
+		relocate(vertexSpace.capacity(), indexSpace.capacity(), true);
+		return true;
+	}
+
+	// changes whenever compact() moved allocations
+	unsigned int generation() const { return generationCount; }
+
+	GeometryArenaStats stats() const
+	{
+		GeometryArenaStats stats;
+		stats.allocations = live;
+		stats.vertexCapacity = vertexSpace.capacity();
+		stats.verticesUsed = vertexSpace.capacity() - vertexSpace.freeElements();
+		stats.vertexFreeBlocks = vertexSpace.freeBlocks();
+		stats.largestFreeVertices = vertexSpace.largestFree();
+		stats.indexCapacity = indexSpace.capacity();
+		stats.indicesUsed = indexSpace.capacity() - indexSpace.freeElements();
+		stats.indexFreeBlocks = indexSpace.freeBlocks();
+		stats.largestFreeIndices = indexSpace.largestFree();
+		return stats;
+	}
+
+	bool pulling() const { return vertexPulling && pullVAO.valid(); }
+
+	// the one VAO every draw of the arena goes through, plus the vertex streams when pulling
+	void bind() const
+	{
+		if (pulling())
+		{
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, POSITION_PULL_BINDING, streams[0].id());
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ATTRIBUTE_PULL_BINDING, layout == LAYOUT_SPLIT ? streams[1].id() : streams[0].id());
+			glBindVertexArray(pullVAO.id());
+		}
+		else
+			glBindVertexArray(VAO.id());
+	}
+
+	// for passes whose vertex shader only reads location 0
+	void bindPositions() const
+	{
+		glBindVertexArray(positionVAO.id());
+	}
+
+	// per program, before its draws: how (and whether) the vertex shader pulls
+	void setVertexFormat(GLuint program) const
+	{
+		GLint location = glGetUniformLocation(program, "vertexFormat");
+		if (location >= 0)
+			glUniform4ui(location, pulling() ? format.positionStride : 0, format.attributeStride, format.normal, format.texCoords);
+	}
+
+private:
+	// a free record keeps the next free record index in firstVertex
+	struct Record {
+		unsigned int firstVertex;
+		unsigned int vertexCount;
+		unsigned int firstIndex;
+		unsigned int indexCount;
+		bool live;
+	};
+
+	VertexLayout layout;
+	VertexAttributeMask attributeMask;
+	StreamLayout streamLayouts[2];	// LAYOUT_SPLIT: positions, everything else
+	GpuBuffer streams[2];	// LAYOUT_INTERLEAVED only uses the first
+	GpuBuffer EBO;
+	RangeAllocator vertexSpace, indexSpace;
+	vector<Record> records;
+	unsigned int freeRecord;
+	unsigned int live;
+	unsigned int generationCount;
+
+	// bytes per vertex in the stream, 0 for a stream the layout does not have
+	unsigned int streamStride(unsigned int stream) const
+	{
+		return streamLayouts[stream].stride;
+	}
+
+	// true when the live ranges end where the used element counts do, i.e. there are no holes before the tail
+	bool isPacked() const
+	{
+		unsigned int vertexEnd = 0, indexEnd = 0;
+		for (unsigned int r = 0; r < records.size(); r++)
+			if (records[r].live)
+			{
+				vertexEnd = max(vertexEnd, records[r].firstVertex + records[r].vertexCount);
+				indexEnd = max(indexEnd, records[r].firstIndex + records[r].indexCount);
+			}
+		return vertexEnd == vertexSpace.capacity() - vertexSpace.freeElements() && indexEnd == indexSpace.capacity() - indexSpace.freeElements();
+	}
+
+	void createBuffers(unsigned int vertexCapacity, unsigned int indexCapacity)
+	{
+		for (unsigned int stream = 0; stream < 2; stream++)
+			if (streamStride(stream))
+			{
+				streams[stream] = GpuBuffer::create();
+				bufferStorage(streams[stream].id(), (GLsizeiptr)vertexCapacity * streamStride(stream), NULL, true);
+			}
+		EBO = GpuBuffer::create();
+		bufferStorage(EBO.id(), (GLsizeiptr)indexCapacity * sizeof(unsigned int), NULL, true);
+
+		// the locations of Mesh::setupMesh, each from whichever stream holds it
+		VAO = VertexArray::create();
+		vertexArrayElements(VAO.id(), EBO.id());
+		for (unsigned int stream = 0; stream < 2; stream++)
+		{
+			const StreamLayout &streamLayout = streamLayouts[stream];
+			for (unsigned int a = 0; a < VERTEX_ATTRIBUTE_COUNT; a++)
+				if (streamLayout.holds(a))
+					vertexArrayAttribute(VAO.id(), a, ModelVertexLayout::components(a), ModelVertexLayout::type(a), ModelVertexLayout::normalized(a),
+						streams[stream].id(), streamLayout.stride, streamLayout.offsets[a]);
+		}
+
+		positionVAO = VertexArray::create();
+		vertexArrayElements(positionVAO.id(), EBO.id());
+		PositionVertexLayout::attach(positionVAO.id(), streams[0].id(), streamStride(0));
+
+		if (supportsVertexPulling())
+		{
+			pullVAO = VertexArray::create();
+			vertexArrayElements(pullVAO.id(), EBO.id());
+		}
+	}
+
+	// moves the contents into new buffers of the given size: at the same offsets, or packed in offset order
+	void relocate(unsigned int vertexCapacity, unsigned int indexCapacity, bool pack)
+	{
+		GpuBuffer oldStreams[2] = { GpuBuffer(streams[0].release()), GpuBuffer(streams[1].release()) };
+		GpuBuffer oldEBO(EBO.release());
+		createBuffers(vertexCapacity, indexCapacity);
+
+		if (!pack)
+		{
+			for (unsigned int stream = 0; stream < 2; stream++)
+				copyBufferSubData(oldStreams[stream].id(), streams[stream].id(), 0, 0, (GLsizeiptr)vertexSpace.capacity() * streamStride(stream));
+			copyBufferSubData(oldEBO.id(), EBO.id(), 0, 0, (GLsizeiptr)indexSpace.capacity() * sizeof(unsigned int));
+			vertexSpace.grow(vertexCapacity);
+			indexSpace.grow(indexCapacity);
+			return;
+		}
+
+		// vertex and index ranges are packed independently, each in its own offset order
+		vector<unsigned int> order;
+		for (unsigned int r = 0; r < records.size(); r++)
+			if (records[r].live)
+				order.push_back(r);
+		vector<Record> &all = records;
+		sort(order.begin(), order.end(), [&all](unsigned int a, unsigned int b) { return all[a].firstVertex < all[b].firstVertex; });
+		unsigned int vertexEnd = 0;
+		for (unsigned int o = 0; o < order.size(); o++)
+		{
+			Record &record = records[order[o]];
+			for (unsigned int stream = 0; stream < 2; stream++)
+			{
+				GLsizeiptr stride = streamStride(stream);
+				copyBufferSubData(oldStreams[stream].id(), streams[stream].id(), record.firstVertex * stride, vertexEnd * stride, record.vertexCount * stride);
+			}
+			record.firstVertex = vertexEnd;
+			vertexEnd += record.vertexCount;
+		}
+		sort(order.begin(), order.end(), [&all](unsigned int a, unsigned int b) { return all[a].firstIndex < all[b].firstIndex; });
+		unsigned int indexEnd = 0;
+		for (unsigned int o = 0; o < order.size(); o++)
+		{
+			Record &record = records[order[o]];
+			copyBufferSubData(oldEBO.id(), EBO.id(), (GLintptr)record.firstIndex * sizeof(unsigned int), (GLintptr)indexEnd * sizeof(unsigned int), (GLsizeiptr)record.indexCount * sizeof(unsigned int));
+			record.firstIndex = indexEnd;
+			indexEnd += record.indexCount;
+		}
+		vertexSpace.reset(vertexCapacity, vertexEnd);
+		indexSpace.reset(indexCapacity, indexEnd);
+		generationCount++;
+	}
+};
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef GL_HANDLES_H
+#define GL_HANDLES_H
+
+#include <glad/glad.h>
+
+// glCreate*/glNamed*/glTexture* (GL 4.5). Names made with glCreate* are objects right away, so they can be
+// edited without ever being bound; gl_resources.h does the editing, with the bind-to-edit path under 3.3.
+inline bool supportsDirectStateAccess()
+{
+	return GLAD_GL_VERSION_4_5 != 0;
+}
+
+// Owning handle of one GL object name. Move-only: the name is deleted exactly once, by whichever handle holds
+// it last, so containers of meshes can grow without two copies aliasing (and later deleting) the same buffer.
+// The context must still be current when a handle dies.
+template <typename Traits>
+class GlHandle
+{
+public:
+	GlHandle() : name(0) {}
+	// takes ownership of an existing name
+	explicit GlHandle(GLuint name) : name(name) {}
+	~GlHandle() { reset(); }
+
+	GlHandle(GlHandle &&other) noexcept : name(other.name) { other.name = 0; }
+	GlHandle &operator=(GlHandle &&other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			name = other.name;
+			other.name = 0;
+		}
+		return *this;
+	}
+	GlHandle(const GlHandle &) = delete;
+	GlHandle &operator=(const GlHandle &) = delete;
+
+	static GlHandle create()
+	{
+		GLuint name = 0;
+		Traits::create(name);
+		return GlHandle(name);
+	}
+
+	GLuint id() const { return name; }
+	bool valid() const { return name != 0; }
+
+	// deletes the object now
+	void reset()
+	{
+		if (name)
+			Traits::destroy(name);
+		name = 0;
+	}
+
+	// gives up ownership without deleting
+	GLuint release()
+	{
+		GLuint released = name;
+		name = 0;
+		return released;
+	}
+
+private:
+	GLuint name;
+};
+
+struct BufferTraits {
+	static void create(GLuint &name)
+	{
+		if (supportsDirectStateAccess())
+			glCreateBuffers(1, &name);
+		else
+			glGenBuffers(1, &name);
+	}
+	static void destroy(GLuint name) { glDeleteBuffers(1, &name); }
+};
+
+struct VertexArrayTraits {
+	static void create(GLuint &name)
+	{
+		if (supportsDirectStateAccess())
+			glCreateVertexArrays(1, &name);
+		else
+			glGenVertexArrays(1, &name);
+	}
+	static void destroy(GLuint name) { glDeleteVertexArrays(1, &name); }
+};
+
+// a texture's target is fixed when glCreateTextures makes it
+template <GLenum Target>
+struct TextureTraits {
+	static void create(GLuint &name)
+	{
+		if (supportsDirectStateAccess())
+			glCreateTextures(Target, 1, &name);
+		else
+			glGenTextures(1, &name);
+	}
+	static void destroy(GLuint name) { glDeleteTextures(1, &name); }
+};
+
+typedef GlHandle<BufferTraits> GpuBuffer;
+typedef GlHandle<VertexArrayTraits> VertexArray;
+typedef GlHandle<TextureTraits<GL_TEXTURE_2D> > Texture2D;
+typedef GlHandle<TextureTraits<GL_TEXTURE_2D_ARRAY> > TextureArray;
+typedef GlHandle<TextureTraits<GL_TEXTURE_CUBE_MAP> > TextureCube;
+#endif
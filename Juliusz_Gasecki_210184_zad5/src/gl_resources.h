@@ -0,0 +1,255 @@
+#pragma once
+#ifndef GL_RESOURCES_H
+#define GL_RESOURCES_H
+
+#include <glad/glad.h>
+
+#include "gl_handles.h"
+
+#include <algorithm>
+#include <cstddef>
+using namespace std;
+
+// Creating and filling buffers, vertex arrays and textures without touching the bound state. With GL 4.5 every
+// call names the object it edits (direct state access); under 3.3 the object is bound for the edit and the
+// previous binding put back, so in both paths resources can be made or refilled between two draws without
+// disturbing them. Objects have to come from the handles in gl_handles.h (or their release()), which create
+// them with glCreate* when DSA is used.
+
+// fallback path: binds for the edit, restores the earlier binding when it goes out of scope
+class ScopedBind
+{
+public:
+	static ScopedBind vertexArray(GLuint vao)
+	{
+		return ScopedBind(GL_VERTEX_ARRAY, GL_VERTEX_ARRAY_BINDING, vao);
+	}
+
+	static ScopedBind buffer(GLenum target, GLuint buffer)
+	{
+		return ScopedBind(target, bufferBindingQuery(target), buffer);
+	}
+
+	static ScopedBind texture(GLenum target, GLuint texture)
+	{
+		return ScopedBind(target, textureBindingQuery(target), texture);
+	}
+
+	ScopedBind(ScopedBind &&other) noexcept : target(other.target), previous(other.previous), active(other.active) { other.active = false; }
+	ScopedBind(const ScopedBind &) = delete;
+	ScopedBind &operator=(const ScopedBind &) = delete;
+
+	~ScopedBind()
+	{
+		if (active)
+			bind(target, (GLuint)previous);
+	}
+
+private:
+	GLenum target;
+	GLint previous;
+	bool active;
+
+	ScopedBind(GLenum target, GLenum query, GLuint name) : target(target), previous(0), active(true)
+	{
+		glGetIntegerv(query, &previous);
+		bind(target, name);
+	}
+
+	static void bind(GLenum target, GLuint name)
+	{
+		if (target == GL_VERTEX_ARRAY)
+			glBindVertexArray(name);
+		else if (target == GL_TEXTURE_2D || target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_CUBE_MAP)
+			glBindTexture(target, name);
+		else
+			glBindBuffer(target, name);
+	}
+
+	static GLenum bufferBindingQuery(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return GL_ARRAY_BUFFER_BINDING;
+		case GL_COPY_READ_BUFFER: return GL_COPY_READ_BUFFER_BINDING;
+		case GL_UNIFORM_BUFFER: return GL_UNIFORM_BUFFER_BINDING;
+		default: return GL_COPY_WRITE_BUFFER_BINDING;
+		}
+	}
+
+	static GLenum textureBindingQuery(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D_ARRAY: return GL_TEXTURE_BINDING_2D_ARRAY;
+		case GL_TEXTURE_CUBE_MAP: return GL_TEXTURE_BINDING_CUBE_MAP;
+		default: return GL_TEXTURE_BINDING_2D;
+		}
+	}
+};
+
+/*  Buffers  */
+
+// Allocates the buffer once: immutable storage with DSA, so only the contents may change afterwards, and only
+// through bufferSubData when dynamic. Growing means a new buffer, as GeometryArena already does.
+inline void bufferStorage(GLuint buffer, GLsizeiptr size, const void *data, bool dynamic)
+{
+	if (supportsDirectStateAccess())
+	{
+		// zero-sized storage is an error
+		glNamedBufferStorage(buffer, max(size, (GLsizeiptr)1), size ? data : NULL, dynamic ? GL_DYNAMIC_STORAGE_BIT : 0);
+		return;
+	}
+	ScopedBind bound = ScopedBind::buffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, data, dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+}
+
+inline void bufferSubData(GLuint buffer, GLintptr offset, GLsizeiptr size, const void *data)
+{
+	if (size == 0)
+		return;
+	if (supportsDirectStateAccess())
+	{
+		glNamedBufferSubData(buffer, offset, size, data);
+		return;
+	}
+	ScopedBind bound = ScopedBind::buffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+}
+
+// the ranges must not overlap when from == to
+inline void copyBufferSubData(GLuint from, GLuint to, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+{
+	if (size == 0)
+		return;
+	if (supportsDirectStateAccess())
+	{
+		glCopyNamedBufferSubData(from, to, readOffset, writeOffset, size);
+		return;
+	}
+	ScopedBind read = ScopedBind::buffer(GL_COPY_READ_BUFFER, from);
+	ScopedBind write = ScopedBind::buffer(GL_COPY_WRITE_BUFFER, to);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, readOffset, writeOffset, size);
+}
+
+/*  Vertex arrays  */
+
+inline void vertexArrayElements(GLuint vao, GLuint buffer)
+{
+	if (supportsDirectStateAccess())
+	{
+		glVertexArrayElementBuffer(vao, buffer);
+		return;
+	}
+	// the element binding is VAO state, it goes when the VAO is unbound
+	ScopedBind bound = ScopedBind::vertexArray(vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
+
+// Enables the attribute at location, reading buffer from offset with the given stride (never 0 = tightly
+// packed, DSA takes 0 literally). Every location gets a buffer binding point of its own.
+inline void vertexArrayAttribute(GLuint vao, GLuint location, GLint components, GLenum type, bool normalized,
+	GLuint buffer, GLsizei stride, size_t offset, GLuint divisor = 0)
+{
+	if (supportsDirectStateAccess())
+	{
+		glVertexArrayVertexBuffer(vao, location, buffer, (GLintptr)offset, stride);
+		glVertexArrayAttribFormat(vao, location, components, type, normalized ? GL_TRUE : GL_FALSE, 0);
+		glVertexArrayAttribBinding(vao, location, location);
+		glVertexArrayBindingDivisor(vao, location, divisor);
+		glEnableVertexArrayAttrib(vao, location);
+		return;
+	}
+	ScopedBind boundArray = ScopedBind::vertexArray(vao);
+	ScopedBind boundBuffer = ScopedBind::buffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(location);
+	glVertexAttribPointer(location, components, type, normalized ? GL_TRUE : GL_FALSE, stride, (void*)offset);
+	glVertexAttribDivisor(location, divisor);
+}
+
+/*  Textures  */
+
+// levels of a full mip chain
+inline GLsizei mipLevels(GLsizei width, GLsizei height)
+{
+	GLsizei levels = 1;
+	for (GLsizei size = max(width, height); size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+// Allocates every level (and face or layer) at once. The fallback specifies the same levels with glTexImage and
+// clamps GL_TEXTURE_MAX_LEVEL to them, which is what immutable storage does implicitly.
+inline void textureStorage(GLuint texture, GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei layers = 1)
+{
+	if (supportsDirectStateAccess())
+	{
+		// a cube map's storage is 2D, its faces come with it
+		if (target == GL_TEXTURE_2D_ARRAY)
+			glTextureStorage3D(texture, levels, internalFormat, width, height, layers);
+		else
+			glTextureStorage2D(texture, levels, internalFormat, width, height);
+		return;
+	}
+	// glTexImage wants a client format matching the internal one even without data
+	GLenum format = internalFormat == GL_R8 ? GL_RED : internalFormat == GL_RG8 ? GL_RG : internalFormat == GL_RGB8 ? GL_RGB : GL_RGBA;
+	ScopedBind bound = ScopedBind::texture(target, texture);
+	for (GLsizei level = 0; level < levels; level++)
+	{
+		GLsizei levelWidth = max(width >> level, 1);
+		GLsizei levelHeight = max(height >> level, 1);
+		if (target == GL_TEXTURE_2D_ARRAY)
+			glTexImage3D(target, level, internalFormat, levelWidth, levelHeight, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+		else if (target == GL_TEXTURE_CUBE_MAP)
+			for (GLenum face = 0; face < 6; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat, levelWidth, levelHeight, 0, format, GL_UNSIGNED_BYTE, NULL);
+		else
+			glTexImage2D(target, level, internalFormat, levelWidth, levelHeight, 0, format, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+// fills one whole level of one layer (array layer or cube face, 0 for 2D textures)
+inline void textureSubImage(GLuint texture, GLenum target, GLint level, GLint layer, GLsizei width, GLsizei height,
+	GLenum format, GLenum type, const void *pixels)
+{
+	if (supportsDirectStateAccess())
+	{
+		// cube maps are six layers to the DSA upload
+		if (target == GL_TEXTURE_2D)
+			glTextureSubImage2D(texture, level, 0, 0, width, height, format, type, pixels);
+		else
+			glTextureSubImage3D(texture, level, 0, 0, layer, width, height, 1, format, type, pixels);
+		return;
+	}
+	ScopedBind bound = ScopedBind::texture(target, texture);
+	if (target == GL_TEXTURE_2D_ARRAY)
+		glTexSubImage3D(target, level, 0, 0, layer, width, height, 1, format, type, pixels);
+	else if (target == GL_TEXTURE_CUBE_MAP)
+		glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer, level, 0, 0, width, height, format, type, pixels);
+	else
+		glTexSubImage2D(target, level, 0, 0, width, height, format, type, pixels);
+}
+
+inline void textureParameter(GLuint texture, GLenum target, GLenum name, GLint value)
+{
+	if (supportsDirectStateAccess())
+	{
+		glTextureParameteri(texture, name, value);
+		return;
+	}
+	ScopedBind bound = ScopedBind::texture(target, texture);
+	glTexParameteri(target, name, value);
+}
+
+inline void generateTextureMipmap(GLuint texture, GLenum target)
+{
+	if (supportsDirectStateAccess())
+	{
+		glGenerateTextureMipmap(texture);
+		return;
+	}
+	ScopedBind bound = ScopedBind::texture(target, texture);
+	glGenerateMipmap(target);
+}
+#endif
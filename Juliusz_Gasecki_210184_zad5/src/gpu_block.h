@@ -0,0 +1,183 @@
+#pragma once
+#ifndef GPU_BLOCK_H
+#define GPU_BLOCK_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gl_handles.h"
+#include "gl_resources.h"
+
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Base alignment of the GLSL type a C++ block member stands for. Whatever is not specialized aligns like a vec4:
+// vec3, vec4, mat4, and structs, which are assumed to hold one of those in either layout. Arrays are rounded up
+// to a vec4 in std140, std430 keeps an array at its element's alignment.
+template <typename T> struct Std140 { static const size_t alignment = 16; };
+template <> struct Std140<GLfloat> { static const size_t alignment = 4; };
+template <> struct Std140<GLint> { static const size_t alignment = 4; };
+template <> struct Std140<GLuint> { static const size_t alignment = 4; };
+template <> struct Std140<glm::vec2> { static const size_t alignment = 8; };
+template <> struct Std140<glm::ivec2> { static const size_t alignment = 8; };
+template <> struct Std140<glm::uvec2> { static const size_t alignment = 8; };
+template <typename T, size_t N> struct Std140<T[N]> {
+	static_assert(sizeof(T) % 16 == 0, "std140 array elements are 16 bytes apart, pad the element type");
+	static const size_t alignment = 16;
+};
+
+template <typename T> struct Std430 : Std140<T> {};
+template <typename T, size_t N> struct Std430<T[N]> { static const size_t alignment = Std430<T>::alignment; };
+
+inline constexpr size_t alignUp(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Holds a member of a block struct to the place the GLSL layout gives it: right after the previous member,
+// rounded up to its alignment. Explicit padding members go between the two, so a missing or extra pad fails to
+// compile instead of shifting every later member on the GPU.
+#define GPU_BLOCK_MEMBER_AFTER(Layout, Struct, member, previous) \
+	static_assert(offsetof(Struct, member) == alignUp(offsetof(Struct, previous) + sizeof(Struct::previous), \
+		Layout<decltype(Struct::member)>::alignment), #Struct "::" #member " is not where " #Layout " puts it")
+
+// a struct used as a block member or array element ends on a vec4 boundary in std140
+#define GPU_BLOCK_STRUCT_SIZE(Struct) \
+	static_assert(sizeof(Struct) % 16 == 0, #Struct " is not padded to a multiple of 16 bytes")
+
+// GLSL name and byte offset of every member of a block struct, named the way the GL lists the active uniforms
+// of a block: "member", "array[2].member", "basicArray[0]". A struct fills it in its describe().
+class GpuBlockMembers
+{
+public:
+	void add(const string &name, size_t offset)
+	{
+		offsets[name] = (GLint)offset;
+	}
+
+	// a struct member: T::describe adds its members under "name."
+	template <typename T>
+	void addStruct(const string &name, size_t offset)
+	{
+		T::describe(*this, name + ".", offset);
+	}
+
+	template <typename T>
+	void addStructArray(const string &name, size_t offset, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			ostringstream element;
+			element << name << "[" << i << "].";
+			T::describe(*this, element.str(), offset + i * sizeof(T));
+		}
+	}
+
+	// offset of the member, -1 when the struct has none of that name
+	GLint find(const string &name) const
+	{
+		map<string, GLint>::const_iterator member = offsets.find(name);
+		return member == offsets.end() ? -1 : member->second;
+	}
+
+	template <typename Block>
+	static GpuBlockMembers of()
+	{
+		GpuBlockMembers members;
+		Block::describe(members, "", 0);
+		return members;
+	}
+
+private:
+	map<string, GLint> offsets;
+};
+
+// Cross-checks a uniform block of a linked program against its C++ struct: the block must fit into size bytes
+// and every active member must sit at the offset the struct has it at. Returns true when the program has no
+// such block; mismatches are reported one by one.
+inline bool verifyUniformBlock(GLuint program, const char *blockName, const GpuBlockMembers &members, size_t size)
+{
+	GLuint block = glGetUniformBlockIndex(program, blockName);
+	if (block == GL_INVALID_INDEX)
+		return true;
+	bool valid = true;
+	GLint dataSize = 0, count = 0, maxLength = 0;
+	glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+	glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &count);
+	if ((size_t)dataSize > size)
+	{
+		cout << "ERROR::GPU_BLOCK:: " << blockName << " is " << dataSize << " bytes in program " << program << ", the struct " << size << endl;
+		valid = false;
+	}
+	if (count <= 0)
+		return valid;
+	vector<GLint> indices(count);
+	glGetActiveUniformBlockiv(program, block, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, indices.data());
+	vector<GLint> offsets(count);
+	glGetActiveUniformsiv(program, count, (const GLuint*)indices.data(), GL_UNIFORM_OFFSET, offsets.data());
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		glGetActiveUniformName(program, (GLuint)indices[i], (GLsizei)name.size(), NULL, name.data());
+		GLint offset = members.find(name.data());
+		if (offset != offsets[i])
+		{
+			cout << "ERROR::GPU_BLOCK:: " << blockName << "." << name.data() << " is at " << offsets[i] << " in program " << program << ", ";
+			if (offset < 0)
+				cout << "the struct does not have it" << endl;
+			else
+				cout << "the struct has it at " << offset << endl;
+			valid = false;
+		}
+	}
+	return valid;
+}
+
+// One block struct in a uniform buffer of its own. Block provides blockName() and describe(); the program side
+// is bound and checked once in attach(), after which the whole struct goes to the GPU as a single write, no
+// matter how many members it has.
+template <typename Block>
+class UniformBuffer
+{
+public:
+	Block data;
+
+	explicit UniformBuffer(GLuint binding) : data(), binding(binding), buffer(GpuBuffer::create())
+	{
+		bufferStorage(buffer.id(), sizeof(Block), NULL, true);
+	}
+
+	// once per program: points its block at the binding, false when the layouts disagree
+	bool attach(GLuint program) const
+	{
+		GLuint block = glGetUniformBlockIndex(program, Block::blockName());
+		if (block == GL_INVALID_INDEX)
+			return true;
+		glUniformBlockBinding(program, block, binding);
+		return verifyUniformBlock(program, Block::blockName(), GpuBlockMembers::of<Block>(), sizeof(Block));
+	}
+
+	// copies data to the GPU and binds it, before the draws that read it
+	void update() const
+	{
+		bufferSubData(buffer.id(), 0, sizeof(Block), &data);
+		bind();
+	}
+
+	void bind() const
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer.id());
+	}
+
+private:
+	GLuint binding;
+	GpuBuffer buffer;
+};
+#endif
@@ -0,0 +1,308 @@
+#pragma once
+#ifndef GPU_CULL_H
+#define GPU_CULL_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gl_handles.h"
+#include "shader.h"
+#include "indirect.h"
+#include "frustum.h"
+#include "frame_arena.h"
+
+#include <vector>
+using namespace std;
+
+// one cullable object, std430 layout of ObjectData in cull.cs (112 bytes)
+struct GpuCullObject {
+	glm::vec4 boundsMin;	// object space
+	glm::vec4 boundsMax;
+	glm::mat4 model;
+	GLuint mesh;			// index into the ranges given to setMeshes
+	GLuint bucket;
+	GLuint materialIndex;
+	GLuint animationIndex;	// copied to DrawInstanceData
+};
+
+// MeshData in cull.cs
+struct GpuCullMesh {
+	GLuint count;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint pad;
+};
+
+// GPU driven culling. A compute pass tests every object against the frustum and against a Hi-Z pyramid built
+// from the previous frame's depth buffer. Survivors are appended to a per bucket region of an indirect command
+// buffer, together with their DrawInstanceData, so draw() never needs to know on the CPU what is visible.
+// Culling needs GL 4.3. Consuming the result needs the 4.6 multi-draw path (gl_BaseInstance,
+// glMultiDrawElementsIndirectCount); without it callers keep the CPU culler.
+class GpuCuller
+{
+public:
+	static bool supported() { return GLAD_GL_VERSION_4_3 != 0; }
+	static bool canDraw() { return GLAD_GL_VERSION_4_6 != 0; }
+
+	GpuCuller(unsigned int bucketCount, unsigned int bucketCapacity)
+		: cullShader("res/shaders/cull.cs"), hiZShader("res/shaders/hiz.cs"), bucketCount(bucketCount), bucketCapacity(bucketCapacity),
+		objectCount(0), objectCapacity(0), hiZWidth(0), hiZHeight(0), hiZLevels(0), hiZValid(false)
+	{
+		drawBuffer = GpuBuffer::create();
+		objectBuffer = GpuBuffer::create();
+		meshBuffer = GpuBuffer::create();
+		commandBuffer = GpuBuffer::create();
+		counterBuffer = GpuBuffer::create();
+		visibilityBuffer = GpuBuffer::create();
+
+		unsigned int slots = bucketCount * bucketCapacity;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer.id());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, slots * sizeof(DrawInstanceData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer.id());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, slots * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer.id());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, bucketCount * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// uniform locations are looked up once, the samplers never change units
+		cullUniforms.objectCount = glGetUniformLocation(cullShader.ID, "objectCount");
+		cullUniforms.bucketCapacity = glGetUniformLocation(cullShader.ID, "bucketCapacity");
+		cullUniforms.frustumPlanes = glGetUniformLocation(cullShader.ID, "frustumPlanes");
+		cullUniforms.useHiZ = glGetUniformLocation(cullShader.ID, "useHiZ");
+		cullUniforms.previousViewProjection = glGetUniformLocation(cullShader.ID, "previousViewProjection");
+		cullUniforms.hiZSize = glGetUniformLocation(cullShader.ID, "hiZSize");
+		cullUniforms.hiZLevels = glGetUniformLocation(cullShader.ID, "hiZLevels");
+		hiZUniforms.copyDepth = glGetUniformLocation(hiZShader.ID, "copyDepth");
+		hiZUniforms.srcSize = glGetUniformLocation(hiZShader.ID, "srcSize");
+		hiZUniforms.dstSize = glGetUniformLocation(hiZShader.ID, "dstSize");
+		cullShader.use();
+		cullShader.setInt("hiZ", 0);
+		hiZShader.use();
+		hiZShader.setInt("depthTexture", 0);
+		glUseProgram(0);
+	}
+
+	void setMeshes(const vector<MeshRange> &ranges)
+	{
+		vector<GpuCullMesh> meshes(ranges.size());
+		for (unsigned int i = 0; i < ranges.size(); i++)
+		{
+			meshes[i].count = ranges[i].count;
+			meshes[i].firstIndex = ranges[i].firstIndex;
+			meshes[i].baseVertex = ranges[i].baseVertex;
+			meshes[i].pad = 0;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer.id());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, meshes.size() * sizeof(GpuCullMesh), meshes.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// per frame upload of bounds and transforms; no bucket may receive more than bucketCapacity objects
+	void setObjects(const vector<GpuCullObject> &objects)
+	{
+		objectCount = (unsigned int)objects.size();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer.id());
+		if (objectCount > objectCapacity)
+		{
+			objectCapacity = objectCount * 2;
+			glBufferData(GL_SHADER_STORAGE_BUFFER, objectCapacity * sizeof(GpuCullObject), NULL, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer.id());
+			glBufferData(GL_SHADER_STORAGE_BUFFER, objectCapacity * sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer.id());
+		}
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectCount * sizeof(GpuCullObject), objects.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// useHiZ is ignored until updateHiZ() has captured a depth buffer
+	void cull(const Frustum &frustum, bool useHiZ)
+	{
+		if (objectCount == 0)
+			return;
+
+		FrameVector<GLuint> zeros(bucketCount, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer.id());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, zeros.size() * sizeof(GLuint), zeros.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawBuffer.id());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, objectBuffer.id());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, meshBuffer.id());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBuffer.id());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, counterBuffer.id());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, visibilityBuffer.id());
+
+		cullShader.use();
+		glUniform1ui(cullUniforms.objectCount, objectCount);
+		glUniform1ui(cullUniforms.bucketCapacity, bucketCapacity);
+		glUniform4fv(cullUniforms.frustumPlanes, 6, glm::value_ptr(frustum.planes[0]));
+		bool hiZ = useHiZ && hiZValid;
+		glUniform1i(cullUniforms.useHiZ, hiZ);
+		if (hiZ)
+		{
+			glUniformMatrix4fv(cullUniforms.previousViewProjection, 1, GL_FALSE, glm::value_ptr(hiZViewProjection));
+			glUniform2f(cullUniforms.hiZSize, (float)hiZWidth, (float)hiZHeight);
+			glUniform1i(cullUniforms.hiZLevels, hiZLevels);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, hiZTexture.id());
+		}
+		glDispatchCompute((objectCount + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		if (hiZ)
+			glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// draws the survivors of one bucket, the caller binds the geometry arena and sets view/projection
+	void draw(unsigned int bucket, GLuint program)
+	{
+		glUseProgram(program);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawBuffer.id());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer.id());
+		glBindBuffer(GL_PARAMETER_BUFFER, counterBuffer.id());
+		glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(void*)((size_t)bucket * bucketCapacity * sizeof(DrawElementsIndirectCommand)),
+			(GLintptr)(bucket * sizeof(GLuint)), bucketCapacity, 0);
+		glBindBuffer(GL_PARAMETER_BUFFER, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// Copies the depth of the default framebuffer and reduces it into the max depth pyramid used by next frame's cull.
+	// Call after the opaque scene is drawn; viewProjection is the matrix that frame was rendered with.
+	void updateHiZ(int width, int height, const glm::mat4 &viewProjection)
+	{
+		if (width <= 0 || height <= 0)
+			return;
+		if (width != hiZWidth || height != hiZHeight)
+			createHiZTargets(width, height);
+
+		// unlike a depth blit, a copy converts from whatever depth format the window got
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depthTexture.id());
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+		hiZShader.use();
+		int w = width, h = height;
+		for (int level = 0; level < hiZLevels; level++)
+		{
+			int srcW = w, srcH = h;
+			if (level > 0)
+			{
+				w = glm::max(w / 2, 1);
+				h = glm::max(h / 2, 1);
+			}
+			glUniform1i(hiZUniforms.copyDepth, level == 0);
+			glUniform2i(hiZUniforms.srcSize, srcW, srcH);
+			glUniform2i(hiZUniforms.dstSize, w, h);
+			glBindImageTexture(0, hiZTexture.id(), glm::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+			glBindImageTexture(1, hiZTexture.id(), level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glDispatchCompute((w + 7) / 8, (h + 7) / 8, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		}
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		hiZViewProjection = viewProjection;
+		hiZValid = true;
+	}
+
+	// blocking readback of the last cull, one flag per object
+	void readVisibility(vector<unsigned char> &visible)
+	{
+		vector<GLuint> flags(objectCount);
+		visible.resize(objectCount);
+		if (objectCount == 0)
+			return;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer.id());
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectCount * sizeof(GLuint), flags.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		for (unsigned int i = 0; i < objectCount; i++)
+			visible[i] = flags[i] != 0;
+	}
+
+	// Test mode: compares the frustum-only GPU result with the CPU FrustumCuller for the same world boxes.
+	// Boxes within epsilon of a plane are skipped, both sides are allowed to round differently there.
+	// Returns the number of mismatches.
+	unsigned int validate(const Frustum &frustum, const vector<AABB> &worldBounds)
+	{
+		cull(frustum, false);
+		vector<unsigned char> gpuVisible;
+		readVisibility(gpuVisible);
+
+		FrustumCuller cpu;
+		for (unsigned int i = 0; i < worldBounds.size(); i++)
+			cpu.add(worldBounds[i]);
+		cpu.cull(frustum);
+
+		unsigned int mismatches = 0;
+		for (unsigned int i = 0; i < worldBounds.size() && i < gpuVisible.size(); i++)
+		{
+			if ((gpuVisible[i] != 0) == cpu.visible(i))
+				continue;
+			if (nearPlane(frustum, worldBounds[i], 1e-3f))
+				continue;
+			mismatches++;
+		}
+		return mismatches;
+	}
+
+private:
+	Shader cullShader;
+	Shader hiZShader;
+	unsigned int bucketCount, bucketCapacity;
+	unsigned int objectCount, objectCapacity;
+	GpuBuffer drawBuffer, objectBuffer, meshBuffer, commandBuffer, counterBuffer, visibilityBuffer;
+	Texture2D hiZTexture, depthTexture;
+	int hiZWidth, hiZHeight, hiZLevels;
+	bool hiZValid;
+	glm::mat4 hiZViewProjection;
+	struct {
+		GLint objectCount, bucketCapacity, frustumPlanes, useHiZ, previousViewProjection, hiZSize, hiZLevels;
+	} cullUniforms;
+	struct {
+		GLint copyDepth, srcSize, dstSize;
+	} hiZUniforms;
+
+	void createHiZTargets(int width, int height)
+	{
+		hiZWidth = width;
+		hiZHeight = height;
+		hiZLevels = 1;
+		while ((glm::max(width, height) >> hiZLevels) > 0)
+			hiZLevels++;
+
+		// 32F holds any window depth format without loss, glCopyTexSubImage2D converts into it
+		depthTexture = Texture2D::create();
+		glBindTexture(GL_TEXTURE_2D, depthTexture.id());
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+		hiZTexture = Texture2D::create();
+		glBindTexture(GL_TEXTURE_2D, hiZTexture.id());
+		glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		hiZValid = false;
+	}
+
+	static bool nearPlane(const Frustum &frustum, const AABB &box, float epsilon)
+	{
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extents();
+		for (int i = 0; i < 6; i++)
+		{
+			const glm::vec4 &p = frustum.planes[i];
+			float d = glm::dot(glm::vec3(p), c) + p.w + glm::dot(glm::abs(glm::vec3(p)), e);
+			if (fabsf(d) < epsilon)
+				return true;
+		}
+		return false;
+	}
+};
+#endif
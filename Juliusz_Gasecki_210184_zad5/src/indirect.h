@@ -0,0 +1,236 @@
+#pragma once
+#ifndef INDIRECT_H
+#define INDIRECT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gl_handles.h"
+#include "mesh.h"
+#include "geometry_arena.h"
+#include "ring_buffer.h"
+#include "frame_arena.h"
+
+#include <vector>
+using namespace std;
+
+// layout required by GL_DRAW_INDIRECT_BUFFER for glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint  baseVertex;
+	GLuint baseInstance;
+};
+
+// per-instance data read by indirect.vs from an std430 SSBO (array stride 80 bytes)
+struct DrawInstanceData {
+	glm::mat4 model;
+	GLuint materialIndex;
+	GLuint animationIndex;	// door_anim.vs: 1 + slot in the door animation buffer, 0 = not animated
+	GLuint pad[2];
+};
+
+// true when the context can run the multi-draw path (gl_BaseInstance is core GLSL since 4.60)
+inline bool supportsMultiDrawIndirect()
+{
+	return GLAD_GL_VERSION_4_6 != 0;
+}
+
+// One bucket per shader combination. Every draw pushed into a bucket becomes one indirect command.
+struct RenderBucket {
+	GLuint multiDrawProgram;	// indirect.vs variant, fetches DrawInstanceData itself
+	GLuint fallbackProgram;		// classic variant with a "model" uniform
+	GLint fallbackModelLoc;
+	GLint fallbackMaterialLoc;
+	// frame arena storage, replaced by RenderQueue::clear() every frame
+	FrameVector<DrawElementsIndirectCommand> commands;
+	FrameVector<DrawInstanceData> instances;
+};
+
+// Collects the draws of a frame per bucket and submits every bucket with a single glMultiDrawElementsIndirect,
+// or with a plain glDrawElementsBaseVertex loop when the context is older than 4.6.
+class RenderQueue
+{
+public:
+	vector<RenderBucket> buckets;
+	bool multiDraw;
+
+	RenderQueue() : multiDraw(supportsMultiDrawIndirect()), stream(NULL),
+		indirectCapacity(0), instanceCapacity(0)
+	{
+		if (multiDraw)
+		{
+			indirectBuffer = GpuBuffer::create();
+			instanceBuffer = GpuBuffer::create();
+		}
+	}
+
+	// returns the bucket index used by push()
+	unsigned int addBucket(GLuint multiDrawProgram, GLuint fallbackProgram)
+	{
+		RenderBucket bucket;
+		bucket.multiDrawProgram = multiDrawProgram;
+		bucket.fallbackProgram = fallbackProgram;
+		bucket.fallbackModelLoc = glGetUniformLocation(fallbackProgram, "model");
+		bucket.fallbackMaterialLoc = glGetUniformLocation(fallbackProgram, "materialIndex");
+		buckets.push_back(bucket);
+		return (unsigned int)buckets.size() - 1;
+	}
+
+	// commands and instance data go through the frame's ring buffer instead of the queue's own buffers
+	void setStreamBuffer(GpuRingBuffer *ring)
+	{
+		stream = ring;
+	}
+
+	// the program a caller has to set view/projection on before submit()
+	GLuint programFor(unsigned int bucket) const
+	{
+		return multiDraw ? buckets[bucket].multiDrawProgram : buckets[bucket].fallbackProgram;
+	}
+
+	// starts the frame's lists on the calling thread's frame arena, sized like last frame's so push() rarely grows
+	// them; last frame's storage may already be reused, it is dropped without being read
+	void clear()
+	{
+		for (unsigned int i = 0; i < buckets.size(); i++)
+		{
+			size_t last = buckets[i].commands.size();
+			FrameVector<DrawElementsIndirectCommand>().swap(buckets[i].commands);
+			FrameVector<DrawInstanceData>().swap(buckets[i].instances);
+			buckets[i].commands.reserve(last);
+			buckets[i].instances.reserve(last);
+		}
+	}
+
+	void push(unsigned int bucket, const MeshRange &range, const glm::mat4 &model, GLuint materialIndex = 0, GLuint animationIndex = 0)
+	{
+		RenderBucket &b = buckets[bucket];
+		DrawElementsIndirectCommand command;
+		command.count = range.count;
+		command.instanceCount = 1;
+		command.firstIndex = range.firstIndex;
+		command.baseVertex = range.baseVertex;
+		command.baseInstance = 0;	// patched in submit() once all buckets are known
+		b.commands.push_back(command);
+
+		DrawInstanceData instance;
+		instance.model = model;
+		instance.materialIndex = materialIndex;
+		instance.animationIndex = animationIndex;
+		instance.pad[0] = instance.pad[1] = 0;
+		b.instances.push_back(instance);
+	}
+
+	void submit(const GeometryArena &geometry)
+	{
+		geometry.bind();
+		if (multiDraw)
+			submitMultiDraw();
+		else
+			submitFallback();
+		glBindVertexArray(0);
+	}
+
+private:
+	GpuRingBuffer *stream;
+	GpuBuffer indirectBuffer, instanceBuffer;
+	size_t indirectCapacity, instanceCapacity;
+
+	void submitMultiDraw()
+	{
+		// pack every bucket into one command and one instance buffer so both are uploaded once per frame
+		size_t total = 0;
+		for (unsigned int i = 0; i < buckets.size(); i++)
+			total += buckets[i].commands.size();
+		FrameVector<DrawElementsIndirectCommand> frameCommands;
+		FrameVector<DrawInstanceData> frameInstances;
+		frameCommands.reserve(total);
+		frameInstances.reserve(total);
+		for (unsigned int i = 0; i < buckets.size(); i++)
+		{
+			for (unsigned int j = 0; j < buckets[i].commands.size(); j++)
+			{
+				DrawElementsIndirectCommand command = buckets[i].commands[j];
+				command.baseInstance = (GLuint)frameInstances.size();
+				frameCommands.push_back(command);
+				frameInstances.push_back(buckets[i].instances[j]);
+			}
+		}
+		if (frameCommands.empty())
+			return;
+
+		GLsizeiptr commandBytes = frameCommands.size() * sizeof(DrawElementsIndirectCommand);
+		GLsizeiptr instanceBytes = frameInstances.size() * sizeof(DrawInstanceData);
+		GLintptr commandBase = 0;
+		RingAllocation commands = { NULL, 0, 0, 0 };
+		RingAllocation instances = { NULL, 0, 0, 0 };
+		if (stream)
+		{
+			commands = stream->upload(frameCommands.data(), commandBytes, sizeof(GLuint));
+			instances = stream->upload(frameInstances.data(), instanceBytes, stream->storageAlignment());
+		}
+		if (commands.valid() && instances.valid())
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, instances.buffer, instances.offset, instances.size);
+			commandBase = commands.offset;
+		}
+		else
+		{
+			// no ring or it ran full this frame
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer.id());
+			upload(GL_DRAW_INDIRECT_BUFFER, commandBytes, frameCommands.data(), indirectCapacity);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer.id());
+			upload(GL_SHADER_STORAGE_BUFFER, instanceBytes, frameInstances.data(), instanceCapacity);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer.id());
+		}
+
+		size_t first = 0;
+		for (unsigned int i = 0; i < buckets.size(); i++)
+		{
+			GLsizei drawCount = (GLsizei)buckets[i].commands.size();
+			if (drawCount == 0)
+				continue;
+			glUseProgram(buckets[i].multiDrawProgram);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(void*)(commandBase + first * sizeof(DrawElementsIndirectCommand)), drawCount, 0);
+			first += drawCount;
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	void submitFallback()
+	{
+		for (unsigned int i = 0; i < buckets.size(); i++)
+		{
+			RenderBucket &b = buckets[i];
+			if (b.commands.empty())
+				continue;
+			glUseProgram(b.fallbackProgram);
+			for (unsigned int j = 0; j < b.commands.size(); j++)
+			{
+				glUniformMatrix4fv(b.fallbackModelLoc, 1, GL_FALSE, glm::value_ptr(b.instances[j].model));
+				if (b.fallbackMaterialLoc >= 0)
+					glUniform1i(b.fallbackMaterialLoc, (GLint)b.instances[j].materialIndex);
+				glDrawElementsBaseVertex(GL_TRIANGLES, b.commands[j].count, GL_UNSIGNED_INT,
+					(void*)(b.commands[j].firstIndex * sizeof(unsigned int)), b.commands[j].baseVertex);
+			}
+		}
+	}
+
+	// grows the bound buffer geometrically, otherwise just overwrites the used range
+	void upload(GLenum target, size_t size, const void *data, size_t &capacity)
+	{
+		if (size > capacity)
+		{
+			capacity = size * 2;
+			glBufferData(target, capacity, NULL, GL_DYNAMIC_DRAW);
+		}
+		glBufferSubData(target, 0, size, data);
+	}
+};
+#endif
@@ -0,0 +1,347 @@
+#pragma once
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Counts the jobs started with it that have not finished yet. Waiting on it is how callers join a batch and how
+// a job expresses that it depends on another batch.
+struct JobCounter {
+	atomic<unsigned int> value;
+
+	JobCounter() : value(0) {}
+	bool done() const { return value.load(memory_order_acquire) == 0; }
+};
+
+struct Job {
+	function<void()> task;
+	JobCounter *counter;
+	const JobCounter *after;	// must be done before task runs, may be NULL
+	atomic<bool> busy;			// slot still queued or running, the owner may not reuse it
+
+	Job() : counter(NULL), after(NULL), busy(false) {}
+};
+
+// Chase-Lev work-stealing deque of fixed capacity (Le, Pop, Cohen, Zappa Nardelli 2013). The owning thread pushes
+// and pops at the bottom without contention, every other thread steals from the top with one CAS.
+class JobDeque
+{
+public:
+	static const unsigned int CAPACITY = 4096;
+
+	JobDeque() : top(0), bottom(0)
+	{
+		for (unsigned int i = 0; i < CAPACITY; i++)
+			slots[i].store(NULL, memory_order_relaxed);
+	}
+
+	// owner only, false when full
+	bool push(Job *job)
+	{
+		long long b = bottom.load(memory_order_relaxed);
+		long long t = top.load(memory_order_acquire);
+		if (b - t >= (long long)CAPACITY)
+			return false;
+		// release on the slot publishes the job's fields to whoever steals it
+		slots[b & (CAPACITY - 1)].store(job, memory_order_release);
+		bottom.store(b + 1, memory_order_release);
+		return true;
+	}
+
+	// owner only, newest first
+	Job *pop()
+	{
+		long long b = bottom.load(memory_order_relaxed) - 1;
+		bottom.store(b, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		long long t = top.load(memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, memory_order_relaxed);
+			return NULL;
+		}
+		Job *job = slots[b & (CAPACITY - 1)].load(memory_order_relaxed);
+		if (t == b)
+		{
+			// last job, race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+				job = NULL;
+			bottom.store(b + 1, memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// any thread, oldest first; NULL when empty or another thread won the race
+	Job *steal()
+	{
+		long long t = top.load(memory_order_acquire);
+		atomic_thread_fence(memory_order_seq_cst);
+		long long b = bottom.load(memory_order_acquire);
+		if (t >= b)
+			return NULL;
+		Job *job = slots[t & (CAPACITY - 1)].load(memory_order_acquire);
+		if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+			return NULL;
+		return job;
+	}
+
+	bool empty() const
+	{
+		return top.load(memory_order_acquire) >= bottom.load(memory_order_acquire);
+	}
+
+private:
+	atomic<long long> top;
+	char pad[64];	// keeps the thieves' top and the owner's bottom on different cache lines
+	atomic<long long> bottom;
+	atomic<Job*> slots[CAPACITY];
+};
+
+// Fork/join job system: one deque per thread, idle threads steal. Thread 0 is the one that created the system
+// (the main thread); with mainThreadHelps it runs jobs while it waits, otherwise it only submits and workers
+// cover every core. Jobs started from threads outside the system (e.g. the simulation thread) run inline.
+class JobSystem
+{
+public:
+	explicit JobSystem(unsigned int threadCount = 0, bool mainThreadHelps = true)
+		: helps(mainThreadHelps), quit(false), sleeping(0), signal(0)
+	{
+		if (threadCount == 0)
+			threadCount = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
+		// the main thread counts as one of the threads only when it takes part
+		unsigned int workerCount = helps ? threadCount - 1 : threadCount;
+		contexts.resize(workerCount + 1);
+		for (unsigned int i = 0; i < contexts.size(); i++)
+			contexts[i] = new ThreadContext();
+		current() = Binding(this, 0);
+		for (unsigned int i = 1; i < contexts.size(); i++)
+			workers.push_back(thread(&JobSystem::workerLoop, this, i));
+	}
+
+	~JobSystem()
+	{
+		{
+			lock_guard<mutex> lock(sleepMutex);
+			quit.store(true);
+			signal++;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		for (unsigned int i = 0; i < contexts.size(); i++)
+			delete contexts[i];
+		if (current().system == this)
+			current() = Binding(NULL, 0);
+	}
+
+	// queues task on the calling thread's deque; counter is incremented now and decremented when it finished
+	void run(JobCounter &counter, function<void()> task, const JobCounter *after = NULL)
+	{
+		counter.value.fetch_add(1, memory_order_relaxed);
+		int index = threadIndex();
+		Job *job = index < 0 ? NULL : acquireSlot(*contexts[index]);
+		if (job)
+		{
+			job->task = move(task);
+			job->counter = &counter;
+			job->after = after;
+			if (contexts[index]->deque.push(job))
+			{
+				wakeOne();
+				return;
+			}
+			task = move(job->task);
+			job->busy.store(false, memory_order_relaxed);
+		}
+		// outside the system, out of slots or deque full: run it right here
+		if (after)
+			wait(*after);
+		task();
+		counter.value.fetch_sub(1, memory_order_release);
+	}
+
+	// returns once counter is done; helping threads run queued jobs meanwhile
+	void wait(const JobCounter &counter)
+	{
+		int index = threadIndex();
+		bool help = index > 0 || (index == 0 && helps);
+		unsigned int idle = 0;
+		while (!counter.done())
+		{
+			Job *job = help ? findJob(index) : NULL;
+			if (job)
+			{
+				execute(job);
+				idle = 0;
+			}
+			else if (++idle > 64)
+				this_thread::yield();
+		}
+	}
+
+	// splits [begin, end) into chunks of at most grain items, body(first, last) runs once per chunk, returns when all ran
+	template <typename Body>
+	void parallelFor(unsigned int begin, unsigned int end, unsigned int grain, Body body)
+	{
+		if (begin >= end)
+			return;
+		if (grain == 0)
+			grain = 1;
+		JobCounter counter;
+		unsigned int first = begin;
+		// the caller keeps the first chunk for itself, that is one job less to schedule
+		unsigned int ownLast = first + grain < end ? first + grain : end;
+		// jobs point at body instead of copying it, small enough for function<> to store without allocating;
+		// body outlives them since this waits for all
+		Body *shared = &body;
+		for (first = ownLast; first < end; first += grain)
+		{
+			unsigned int last = end - first > grain ? first + grain : end;
+			run(counter, [shared, first, last]() { (*shared)(first, last); });
+		}
+		body(begin, ownLast);
+		wait(counter);
+	}
+
+	// threads jobs can run on, including the main thread when it helps
+	unsigned int threadCount() const { return (unsigned int)contexts.size() - (helps ? 0 : 1); }
+	// slot of the calling thread (0 = main thread), -1 outside the system; handy for per-thread scratch buffers
+	int threadIndex() const { return current().system == this ? (int)current().index : -1; }
+	unsigned int slotCount() const { return (unsigned int)contexts.size(); }
+
+private:
+	struct ThreadContext {
+		JobDeque deque;
+		Job jobs[JobDeque::CAPACITY];
+		unsigned int nextJob;
+		unsigned int victim;
+
+		ThreadContext() : nextJob(0), victim(0) {}
+	};
+
+	struct Binding {
+		JobSystem *system;
+		unsigned int index;
+
+		Binding(JobSystem *system = NULL, unsigned int index = 0) : system(system), index(index) {}
+	};
+
+	bool helps;
+	vector<ThreadContext*> contexts;
+	vector<thread> workers;
+	atomic<bool> quit;
+	atomic<unsigned int> sleeping;
+	mutex sleepMutex;
+	condition_variable wake;
+	unsigned int signal;
+
+	static Binding &current()
+	{
+		static thread_local Binding binding;
+		return binding;
+	}
+
+	// next pool slot of the owner; a slot still in flight is never handed out twice
+	Job *acquireSlot(ThreadContext &context)
+	{
+		for (unsigned int tries = 0; tries < 4; tries++)
+		{
+			Job *job = &context.jobs[context.nextJob++ & (JobDeque::CAPACITY - 1)];
+			bool expected = false;
+			if (job->busy.compare_exchange_strong(expected, true, memory_order_acquire))
+				return job;
+		}
+		return NULL;
+	}
+
+	Job *findJob(int index)
+	{
+		ThreadContext &own = *contexts[index];
+		Job *job = own.deque.pop();
+		if (job)
+			return job;
+		unsigned int count = (unsigned int)contexts.size();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			unsigned int victim = (own.victim + i) % count;
+			if (victim == (unsigned int)index)
+				continue;
+			job = contexts[victim]->deque.steal();
+			if (job)
+			{
+				own.victim = victim;
+				return job;
+			}
+		}
+		return NULL;
+	}
+
+	void execute(Job *job)
+	{
+		if (job->after)
+			wait(*job->after);
+		job->task();
+		job->task = nullptr;
+		JobCounter *counter = job->counter;
+		job->busy.store(false, memory_order_release);
+		counter->value.fetch_sub(1, memory_order_release);
+	}
+
+	bool anyQueued() const
+	{
+		for (unsigned int i = 0; i < contexts.size(); i++)
+			if (!contexts[i]->deque.empty())
+				return true;
+		return false;
+	}
+
+	void wakeOne()
+	{
+		atomic_thread_fence(memory_order_seq_cst);
+		if (sleeping.load(memory_order_relaxed) == 0)
+			return;
+		{
+			lock_guard<mutex> lock(sleepMutex);
+			signal++;
+		}
+		wake.notify_one();
+	}
+
+	void workerLoop(unsigned int index)
+	{
+		current() = Binding(this, index);
+		unsigned int idle = 0;
+		while (!quit.load(memory_order_relaxed))
+		{
+			Job *job = findJob(index);
+			if (job)
+			{
+				execute(job);
+				idle = 0;
+				continue;
+			}
+			if (++idle < 256)
+			{
+				this_thread::yield();
+				continue;
+			}
+			// nothing to steal for a while: sleep until run() signals; announcing first and checking the deques
+			// after means a push either sees the sleeper or the sleeper sees the job
+			unique_lock<mutex> lock(sleepMutex);
+			sleeping.fetch_add(1, memory_order_seq_cst);
+			atomic_thread_fence(memory_order_seq_cst);
+			unsigned int seen = signal;
+			if (!anyQueued())
+				wake.wait(lock, [this, seen] { return signal != seen || quit.load(); });
+			sleeping.fetch_sub(1, memory_order_relaxed);
+			idle = 0;
+		}
+	}
+};
+#endif
@@ -11,15 +11,44 @@
 #include <shader.h>
 #include <camera.h>
 #include <model.h>
+#include <geometry_arena.h>
+#include <material.h>
+#include <indirect.h>
+#include <frustum.h>
+#include <bvh.h>
+#include <occlusion.h>
+#include <gpu_cull.h>
+#include <simd_math.h>
+#include <ring_buffer.h>
+#include <sim_thread.h>
+#include <job_system.h>
+#include <animation.h>
+#include <door_animation.h>
+#include <world.h>
+#include <scene_systems.h>
+#include <frame_arena.h>
+#include <alloc_counter.h>
+#include <static_batch.h>
+#include <uniform_blocks.h>
 
 #include <iostream>
+#include <cstdlib>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <random>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
-unsigned int loadCubemap(vector<std::string> faces);
+Texture2D loadTexture(const char *path);
+TextureCube loadCubemap(vector<std::string> faces);
+int runScene(GLFWwindow *window);
+int benchmarkVertexStreams();
+int benchmarkSceneIndex();
+int benchmarkMathKernels();
+int benchmarkJobSystem();
 
 // settings
 const unsigned int SCR_WIDTH = 1280;
@@ -34,6 +63,33 @@ bool firstMouse = true;
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+// fixed simulation steps per second, independent of the frame rate
+const double SIM_RATE = 60.0;
+// keys the simulation thread reacts to; GLFW may only be polled on the main thread, which publishes them here
+const unsigned int SIM_KEY_UP = 1, SIM_KEY_DOWN = 2, SIM_KEY_LEFT = 4, SIM_KEY_RIGHT = 8;
+std::atomic<unsigned int> simInput(0);
+
+// everything the fixed simulation step advances, the last two states are blended for rendering. World transforms
+// and visibility are not in it: they follow the blended state and the mouse-driven camera of the frame being drawn,
+// so the render thread derives them (on the job system) after lerpState instead of drawing them a step late.
+struct TramState {
+	glm::vec3 tramPosition;
+	vector<AnimationPose> poses;			// Animator pose slots, empty while the GPU animates the doors
+	vector<AnimationPlayback> playback;		// Animator instances
+};
+
+void lerpState(const TramState &a, const TramState &b, float t, TramState &state) {
+	state.tramPosition = glm::mix(a.tramPosition, b.tramPosition, t);
+	state.playback = b.playback;
+	if (a.poses.size() != b.poses.size())
+	{
+		state.poses = b.poses;
+		return;
+	}
+	state.poses.resize(b.poses.size());
+	for (unsigned int i = 0; i < b.poses.size(); i++)
+		state.poses[i] = mixPose(a.poses[i], b.poses[i], t);
+}
 
 void camToTram(Camera &camera, glm::vec3 position) {
 	if (camera.Position.x != (position.x / 100) + 1.2  || camera.Position.y != (position.y / 100) + 0 || camera.Position.z != (position.z / 100) + 0.8)
@@ -46,13 +102,30 @@ void camToTram(Camera &camera, glm::vec3 position) {
 			
 }
 
+// seconds on a monotonic clock, for the benchmark modes
+double benchmarkClock()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 int main()
 {
+	// PAG_BVH_BENCH=1 times scene index queries and refits against brute force for up to 1M objects and exits,
+	// no window needed
+	if (getenv("PAG_BVH_BENCH") != NULL)
+		return benchmarkSceneIndex();
+	// PAG_SIMD_BENCH=1 times the batch math kernels per SIMD level for 1k and 100k elements and exits
+	if (getenv("PAG_SIMD_BENCH") != NULL)
+		return benchmarkMathKernels();
+	// PAG_JOB_BENCH=1 measures the job system's overhead per job and parallelFor at several grain sizes and exits
+	if (getenv("PAG_JOB_BENCH") != NULL)
+		return benchmarkJobSystem();
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
@@ -62,6 +135,14 @@ int main()
 														 // glfw window creation
 														 // --------------------
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+	// no 4.6 driver: 4.5/4.3 still run the compute culling, 3.3 falls back to a draw loop and CPU culling
+	const int fallbackVersions[][2] = { { 4, 5 }, { 4, 3 }, { 3, 3 } };
+	for (int i = 0; i < 3 && window == NULL; i++)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, fallbackVersions[i][0]);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, fallbackVersions[i][1]);
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+	}
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -81,6 +162,7 @@ int main()
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 	{
 		std::cout << "Failed to initialize GLAD" << std::endl;
+		glfwTerminate();
 		return -1;
 	}
 
@@ -88,13 +170,43 @@ int main()
 	// -----------------------------
 	glEnable(GL_DEPTH_TEST);
 
+	// every GL object of the scene is owned inside runScene, so all of them are deleted while the context exists
+	int result = runScene(window);
+	glfwTerminate();
+	return result;
+}
+
+// builds the scene and runs the render loop until the window closes, returns the exit code
+// ---------------------------------------------------------------------------------------
+int runScene(GLFWwindow *window)
+{
+	// worker threads for per-frame CPU work, one per core; the main thread runs jobs too while it waits
+	JobSystem jobs;
+
 	// build and compile shaders
 	// -------------------------
-	Shader buildingShader("res/shaders/budynki.vs", "res/shaders/budynki.fs");
-	Shader planeShader("res/shaders/normalCubeShader.vs", "res/shaders/normalCubeShader.fs");
-	Shader shader("res/shaders/cubemap1.vs", "res/shaders/cubemap2.fs");
-	Shader shader2("res/shaders/cubemap1.vs", "res/shaders/cubemap1.fs");
-	Shader skyboxShader("res/shaders/skybox.vs", "res/shaders/skybox.fs");
+	Shader buildingShader("res/shaders/budynki.vs", "res/shaders/budynki.fs", nullptr, ColoredVertexLayout::declarations());
+	Shader planeShader("res/shaders/normalCubeShader.vs", "res/shaders/normalCubeShader.fs", nullptr, ColoredVertexLayout::declarations());
+	Shader shader("res/shaders/cubemap1.vs", "res/shaders/cubemap2.fs", nullptr, ModelVertexLayout::declarations());
+	Shader shader2("res/shaders/cubemap1.vs", "res/shaders/cubemap1.fs", nullptr, ModelVertexLayout::declarations());
+	Shader skyboxShader("res/shaders/skybox.vs", "res/shaders/skybox.fs", nullptr, PositionVertexLayout::declarations());
+	// multi-draw variants fetch their model matrix from the draw buffer, only compiled when the context can run them
+	std::unique_ptr<Shader> indirectShader, indirectShader2;
+	if (supportsMultiDrawIndirect())
+	{
+		indirectShader.reset(new Shader("res/shaders/indirect.vs", "res/shaders/cubemap2.fs", nullptr, ModelVertexLayout::declarations()));
+		indirectShader2.reset(new Shader("res/shaders/indirect.vs", "res/shaders/cubemap1.fs", nullptr, ModelVertexLayout::declarations()));
+	}
+	// camera and clock of every scene shader, one buffer written once per frame
+	UniformBuffer<GpuFrame> frameUniforms(GpuFrame::BINDING);
+	frameUniforms.attach(buildingShader.ID);
+	frameUniforms.attach(planeShader.ID);
+	frameUniforms.attach(shader.ID);
+	frameUniforms.attach(shader2.ID);
+	if (indirectShader)
+		frameUniforms.attach(indirectShader->ID);
+	if (indirectShader2)
+		frameUniforms.attach(indirectShader2->ID);
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -243,58 +355,18 @@ int main()
 	GLint projectionLoc = glGetUniformLocation(shader.ID, "projection");
 
 	// cube VAO
-	unsigned int cubeVAO, cubeVBO;
-	glGenVertexArrays(1, &cubeVAO);
-	glGenBuffers(1, &cubeVBO);
-	glBindVertexArray(cubeVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-
-	// plane VAO
-	unsigned int planeVBO, planeVAO;
-	glGenBuffers(1, &planeVBO);
-	glGenVertexArrays(1, &planeVAO);
-	glBindVertexArray(planeVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesPlane), &verticesPlane, GL_DYNAMIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	VertexArray cubeVAO = VertexArray::create();
+	GpuBuffer cubeVBO = GpuBuffer::create();
+	bufferStorage(cubeVBO.id(), sizeof(cubeVertices), &cubeVertices, false);
+	ColoredVertexLayout::attach(cubeVAO.id(), cubeVBO.id());
 
 	//Tramwaj :3
-	unsigned int tramwajVAO, tramwajVBO;
-	glGenVertexArrays(1, &tramwajVAO);
-	glGenBuffers(1, &tramwajVBO);
-	glBindVertexArray(tramwajVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, tramwajVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-
-
-	unsigned int VBO, VAO;
-	glGenBuffers(1, &VBO);
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verticesBuildings), &verticesBuildings, GL_DYNAMIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-
-	glBindVertexArray(VAO);
+	VertexArray tramwajVAO = VertexArray::create();
+	GpuBuffer tramwajVBO = GpuBuffer::create();
+	bufferStorage(tramwajVBO.id(), sizeof(cubeVertices), &cubeVertices, false);
+	ColoredVertexLayout::attach(tramwajVAO.id(), tramwajVBO.id());
+
+
 	glm::vec3 translations[20];
 	int index = 0;
 	float offset = 1;
@@ -310,29 +382,28 @@ int main()
 
 		}
 	}
-	// buildings VAo
-	unsigned int instanceVBO;
-	glGenBuffers(1, &instanceVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * 20, &translations[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glVertexAttribDivisor(2, 1);
+	// the ground plane and the buildings never move: merged once, per material and grid cell, in world space.
+	StaticBatcher staticGeometry(8.0f);
+	glm::mat4 planeModel = glm::scale(glm::translate(glm::mat4(1), glm::vec3(1, -0.5f, 1)), glm::vec3(60.0f, 0.0f, 60.0f));
+	staticGeometry.add(planeShader.ID, verticesPlane, 6, planeModel);
+	for (unsigned int i = 0; i < 20; i++)
+		staticGeometry.add(buildingShader.ID, verticesBuildings, 36, glm::translate(glm::mat4(1), translations[i]));
+	staticGeometry.build(jobs);
+	// the inputs of the batch shaders
+	ColoredVertexLayout::matches(planeShader.ID);
+	ColoredVertexLayout::matches(buildingShader.ID);
+	vector<unsigned char> staticVisible(staticGeometry.batches.size());
+
+	// per-frame data (render queue commands) is streamed through one fenced ring buffer
+	GpuRingBuffer frameData(1 << 20);
 
 
 	// skybox VAO
-	unsigned int skyboxVAO, skyboxVBO;
-	glGenVertexArrays(1, &skyboxVAO);
-	glGenBuffers(1, &skyboxVBO);
-	glBindVertexArray(skyboxVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+	VertexArray skyboxVAO = VertexArray::create();
+	GpuBuffer skyboxVBO = GpuBuffer::create();
+	bufferStorage(skyboxVBO.id(), sizeof(skyboxVertices), &skyboxVertices, false);
+	PositionVertexLayout::attach(skyboxVAO.id(), skyboxVBO.id());
+	PositionVertexLayout::matches(skyboxShader.ID);
 
 	// load textures
 	// -------------
@@ -345,7 +416,7 @@ int main()
 		"res/textures/land_lf.jpg",
 		"res/textures/land_rt.jpg"
 	};
-	unsigned int cubemapTexture = loadCubemap(faces);
+	TextureCube cubemapTexture = loadCubemap(faces);
 
 	// shader configuration
 	// --------------------
@@ -360,93 +431,280 @@ int main()
 
 
 	glm::mat4 localTransform(1);
-
-	//DrawCam * camModel = new DrawCam(new Model("res/models/drzwi.obj"), shader2.ID);
-	//GraphNode camNode(localTransform, camModel, modelLoc, shader.ID);
-
-	DrawModel * tramwaj = new DrawModel(new Model("res/models/tramwaj.obj"), shader.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode tramwajNode(localTransform, tramwaj, modelLoc, shader.ID);
-
-	DrawModel * drzwi = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node(localTransform, drzwi, modelLoc, shader2.ID);
-
-	DrawModel * drzwi2 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node2(localTransform, drzwi2, modelLoc, shader2.ID);
-
-	DrawModel * drzwi3 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node3(localTransform, drzwi3, modelLoc, shader2.ID);
-
-	DrawModel * drzwi4 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
+	// local/world matrices of every scene node, updated once per frame
+	TransformHierarchy transforms;
+
+	// materials of every model, resolved into texture arrays and one uniform table once all are loaded
+	MaterialLibrary materials;
+	// one vertex/index buffer pair for every model mesh, the doors share one copy of drzwi.obj. It keeps only the
+	// attributes the model shaders read, so no tangents while none of them does normal mapping.
+	VertexAttributeMask modelAttributes = activeVertexAttributes(shader.ID) | activeVertexAttributes(shader2.ID);
+	if (indirectShader)
+		modelAttributes |= activeVertexAttributes(indirectShader->ID);
+	if (indirectShader2)
+		modelAttributes |= activeVertexAttributes(indirectShader2->ID);
+	GeometryArena sceneGeometry(LAYOUT_SPLIT, modelAttributes);
+	ModelVertexLayout::matches(shader.ID);
+	ModelVertexLayout::matches(shader2.ID);
+	std::unique_ptr<Model> tramwajModel(new Model("res/models/tramwaj.obj", &materials, &sceneGeometry));
+	std::unique_ptr<Model> drzwiModel(new Model("res/models/drzwi.obj", &materials, &sceneGeometry));
+	materials.upload();
+	materials.attach(shader.ID);
+	materials.attach(shader2.ID);
+	if (indirectShader)
+		materials.attach(indirectShader->ID);
+	if (indirectShader2)
+		materials.attach(indirectShader2->ID);
 	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node4(localTransform, drzwi4, modelLoc, shader2.ID);
-
-	DrawModel * drzwi5 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node5(localTransform, drzwi5, modelLoc, shader2.ID);
-	
-	DrawModel * drzwi6 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node6(localTransform, drzwi6, modelLoc, shader2.ID);
+	int tramwajTransform = transforms.create(localTransform);
+	int drzwiTransforms[8];
+	for (unsigned int d = 0; d < 8; d++)
+	{
+		localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
+		drzwiTransforms[d] = transforms.create(localTransform, tramwajTransform);
+	}
 
-	DrawModel * drzwi7 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node7(localTransform, drzwi7, modelLoc, shader2.ID);
+	// arena ranges of the meshes for the render queue; nothing is unloaded, so they never move
+	vector<MeshRange> tramwajRanges;
+	vector<MeshRange> drzwiRanges;
+	for (unsigned int i = 0; i < tramwajModel->meshes.size(); i++)
+		tramwajRanges.push_back(sceneGeometry.range(tramwajModel->meshes[i].allocation));
+	for (unsigned int i = 0; i < drzwiModel->meshes.size(); i++)
+		drzwiRanges.push_back(sceneGeometry.range(drzwiModel->meshes[i].allocation));
 
-	DrawModel * drzwi8 = new DrawModel(new Model("res/models/drzwi.obj"), shader2.ID);
-	localTransform = glm::scale(localTransform, glm::vec3(0.001f, 0.001f, 0.001f));
-	GraphNode drzwi2Node8(localTransform, drzwi8, modelLoc, shader2.ID);
+	// PAG_STREAM_BENCH=1 times a position-only pass over the interleaved and the split vertex layout and exits
+	if (getenv("PAG_STREAM_BENCH") != NULL)
+	{
+		return benchmarkVertexStreams();
+	}
 
+	RenderQueue renderQueue;
+	unsigned int tramwajBucket = renderQueue.addBucket(indirectShader ? indirectShader->ID : 0, shader.ID);
+	unsigned int drzwiBucket = renderQueue.addBucket(indirectShader2 ? indirectShader2->ID : 0, shader2.ID);
+	renderQueue.setStreamBuffer(&frameData);
+	bool useRenderQueue = true;
+	bool queueKeyDown = false;
+
+	// scene objects are entities; the tram and the doors differ by Animation, so they live in two archetypes.
+	// Their meshes keep consecutive slots in the per-mesh arrays below, tram first.
+	World scene;
+	const ComponentMask drawable = componentBit<Transform>() | componentBit<MeshRef>() | componentBit<Material>()
+		| componentBit<Bounds>() | componentBit<Visibility>();
+	Entity tramwajEntity = scene.create(drawable);
+	scene.get<Transform>(tramwajEntity).node = tramwajTransform;
+	scene.get<MeshRef>(tramwajEntity).model = tramwajModel.get();
+	scene.get<MeshRef>(tramwajEntity).ranges = tramwajRanges.data();
+	scene.get<MeshRef>(tramwajEntity).bucket = tramwajBucket;
+	scene.get<Material>(tramwajEntity).program = shader.ID;
+	scene.get<Material>(tramwajEntity).modelUniform = modelLoc;
+	scene.get<Bounds>(tramwajEntity).local = tramwajModel->bounds;
+	Entity drzwiEntities[8];
+	for (unsigned int d = 0; d < 8; d++)
+	{
+		Entity door = scene.create(drawable | componentBit<Animation>());
+		scene.get<Transform>(door).node = drzwiTransforms[d];
+		scene.get<MeshRef>(door).model = drzwiModel.get();
+		scene.get<MeshRef>(door).ranges = drzwiRanges.data();
+		scene.get<MeshRef>(door).bucket = drzwiBucket;
+		scene.get<MeshRef>(door).firstMesh = (unsigned int)(tramwajRanges.size() + d * drzwiRanges.size());
+		scene.get<Material>(door).program = shader2.ID;
+		scene.get<Material>(door).modelUniform = glGetUniformLocation(shader2.ID, "model");
+		scene.get<Bounds>(door).local = drzwiModel->bounds;
+		drzwiEntities[d] = door;
+	}
+	FrustumCuller culler;
+
+	// scene index over whole objects: 0 is the tram, 1-8 the doors, 9-28 the buildings
+	DynamicAabbTree sceneIndex;
+	transforms.update();
+	updateTransformsSystem(scene, transforms, jobs);
+	// proxy user data is the object id, sceneObjects maps the entity ones back
+	vector<Entity> sceneObjects;
+	sceneObjects.push_back(tramwajEntity);
+	sceneObjects.insert(sceneObjects.end(), drzwiEntities, drzwiEntities + 8);
+	for (unsigned int i = 0; i < sceneObjects.size(); i++)
+		scene.get<Visibility>(sceneObjects[i]).proxy = sceneIndex.createProxy(scene.get<Bounds>(sceneObjects[i]).world, i);
+	for (unsigned int i = 0; i < 20; i++)
+		sceneIndex.createProxy(AABB(translations[i] - glm::vec3(0.5f), translations[i] + glm::vec3(0.5f)), 9 + i);
+	bool objectVisible[29];
+	vector<int> meshSlots(tramwajRanges.size() + 8 * drzwiRanges.size());
+	vector<AABB> meshWorldBounds(meshSlots.size());
+	// object space bounds and world matrix of every mesh, transformed to world bounds in one batch per frame
+	vector<AABB> meshLocalBounds;
+	Mat4Array meshModels(meshSlots.size());
+	for (unsigned int i = 0; i < tramwajRanges.size(); i++)
+		meshLocalBounds.push_back(tramwajModel->meshes[i].bounds);
+	for (unsigned int d = 0; d < 8; d++)
+		for (unsigned int i = 0; i < drzwiRanges.size(); i++)
+			meshLocalBounds.push_back(drzwiModel->meshes[i].bounds);
+	vector<unsigned char> meshVisible(meshSlots.size());
+
+	// software occlusion: building boxes and a hull inside the tram body are rasterized as occluders
+	OcclusionCuller occlusion(jobs);
+	vector<glm::vec3> buildingOccluder;
+	vector<unsigned int> buildingOccluderIndices;
+	for (unsigned int i = 0; i < 36; i++)
+	{
+		buildingOccluder.push_back(glm::vec3(verticesBuildings[i * 6], verticesBuildings[i * 6 + 1], verticesBuildings[i * 6 + 2]));
+		buildingOccluderIndices.push_back(i);
+	}
+	AABB tramwajHull(tramwajModel->bounds.center() - tramwajModel->bounds.extents() * 0.7f,
+		tramwajModel->bounds.center() + tramwajModel->bounds.extents() * 0.7f);
+	bool useOcclusion = true;
+	bool occlusionKeyDown = false;
+	glm::vec3 lastTramwajCenter = scene.get<Bounds>(tramwajEntity).world.center();
+	float lastTitleUpdate = 0.0f;
+
+	// GPU culling: one object per mesh, in the same order as meshWorldBounds. Drawing its output needs the
+	// multi-draw path, otherwise (or with G) the CPU culling above decides what the render queue gets.
+	std::unique_ptr<GpuCuller> gpuCuller;
+	vector<GpuCullObject> gpuObjects(meshSlots.size());
+	if (GpuCuller::supported())
+	{
+		gpuCuller.reset(new GpuCuller(2, (unsigned int)meshSlots.size()));
+		vector<MeshRange> cullRanges(tramwajRanges);
+		cullRanges.insert(cullRanges.end(), drzwiRanges.begin(), drzwiRanges.end());
+		gpuCuller->setMeshes(cullRanges);
+	}
+	bool useGpuCulling = true;
+	bool gpuCullKeyDown = false;
+	// PAG_GPU_CULL_TEST=1 checks the compute frustum test against the CPU culler every frame and exits after
+	// a few seconds, non zero on a mismatch (runs on a software rasterizer, e.g. LIBGL_ALWAYS_SOFTWARE=1)
+	bool gpuCullTest = getenv("PAG_GPU_CULL_TEST") != NULL;
+	unsigned int gpuCullTestFrames = 0;
+	unsigned int gpuCullMismatches = 0;
+	if (gpuCullTest && !gpuCuller)
+	{
+		std::cout << "ERROR::GPUCULL:: compute shaders need an OpenGL 4.3 context" << std::endl;
+		return -1;
+	}
 
-	//tramwajNode.addChildren(&camNode);
-	tramwajNode.addChildren(&drzwi2Node);
-	tramwajNode.addChildren(&drzwi2Node2);
-	tramwajNode.addChildren(&drzwi2Node3);
-	tramwajNode.addChildren(&drzwi2Node4);
-	tramwajNode.addChildren(&drzwi2Node5);
-	tramwajNode.addChildren(&drzwi2Node6);
-	tramwajNode.addChildren(&drzwi2Node7);
-	tramwajNode.addChildren(&drzwi2Node8);
+	// PAG_ALLOC_TEST=1 (with a PAG_COUNT_ALLOCATIONS build) checks that steady-state frames make no global heap
+	// allocations: after a warm-up every frame is counted, it exits after a few seconds, non zero if any allocated
+	bool allocTest = getenv("PAG_ALLOC_TEST") != NULL;
+	unsigned int allocTestFrames = 0;
+	unsigned int allocatingFrames = 0;
+	const unsigned int ALLOC_TEST_WARMUP = 120;
+	if (allocTest && !countingAllocations())
+	{
+		std::cout << "ERROR::ALLOC:: build with -DPAG_COUNT_ALLOCATIONS=ON to count allocations" << std::endl;
+		return -1;
+	}
 
-	//tramwajNode.addChildren(&lolNode);
 	glm::vec3 tramwajPosition(1);
-	//glm::vec3 doorPosition1 = glm::vec3(31.0f, 2.0f, -20.0f);
-	//glm::vec3 doorPosition2 = glm::vec3(26.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition1 = glm::vec3(31.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition2 = glm::vec3(29.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition7 = glm::vec3(27.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition8 = glm::vec3(25.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition3 = glm::vec3(-2.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition4 = glm::vec3(-7.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition5 = glm::vec3(-33.0f, 2.0f, -20.0f);
-	glm::vec3 doorPosition6 = glm::vec3(-38.0f, 2.0f, -20.0f);
-
-
-	float doorsRotate1 = 0;
-	float doorsRotate2 = 0;
-	float doorsRotate3 = 0;
-	float doorsRotate4 = 0;
-
-	float doorsRotate5 = 0;
-	float doorsRotate6 = 0;
-	float doorsRotate7 = 0;
-	float doorsRotate8 = 0;
+
+	// door motion is data: every clip in the file is played on the door nodes it names, LEFT runs them forwards
+	// and RIGHT backwards, each stops at its own end
+	vector<AnimationClip> doorClips = loadAnimationClips("res/animations/tram_doors.anim");
+	Animator animator;
+	int drzwiSlots[8];
+	for (unsigned int d = 0; d < 8; d++)
+	{
+		drzwiSlots[d] = animator.bindTarget("drzwi" + std::to_string(d + 1), drzwiTransforms[d]);
+		scene.get<Animation>(drzwiEntities[d]).slot = drzwiSlots[d];
+	}
+	vector<int> doorAnimations;
+	for (unsigned int i = 0; i < doorClips.size(); i++)
+	{
+		int instance = animator.play(doorClips[i], 0.0f);
+		if (instance >= 0)
+			doorAnimations.push_back(instance);
+	}
+	animator.update(0.0f);
+	// fixed from here on, the render loop writes pose i to node animatedNodes[i]
+	const vector<int> animatedNodes = animator.targets();
+
+	// animated-instance mode: door_anim.vs evaluates the door matrices from per-door anchors, the CPU only writes
+	// an anchor when a door clip changes speed. The door nodes then sit at the tram's origin and cull with bounds
+	// swept over the whole motion.
+	std::unique_ptr<GpuDoorAnimations> gpuDoorAnimations;
+	std::unique_ptr<Shader> doorAnimShader;
+	if (GpuDoorAnimations::supported() && indirectShader2)
+	{
+		gpuDoorAnimations.reset(new GpuDoorAnimations(animator));
+		if (gpuDoorAnimations->isValid())
+		{
+			doorAnimShader.reset(new Shader("res/shaders/door_anim.vs", "res/shaders/cubemap1.fs", nullptr, ModelVertexLayout::declarations()));
+			materials.attach(doorAnimShader->ID);
+			frameUniforms.attach(doorAnimShader->ID);
+			// built after the arena, it has to make do with the attributes the arena kept
+			if (activeVertexAttributes(doorAnimShader->ID) & ~sceneGeometry.attributes())
+				std::cout << "ERROR::GEOMETRY:: door_anim.vs reads vertex attributes the scene geometry does not keep" << std::endl;
+		}
+		else
+		{
+			gpuDoorAnimations.reset();
+		}
+	}
+	vector<AABB> drzwiSweptBounds(8);
+	vector<AABB> drzwiSweptMeshBounds(8 * drzwiRanges.size());
+	if (gpuDoorAnimations)
+		for (unsigned int d = 0; d < 8; d++)
+		{
+			drzwiSweptBounds[d] = gpuDoorAnimations->sweptBounds(drzwiSlots[d], drzwiModel->bounds);
+			for (unsigned int i = 0; i < drzwiRanges.size(); i++)
+				drzwiSweptMeshBounds[d * drzwiRanges.size() + i] = gpuDoorAnimations->sweptBounds(drzwiSlots[d], drzwiModel->meshes[i].bounds);
+		}
+	bool useGpuDoors = true;
+	bool gpuDoorKeyDown = false;
+	bool gpuDoorsActive = false;
+	// read by the simulation thread: while set the animator only keeps time, poses are not sampled
+	std::atomic<bool> animateOnGpu(false);
+	// multi-draw shaders fetch their vertices from the shared vertex buffer instead of through attributes
+	bool vertexPullKeyDown = false;
 
 	// render loop
 	// -----------
-	float doorsStatez1 = 0;
-	float doorsStatex1 = 0;
-	float doorsStatez2 = 0;
-	float doorsStatex2 = 0;
-	float doorsStatez3 = 0;
-	float doorsStatex3 = 0;
-	bool doorsOpen = false;
 	bool followTram = true;
+	auto captureState = [&]() {
+		TramState state;
+		state.tramPosition = tramwajPosition;
+		if (animator.isSampling())
+			state.poses = animator.poses();
+		for (unsigned int i = 0; i < animator.instanceCount(); i++)
+			state.playback.push_back(animator.getPlayback(i));
+		return state;
+	};
+	// One fixed simulation step, run on the simulation thread. It owns tramwajPosition and the animator from
+	// sim.start() on; the render loop only sees them through the snapshots the thread publishes.
+	auto simStep = [&](TramState &state) {
+		unsigned int input = simInput.load();
+		if (input & SIM_KEY_UP) {
+			tramwajPosition += glm::vec3(1.0f, 0.0f, -0.0f);
+		
+		
+		
+		}
+		else if (input & SIM_KEY_DOWN) {
+			tramwajPosition += glm::vec3(-1.0f, 0.0f, -0.0f);
+		
+		}
+
+		float doorSpeed = ((input & SIM_KEY_LEFT) ? 1.0f : 0.0f) - ((input & SIM_KEY_RIGHT) ? 1.0f : 0.0f);
+		for (unsigned int i = 0; i < doorAnimations.size(); i++)
+			animator.setSpeed(doorAnimations[i], doorSpeed);
+		animator.setSampling(!animateOnGpu.load());
+		animator.update((float)(1.0 / SIM_RATE));
+		state.tramPosition = tramwajPosition;
+		if (animator.isSampling())
+			state.poses = animator.poses();
+		else
+			state.poses.clear();
+		state.playback.resize(animator.instanceCount());
+		for (unsigned int i = 0; i < animator.instanceCount(); i++)
+			state.playback[i] = animator.getPlayback(i);
+	};
+	SimulationThread<TramState> sim(SIM_RATE, captureState(), simStep);
+	TramState renderState = captureState();
+	TramState appliedState = renderState;
+	bool posesApplied = false;
+	sim.start();
 	while (!glfwWindowShouldClose(window))
 	{
+		// scratch memory of the last frame is free again on every thread
+		FrameArena::beginFrame();
+		unsigned long long frameAllocations = allocationCount();
+
 		// per-frame time logic
 		// --------------------
 		float currentFrame = glfwGetTime();
@@ -456,6 +714,24 @@ int main()
 		// input
 		// -----
 		processInput(window);
+		unsigned int keys = 0;
+		if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+			keys |= SIM_KEY_UP;
+		if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+			keys |= SIM_KEY_DOWN;
+		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+			keys |= SIM_KEY_LEFT;
+		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+			keys |= SIM_KEY_RIGHT;
+		simInput.store(keys);
+		frameData.beginFrame();
+
+		// newest published snapshot, rendered a fraction of a step behind; never waits for the simulation thread
+		const SimSnapshot<TramState> &snapshot = sim.latest();
+		float simAlpha = sim.alpha(SimulationThread<TramState>::now());
+		lerpState(snapshot.previous, snapshot.current, simAlpha, renderState);
+		// the clock door_anim.vs runs on: simulation time of the interpolated state
+		float animationTime = (float)((snapshot.tick + simAlpha - 1.0) / SIM_RATE);
 
 		// render
 		// ------
@@ -467,24 +743,26 @@ int main()
 		glm::mat4 model = glm::mat4(1.0f);
 		glm::mat4 view = camera.GetViewMatrix();
 		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		Frustum frustum = extractFrustum(projection * view);
+		frameUniforms.data.view = view;
+		frameUniforms.data.projection = projection;
+		frameUniforms.data.cameraPos = camera.Position;
+		frameUniforms.data.animationTime = animationTime;
+		frameUniforms.update();
 		shader.setMat4("model", model);
-		shader.setMat4("view", view);
-		shader.setMat4("projection", projection);
-		shader.setVec3("cameraPos", camera.Position);
 		// cubes
-		/*glBindVertexArray(cubeVAO);
+		/*glBindVertexArray(cubeVAO.id());
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture.id());
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 		glBindVertexArray(0);*/
 
 		//Rysowanie tramwaju
+		// material table and texture arrays for every tram/door draw below, whichever path draws them
+		materials.bind();
 
 		shader2.use();
 		shader.setMat4("model", model);
-		shader.setMat4("view", view);
-		shader.setMat4("projection", projection);
-		shader.setVec3("cameraPos", camera.Position);
 		shader.use();
 		localTransform = glm::mat4(1);
 		//glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(tramwajPosition));
@@ -492,9 +770,9 @@ int main()
 		//glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
 		if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-			camera.Position.x = tramwajPosition.x/100;
-			camera.Position.y = tramwajPosition.y/100;
-			camera.Position.z = tramwajPosition.z/100;
+			camera.Position.x = renderState.tramPosition.x/100;
+			camera.Position.y = renderState.tramPosition.y/100;
+			camera.Position.z = renderState.tramPosition.z/100;
 			camera.Position += glm::vec3(-1.2f, 0.0f, -0.8f);
 
 		}
@@ -502,418 +780,259 @@ int main()
 			followTram = !followTram;
 
 		}
-
-		//model = glm::scale(model, glm::vec3(2, 0.3f, 1));
-		model = glm::translate(model, glm::vec3(0.0f, -0.5f, 0.0f));
-		model = glm::scale(model, glm::vec3(0.01f, 0.01f, 0.01f));
-		if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-			if (followTram)
-			{
-				camToTram(camera, tramwajPosition);
-				//camera.Position += glm::vec3(0.01f, 0.0f, -0.0f);
-			}	
-			tramwajPosition += glm::vec3(1.0f, 0.0f, -0.0f);
-			
-			
-			
+		if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+			if (!occlusionKeyDown)
+				useOcclusion = !useOcclusion;
+			occlusionKeyDown = true;
 		}
-		else if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-			if (followTram)
-			{
-				camToTram(camera, tramwajPosition);
-				//camera.Position += glm::vec3(-0.01f, 0.0f, -0.0f);
-			}	
-			tramwajPosition += glm::vec3(-1.0f, 0.0f, -0.0f);
-			
+		else
+			occlusionKeyDown = false;
+		if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) {
+			if (!queueKeyDown)
+				useRenderQueue = !useRenderQueue;
+			queueKeyDown = true;
 		}
-		model = glm::translate(model, tramwajPosition);
-		shader.setMat4("model", model);
-		tramwajNode.setLocalTransform(model);
-		
-		////////////////////////////////////////////////////////////////////////////
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition1);
-		localTransform = glm::rotate(localTransform, doorsRotate5, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-
-		//localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-		drzwi2Node.setLocalTransform(localTransform);
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition2);
-		localTransform = glm::rotate(localTransform, doorsRotate6, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-		//localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-		drzwi2Node2.setLocalTransform(localTransform);
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition7);
-		localTransform = glm::rotate(localTransform, doorsRotate7, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-		drzwi2Node7.setLocalTransform(localTransform);
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition8);
-		localTransform = glm::rotate(localTransform, doorsRotate8, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-		drzwi2Node8.setLocalTransform(localTransform);
-
-		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-			doorsOpen = true;
-			localTransform = glm::mat4(1);
-			if (doorsStatex1 < 15) {
-				localTransform = glm::mat4(1);
-				doorPosition1 += glm::vec3(0.2f, 0.0f, 0.33f );
-				doorPosition2 += glm::vec3(-0.33f , 0.0f, 0.33f);
-				doorPosition7 += glm::vec3(0.33f , 0.0f, 0.33f);
-				doorPosition8 += glm::vec3(-0.2f , 0.0f, 0.33f);
-				doorsRotate5 += 0.1 ;
-				doorsRotate6 += 0.05 ;
-				doorsRotate7 -= 0.05 ;
-				doorsRotate8 -= 0.1 ;
-				doorsStatex1 += 1;
-				localTransform = glm::translate(localTransform, doorPosition1);
-				localTransform = glm::rotate(localTransform, doorsRotate5, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node.setLocalTransform(localTransform);
-
-				localTransform = glm::translate(localTransform, doorPosition2);
-				localTransform = glm::rotate(localTransform, doorsRotate6, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node2.setLocalTransform(localTransform);
-
-				localTransform = glm::translate(localTransform, doorPosition7);
-				localTransform = glm::rotate(localTransform, doorsRotate7, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node7.setLocalTransform(localTransform);
-
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition8);
-				localTransform = glm::rotate(localTransform, doorsRotate8, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node8.setLocalTransform(localTransform);
-			}
+		else
+			queueKeyDown = false;
+		if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+			if (!gpuCullKeyDown)
+				useGpuCulling = !useGpuCulling;
+			gpuCullKeyDown = true;
 		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-			doorsOpen = true;
-			localTransform = glm::mat4(1);
-			if (doorsStatex1 > 0) {
-				localTransform = glm::mat4(1);
-				doorPosition1 += glm::vec3(-0.2f, 0.0f, -0.33f);
-				doorPosition2 += glm::vec3(0.33f, 0.0f, -0.33f);
-				doorPosition7 += glm::vec3(-0.33f, 0.0f, -0.33f);
-				doorPosition8 += glm::vec3(0.2f, 0.0f, -0.33f);
-				doorsRotate5 -= 0.1;
-				doorsRotate6 -= 0.05;
-				doorsRotate7 += 0.05;
-				doorsRotate8 += 0.1;
-				doorsStatex1 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition1);
-				localTransform = glm::rotate(localTransform, doorsRotate5, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node.setLocalTransform(localTransform);
-
-				localTransform = glm::translate(localTransform, doorPosition2);
-				localTransform = glm::rotate(localTransform, doorsRotate6, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node2.setLocalTransform(localTransform);
-
-				localTransform = glm::translate(localTransform, doorPosition7);
-				localTransform = glm::rotate(localTransform, doorsRotate7, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node7.setLocalTransform(localTransform);
-
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition8);
-				localTransform = glm::rotate(localTransform, doorsRotate8, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.05f, 0.23f, 0.1f));
-				drzwi2Node8.setLocalTransform(localTransform);
-			}
-
+		else
+			gpuCullKeyDown = false;
+		if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+			if (!gpuDoorKeyDown)
+				useGpuDoors = !useGpuDoors;
+			gpuDoorKeyDown = true;
 		}
+		else
+			gpuDoorKeyDown = false;
+		if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) {
+			if (!vertexPullKeyDown)
+				sceneGeometry.vertexPulling = !sceneGeometry.vertexPulling;
+			vertexPullKeyDown = true;
+		}
+		else
+			vertexPullKeyDown = false;
 
-
-		/*
-		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-			localTransform = glm::mat4(1);
-			if (doorsStatez1 >= 0 && doorsStatez1 < 5)
-			{
-				localTransform = glm::mat4(1);
-				doorPosition1 += glm::vec3(0.0f, 0.0f, -1.0f);
-				doorPosition2 += glm::vec3(0.0f, 0.0f, -1.0f);
-				doorsStatez1 += 1;
-				localTransform = glm::translate(localTransform, doorPosition2);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node2.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition1);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node.setLocalTransform(localTransform);
-			}
-			else if (doorsStatez1 >= 5 && doorsStatex1 <=2)
+		// switching door modes: GPU doors need the multi-draw queue, their nodes then only carry the tram's matrix
+		bool gpuDoors = useGpuDoors && gpuDoorAnimations && useRenderQueue;
+		if (gpuDoors != gpuDoorsActive)
+		{
+			gpuDoorsActive = gpuDoors;
+			animateOnGpu.store(gpuDoors);
+			renderQueue.buckets[drzwiBucket].multiDrawProgram = gpuDoors ? doorAnimShader->ID : indirectShader2->ID;
+			for (unsigned int d = 0; d < 8; d++)
 			{
-				localTransform = glm::mat4(1);
-				doorPosition1 += glm::vec3(1.0f, 0.0f, 0.0f);
-				doorPosition2 += glm::vec3(-1.0f, 0.0f, 0.0f);
-				doorsStatex1 += 1;
-				localTransform = glm::translate(localTransform, doorPosition2);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node2.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition1);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node.setLocalTransform(localTransform);
+				Bounds &bounds = scene.get<Bounds>(drzwiEntities[d]);
+				bounds.local = gpuDoors ? drzwiSweptBounds[d] : drzwiModel->bounds;
+				bounds.dirty = 1;
+				if (gpuDoors)
+					transforms.setLocal(drzwiTransforms[d], glm::mat4(1));
+				for (unsigned int i = 0; i < drzwiRanges.size(); i++)
+					meshLocalBounds[tramwajRanges.size() + d * drzwiRanges.size() + i] =
+						gpuDoors ? drzwiSweptMeshBounds[d * drzwiRanges.size() + i] : drzwiModel->meshes[i].bounds;
 			}
+			if (gpuDoors)
+				gpuDoorAnimations->invalidate();
+			else
+				posesApplied = false;
 		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-			localTransform = glm::mat4(1);
-			if (doorsStatez1 == 5 && doorsStatex1 > 0)
-			{
-				localTransform = glm::mat4(1);
-				doorPosition1 += glm::vec3(-1.0f, 0.0f, .0f);
-				doorPosition2 += glm::vec3(1.0f, 0.0f, .0f);
-				doorsStatex1 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition2);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node2.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition1);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node.setLocalTransform(localTransform);
-			}
-			else if (doorsStatez1 > 0 && doorsStatex1 ==0)
-			{
-				localTransform = glm::mat4(1);
-				doorPosition1 += glm::vec3(.0f, 0.0f, 1.0f);
-				doorPosition2 += glm::vec3(.0f, 0.0f, 1.0f);
-				doorsStatez1 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition2);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node2.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition1);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node.setLocalTransform(localTransform);
-			}
+		if (gpuDoorsActive)
+		{
+			gpuDoorAnimations->sync(snapshot.current.playback, (float)(snapshot.tick / SIM_RATE));
+			gpuDoorAnimations->bind();
 		}
-		*/
-		
-		
-		//////////////////////////////////////////////////////////////////////////////
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition3);
-		localTransform = glm::rotate(localTransform, doorsRotate1, glm::vec3(0,1,0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-		drzwi2Node3.setLocalTransform(localTransform);
 
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition4);
-		localTransform = glm::rotate(localTransform , doorsRotate2, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-		drzwi2Node4.setLocalTransform(localTransform);
-
-		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-			doorsOpen = true;
-			localTransform = glm::mat4(1);
-			if (doorsStatex2 < 5) {
-				localTransform = glm::mat4(1);
-				doorPosition3 += glm::vec3(-0.6f, 0.0f, 1.0f);
-				doorPosition4 += glm::vec3(0.6f, 0.0f, 1.0f);
-				doorsRotate1 += 0.3;
-				doorsRotate2 -= 0.3;
-				doorsStatex2 += 1;
-				localTransform = glm::translate(localTransform, doorPosition3);
-				localTransform = glm::rotate(localTransform, doorsRotate1, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				
-				drzwi2Node3.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition4);
-				localTransform = glm::rotate(localTransform, doorsRotate2, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node4.setLocalTransform(localTransform);
+		if (followTram && (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS))
+			camToTram(camera, renderState.tramPosition);
+		//model = glm::scale(model, glm::vec3(2, 0.3f, 1));
+		model = glm::translate(model, glm::vec3(0.0f, -0.5f, 0.0f));
+		model = glm::scale(model, glm::vec3(0.01f, 0.01f, 0.01f));
+		model = glm::translate(model, renderState.tramPosition);
+		shader.setMat4("model", model);
+		transforms.setLocal(tramwajTransform, model);
+		// animated nodes get new local transforms only on frames their interpolated pose changed, otherwise they stay clean
+		if (!gpuDoorsActive && renderState.poses.size() == animatedNodes.size())
+		{
+			for (unsigned int i = 0; i < animatedNodes.size(); i++)
+			{
+				if (posesApplied && renderState.poses[i] == appliedState.poses[i])
+					continue;
+				transforms.setLocal(animatedNodes[i], renderState.poses[i].matrix());
+				appliedState.poses[i] = renderState.poses[i];
 			}
+			posesApplied = true;
 		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-			doorsOpen = true;
-			localTransform = glm::mat4(1);
-			if (doorsStatex2 > 0) {
-				localTransform = glm::mat4(1);
-				doorPosition3 += glm::vec3(0.6f, 0.0f, -1.0f);
-				doorPosition4 += glm::vec3(-0.6f, 0.0f, -1.0f);
-				doorsRotate1 -= 0.3;
-				doorsRotate2 += 0.3;
-				doorsStatex2 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition3);
-				localTransform = glm::rotate(localTransform, doorsRotate1, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-
-				drzwi2Node3.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition4);
-				localTransform = glm::rotate(localTransform, doorsRotate2, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node4.setLocalTransform(localTransform);
-			}
-
+		// one linear pass over the hierarchy, only the tram and the doors that moved are recomputed
+		transforms.update();
+		//glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(tramwaj.getTransform()));
+		// culling: the scene index prunes whole objects, the SIMD culler then tests the meshes of the survivors
+		updateTransformsSystem(scene, transforms, jobs);
+		glm::mat4 tramwajWorld = scene.get<Transform>(tramwajEntity).world;
+		glm::vec3 tramwajCenter = scene.get<Bounds>(tramwajEntity).world.center();
+		glm::vec3 tramwajDisplacement = tramwajCenter - lastTramwajCenter;
+		lastTramwajCenter = tramwajCenter;
+		moveProxiesSystem(scene, sceneIndex, tramwajDisplacement);
+
+		for (unsigned int i = 0; i < 29; i++)
+			objectVisible[i] = false;
+		clearVisibilitySystem(scene);
+		sceneIndex.queryFrustum(frustum, [&](int object) {
+			objectVisible[object] = true;
+			if (object < (int)sceneObjects.size())
+				scene.get<Visibility>(sceneObjects[object]).visible = 1;
+			return true;
+		});
+
+		culler.clear();
+		unsigned int meshCount = (unsigned int)meshSlots.size();
+		meshModelsSystem(scene, meshModels);
+		mathKernels().transformAABBs(meshModels.data(), meshLocalBounds.data(), meshWorldBounds.data(), meshCount);
+		scene.forEachChunk(componentBit<MeshRef>() | componentBit<Visibility>(), [&](Chunk &chunk) {
+			const MeshRef *mesh = chunk.array<MeshRef>();
+			const Visibility *visibility = chunk.array<Visibility>();
+			for (unsigned int e = 0; e < chunk.size(); e++)
+				for (unsigned int i = 0; i < mesh[e].model->meshes.size(); i++)
+				{
+					unsigned int slot = mesh[e].firstMesh + i;
+					meshSlots[slot] = visibility[e].visible ? (int)culler.add(meshWorldBounds[slot]) : -1;
+				}
+		});
+		culler.cull(frustum);
+
+		// occluders are only the objects that survived the frustum, occludees are tested after rasterization
+		if (useOcclusion)
+		{
+			occlusion.beginFrame(projection * view);
+			for (unsigned int i = 0; i < 20; i++)
+				if (objectVisible[9 + i])
+					occlusion.addOccluder(buildingOccluder.data(), buildingOccluderIndices.data(), buildingOccluderIndices.size(), glm::translate(glm::mat4(1), translations[i]));
+			if (objectVisible[0])
+				occlusion.addOccluderBox(tramwajHull, tramwajWorld);
+			occlusion.rasterize();
 		}
+		unsigned int visibleCount = 0;
+		for (unsigned int i = 0; i < meshCount; i++)
+		{
+			meshVisible[i] = meshSlots[i] >= 0 && culler.visible(meshSlots[i]) && (!useOcclusion || occlusion.isVisible(meshWorldBounds[i]));
+			visibleCount += meshVisible[i];
+		}
+		// static geometry is culled per cell batch
+		unsigned int batchCount = (unsigned int)staticGeometry.batches.size();
+		for (unsigned int b = 0; b < batchCount; b++)
+		{
+			const AABB &bounds = staticGeometry.batches[b].bounds;
+			staticVisible[b] = frustumContainsAABB(frustum, bounds) && (!useOcclusion || occlusion.isVisible(bounds));
+			visibleCount += staticVisible[b];
+		}
+		unsigned int culledCount = meshCount + batchCount - visibleCount;
 
-		//////////////////////////////////////////////////////////////////////////////
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition5);
-		localTransform = glm::rotate(localTransform, doorsRotate3, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-		drzwi2Node5.setLocalTransform(localTransform);
-
-		localTransform = glm::mat4(1);
-		localTransform = glm::translate(localTransform, doorPosition6);
-		localTransform = glm::rotate(localTransform, doorsRotate4, glm::vec3(0, 1, 0));
-		localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-		drzwi2Node6.setLocalTransform(localTransform);
-
-		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-			doorsOpen = true;
-			localTransform = glm::mat4(1);
-			if (doorsStatex3 < 10) {
-				localTransform = glm::mat4(1);
-				doorPosition5 += glm::vec3(0.05f, 0.0f, 0.5f);
-				doorPosition6 += glm::vec3(-0.05f, 0.0f, 0.5f);
-				doorsRotate3 += 0.15;
-				doorsRotate4 -= 0.15;
-				doorsStatex3 += 1;
-				localTransform = glm::translate(localTransform, doorPosition5);
-				localTransform = glm::rotate(localTransform, doorsRotate3, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-
-				drzwi2Node5.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition6);
-				localTransform = glm::rotate(localTransform, doorsRotate4, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node6.setLocalTransform(localTransform);
+		if (gpuCuller)
+		{
+			unsigned int object = 0;
+			for (unsigned int i = 0; i < tramwajRanges.size(); i++, object++)
+			{
+				const AABB &bounds = meshLocalBounds[object];
+				gpuObjects[object].boundsMin = glm::vec4(bounds.min, 1.0f);
+				gpuObjects[object].boundsMax = glm::vec4(bounds.max, 1.0f);
+				gpuObjects[object].model = meshModels[object];
+				gpuObjects[object].mesh = i;
+				gpuObjects[object].bucket = tramwajBucket;
+				gpuObjects[object].materialIndex = tramwajModel->meshes[i].material;
+				gpuObjects[object].animationIndex = 0;
 			}
+			for (unsigned int d = 0; d < 8; d++)
+				for (unsigned int i = 0; i < drzwiRanges.size(); i++, object++)
+				{
+					const AABB &bounds = meshLocalBounds[object];
+					gpuObjects[object].boundsMin = glm::vec4(bounds.min, 1.0f);
+					gpuObjects[object].boundsMax = glm::vec4(bounds.max, 1.0f);
+					gpuObjects[object].model = meshModels[object];
+					gpuObjects[object].mesh = (GLuint)(tramwajRanges.size() + i);
+					gpuObjects[object].bucket = drzwiBucket;
+					gpuObjects[object].materialIndex = drzwiModel->meshes[i].material;
+					gpuObjects[object].animationIndex = gpuDoorsActive ? drzwiSlots[d] + 1 : 0;
+				}
+			gpuCuller->setObjects(gpuObjects);
 		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-			doorsOpen = true;
-			localTransform = glm::mat4(1);
-			if (doorsStatex3 > 0) {
-				localTransform = glm::mat4(1);
-				doorPosition5 += glm::vec3(-0.05f, 0.0f, -0.5f);
-				doorPosition6 += glm::vec3(0.05f, 0.0f, -0.5f);
-				doorsRotate3 -= 0.15;
-				doorsRotate4 += 0.15;
-				doorsStatex3 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition5);
-				localTransform = glm::rotate(localTransform, doorsRotate3, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-
-				drzwi2Node5.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition6);
-				localTransform = glm::rotate(localTransform, doorsRotate4, glm::vec3(0, 1, 0));
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node6.setLocalTransform(localTransform);
-			}
+		if (gpuCullTest)
+		{
+			unsigned int mismatches = gpuCuller->validate(frustum, meshWorldBounds);
+			if (mismatches)
+				std::cout << "ERROR::GPUCULL:: frame " << gpuCullTestFrames << ": " << mismatches << " objects differ from the CPU culler" << std::endl;
+			gpuCullMismatches += mismatches;
+			if (++gpuCullTestFrames == 300)
+				glfwSetWindowShouldClose(window, true);
+		}
+		bool drawGpuCulled = useRenderQueue && useGpuCulling && gpuCuller && GpuCuller::canDraw() && !gpuCullTest;
 
+		if (currentFrame - lastTitleUpdate > 1.0f)
+		{
+			char title[128];
+			snprintf(title, sizeof(title), "LearnOpenGL | visible %u culled %u (occluded %u)", visibleCount, culledCount,
+				useOcclusion ? occlusion.stats.occluded : 0);
+			glfwSetWindowTitle(window, title);
+			lastTitleUpdate = currentFrame;
 		}
-		/*
-		if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-			localTransform = glm::mat4(1);
-			if (doorsStatez3 >= 0 && doorsStatez3 < 5)
-			{
-				localTransform = glm::mat4(1);
-				doorPosition5 += glm::vec3(0.0f, 0.0f, -1.0f);
-				doorPosition6 += glm::vec3(0.0f, 0.0f, -1.0f);
-				doorsStatez3 += 1;
-				localTransform = glm::translate(localTransform, doorPosition6);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node5.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition5);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node6.setLocalTransform(localTransform);
-			}
-			else if (doorsStatez3 >= 5 && doorsStatex3 <= 2)
+
+		if (drawGpuCulled)
+		{
+			// visibility never comes back to the CPU, the compute pass writes the indirect commands directly
+			gpuCuller->cull(frustum, useOcclusion);
+			sceneGeometry.bind();
+			for (unsigned int b = 0; b < renderQueue.buckets.size(); b++)
 			{
-				localTransform = glm::mat4(1);
-				doorPosition5 += glm::vec3(1.0f, 0.0f, 0.0f);
-				doorPosition6 += glm::vec3(-1.0f, 0.0f, 0.0f);
-				doorsStatex3 += 1;
-				localTransform = glm::translate(localTransform, doorPosition6);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node6.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition5);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node5.setLocalTransform(localTransform);
+				GLuint program = renderQueue.buckets[b].multiDrawProgram;
+				glUseProgram(program);
+				sceneGeometry.setVertexFormat(program);
+				gpuCuller->draw(b, program);
 			}
+			glBindVertexArray(0);
 		}
-		if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-			localTransform = glm::mat4(1);
-			if (doorsStatez3 == 5 && doorsStatex3 > 0)
-			{
-				localTransform = glm::mat4(1);
-				doorPosition5 += glm::vec3(-1.0f, 0.0f, .0f);
-				doorPosition6 += glm::vec3(1.0f, 0.0f, .0f);
-				doorsStatex3 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition6);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node6.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition5);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node5.setLocalTransform(localTransform);
-			}
-			else if (doorsStatez3 > 0 && doorsStatex3 == 0)
+		else if (useRenderQueue)
+		{
+			// the whole tram goes out as one bucket per shader instead of one glDrawElements per mesh
+			renderQueue.clear();
+			unsigned int mesh = 0;
+			for (unsigned int i = 0; i < tramwajRanges.size(); i++, mesh++)
+				if (meshVisible[mesh])
+					renderQueue.push(tramwajBucket, tramwajRanges[i], tramwajWorld, tramwajModel->meshes[i].material);
+			for (unsigned int d = 0; d < 8; d++)
+				for (unsigned int i = 0; i < drzwiRanges.size(); i++, mesh++)
+					if (meshVisible[mesh])
+						renderQueue.push(drzwiBucket, drzwiRanges[i], scene.get<Transform>(drzwiEntities[d]).world, drzwiModel->meshes[i].material, gpuDoorsActive ? drzwiSlots[d] + 1 : 0);
+			for (unsigned int b = 0; b < renderQueue.buckets.size(); b++)
 			{
-				localTransform = glm::mat4(1);
-				doorPosition5 += glm::vec3(.0f, 0.0f, 1.0f);
-				doorPosition6 += glm::vec3(.0f, 0.0f, 1.0f);
-				doorsStatez3 -= 1;
-				localTransform = glm::translate(localTransform, doorPosition6);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node6.setLocalTransform(localTransform);
-				localTransform = glm::mat4(1);
-				localTransform = glm::translate(localTransform, doorPosition5);
-				localTransform = glm::scale(localTransform, glm::vec3(0.1f, 0.23f, 0.1f));
-				drzwi2Node5.setLocalTransform(localTransform);
+				GLuint program = renderQueue.programFor(b);
+				glUseProgram(program);
+				sceneGeometry.setVertexFormat(program);
 			}
+			renderQueue.submit(sceneGeometry);
+		}
+		else
+		{
+			// one model per visible entity, in chunk order
+			glBindVertexArray(tramwajVAO.id());
+			if (drawSystem(scene))
+				glDrawArrays(GL_TRIANGLES, 0, 36 * 3);
 		}
-		*/
-		/////////////////////////////////////////////////////////////////////////////
-		//glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(tramwaj.getTransform()));
-		glBindVertexArray(tramwajVAO);
-		tramwajNode.draw();
-		glDrawArrays(GL_TRIANGLES, 0, 36 * 3);
 
 		//cellingNode.draw();
 		//lolNode.draw();
 		//draw plane
 
-		planeShader.use();
-		planeShader.setMat4("projection", projection);
-		planeShader.setMat4("view", view);
-		model = glm::mat4(1);
-		model = glm::translate(model, glm::vec3(1, -0.5f, 1));
-		model = glm::scale(model, glm::vec3(60.0f, 0.0f, 60.0f)); //
-		planeShader.setMat4("model", model);
-		glBindVertexArray(planeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		glBindVertexArray(0);
-
 		//draw buildings
-		buildingShader.use();
-		buildingShader.setMat4("projection", projection);
-		buildingShader.setMat4("view", view);
-		model = glm::mat4(1);
-		model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f)); 
-		buildingShader.setMat4("model", model);
-		glBindVertexArray(VAO);
-		glDrawArraysInstanced(GL_TRIANGLES, 0, sizeof(verticesBuildings), 20); // 100 triangles of 6 vertices each
-		glBindVertexArray(0);
+		staticGeometry.draw([&staticVisible](unsigned int batch) { return staticVisible[batch] != 0; });
+
+		// the depth of this frame's opaque objects becomes next frame's Hi-Z occluder
+		if (drawGpuCulled && useOcclusion)
+		{
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			gpuCuller->updateHiZ(framebufferWidth, framebufferHeight, projection * view);
+		}
 
 		// draw skybox as last
 		glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
@@ -922,9 +1041,9 @@ int main()
 		skyboxShader.setMat4("view", view);
 		skyboxShader.setMat4("projection", projection);
 		// skybox cube
-		glBindVertexArray(skyboxVAO);
+		glBindVertexArray(skyboxVAO.id());
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture.id());
 		glDrawArrays(GL_TRIANGLES, 0, 36);
 		glBindVertexArray(0);
 		glDepthFunc(GL_LESS); // set depth function back to default
@@ -933,18 +1052,355 @@ int main()
 		
 							  // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 							  // -------------------------------------------------------------------------------
+		frameData.endFrame();
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		if (allocTest && ++allocTestFrames > ALLOC_TEST_WARMUP)
+		{
+			unsigned long long allocations = allocationCount() - frameAllocations;
+			if (allocations)
+			{
+				std::cout << "ERROR::ALLOC:: frame " << allocTestFrames << ": " << allocations << " heap allocations" << std::endl;
+				allocatingFrames++;
+			}
+			if (allocTestFrames == ALLOC_TEST_WARMUP + 300)
+				glfwSetWindowShouldClose(window, true);
+		}
 	}
+	sim.stop();
 
-	// optional: de-allocate all resources once they've outlived their purpose:
-	// ------------------------------------------------------------------------
-	glDeleteVertexArrays(1, &cubeVAO);
-	glDeleteVertexArrays(1, &skyboxVAO);
-	glDeleteBuffers(1, &cubeVBO);
-	glDeleteBuffers(1, &skyboxVAO);
+	if (gpuCullTest)
+	{
+		std::cout << "GPUCULL:: " << gpuCullTestFrames << " frames, " << gpuCullMismatches << " mismatches" << std::endl;
+		return gpuCullMismatches == 0 ? 0 : 1;
+	}
+	if (allocTest)
+	{
+		std::cout << "ALLOC:: " << allocTestFrames - ALLOC_TEST_WARMUP << " frames checked, " << allocatingFrames << " allocated, frame arena peak "
+			<< FrameArena::local().peakBytes() << " bytes" << std::endl;
+		return allocatingFrames == 0 ? 0 : 1;
+	}
+	return 0;
+}
 
-	glfwTerminate();
+// Loads the tram and the doors once per vertex layout and draws all their meshes position-only, through the
+// arena's positionVAO, timed with a GL_TIME_ELAPSED query. Only vertex fetch differs between the two runs.
+// ---------------------------------------------------------------------------------------------------------
+int benchmarkVertexStreams()
+{
+	const unsigned int PASSES = 200;
+	const VertexLayout layouts[2] = { LAYOUT_INTERLEAVED, LAYOUT_SPLIT };
+	const char *names[2] = { "interleaved", "split" };
+
+	Shader depthShader("res/shaders/depth.vs", "res/shaders/depth.fs", nullptr, PositionVertexLayout::declarations());
+	depthShader.use();
+	depthShader.setMat4("model", glm::scale(glm::mat4(1), glm::vec3(0.001f)));
+	depthShader.setMat4("view", camera.GetViewMatrix());
+	depthShader.setMat4("projection", glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f));
+	glEnable(GL_DEPTH_TEST);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	GLuint query;
+	glGenQueries(1, &query);
+
+	for (unsigned int l = 0; l < 2; l++)
+	{
+		GeometryArena arena(layouts[l]);
+		Model tramwaj("res/models/tramwaj.obj", NULL, &arena);
+		Model drzwi("res/models/drzwi.obj", NULL, &arena);
+		vector<MeshRange> ranges;
+		for (unsigned int i = 0; i < tramwaj.meshes.size(); i++)
+			ranges.push_back(arena.range(tramwaj.meshes[i].allocation));
+		for (unsigned int i = 0; i < drzwi.meshes.size(); i++)
+			ranges.push_back(arena.range(drzwi.meshes[i].allocation));
+
+		arena.bindPositions();
+		// the first pass only warms up the driver, the timed ones redraw the same meshes
+		for (unsigned int pass = 0; pass <= PASSES; pass++)
+		{
+			if (pass == 1)
+			{
+				glFinish();
+				glBeginQuery(GL_TIME_ELAPSED, query);
+			}
+			glClear(GL_DEPTH_BUFFER_BIT);
+			for (unsigned int r = 0; r < ranges.size(); r++)
+				glDrawElementsBaseVertex(GL_TRIANGLES, ranges[r].count, GL_UNSIGNED_INT,
+					(void*)(ranges[r].firstIndex * sizeof(unsigned int)), ranges[r].baseVertex);
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+		glBindVertexArray(0);
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		std::cout << "STREAMS:: " << names[l] << ", " << arena.positionStride() << " bytes per position: "
+			<< elapsed / 1.0e6 / PASSES << " ms per pass (" << arena.stats().verticesUsed << " vertices)" << std::endl;
+	}
+
+	glDeleteQueries(1, &query);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	return 0;
+}
+
+// Fills scene indices with 1k to 1M random boxes at a constant density and times frustum and box queries against
+// a brute-force loop over the same fat boxes, then a refit pass that moves every tenth proxy each frame. Non zero
+// if the tree and the loop ever disagree on a query's result count.
+// ---------------------------------------------------------------------------------------------------------
+int benchmarkSceneIndex()
+{
+	const unsigned int counts[] = { 1000, 10000, 100000, 1000000 };
+	const unsigned int QUERIES = 20;
+	const unsigned int REFIT_FRAMES = 10;
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	unsigned int mismatches = 0;
+
+	for (unsigned int c = 0; c < 4; c++)
+	{
+		unsigned int n = counts[c];
+		// one 1-4 m object per 10 m cube on average, however many there are
+		float side = 10.0f * cbrtf((float)n);
+		vector<AABB> boxes(n);
+		for (unsigned int i = 0; i < n; i++)
+		{
+			glm::vec3 center = glm::vec3(unit(random), unit(random), unit(random)) * side;
+			glm::vec3 half = glm::vec3(0.5f + 1.5f * unit(random));
+			boxes[i] = AABB(center - half, center + half);
+		}
+
+		DynamicAabbTree tree;
+		vector<int> proxies(n);
+		double start = benchmarkClock();
+		for (unsigned int i = 0; i < n; i++)
+			proxies[i] = tree.createProxy(boxes[i], (int)i);
+		double buildTime = benchmarkClock() - start;
+
+		// cameras somewhere in the volume, level-ish view directions, 100 m far plane; a 40 m box around each
+		vector<Frustum> frusta(QUERIES);
+		vector<AABB> regions(QUERIES);
+		for (unsigned int q = 0; q < QUERIES; q++)
+		{
+			glm::vec3 eye = glm::vec3(unit(random), unit(random), unit(random)) * side;
+			float yaw = unit(random) * 6.2831853f;
+			glm::vec3 direction(cosf(yaw), unit(random) - 0.5f, sinf(yaw));
+			glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+			frusta[q] = extractFrustum(projection * glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f)));
+			regions[q] = AABB(eye - glm::vec3(20.0f), eye + glm::vec3(20.0f));
+		}
+
+		// the loop tests the boxes the tree stores, so both have to report the same objects
+		vector<AABB> fatBoxes(n);
+		for (unsigned int i = 0; i < n; i++)
+			fatBoxes[i] = tree.getFatAABB(proxies[i]);
+		vector<unsigned int> treeHits(QUERIES, 0), bruteHits(QUERIES, 0);
+		start = benchmarkClock();
+		for (unsigned int q = 0; q < QUERIES; q++)
+			tree.queryFrustum(frusta[q], [&](int) { treeHits[q]++; return true; });
+		double treeFrustumTime = benchmarkClock() - start;
+		start = benchmarkClock();
+		for (unsigned int q = 0; q < QUERIES; q++)
+			for (unsigned int i = 0; i < n; i++)
+				bruteHits[q] += frustumContainsAABB(frusta[q], fatBoxes[i]);
+		double bruteFrustumTime = benchmarkClock() - start;
+		for (unsigned int q = 0; q < QUERIES; q++)
+			mismatches += treeHits[q] != bruteHits[q];
+
+		std::fill(treeHits.begin(), treeHits.end(), 0);
+		std::fill(bruteHits.begin(), bruteHits.end(), 0);
+		start = benchmarkClock();
+		for (unsigned int q = 0; q < QUERIES; q++)
+			tree.queryBox(regions[q], [&](int) { treeHits[q]++; return true; });
+		double treeBoxTime = benchmarkClock() - start;
+		start = benchmarkClock();
+		for (unsigned int q = 0; q < QUERIES; q++)
+			for (unsigned int i = 0; i < n; i++)
+				bruteHits[q] += overlaps(regions[q], fatBoxes[i]);
+		double bruteBoxTime = benchmarkClock() - start;
+		for (unsigned int q = 0; q < QUERIES; q++)
+			mismatches += treeHits[q] != bruteHits[q];
+
+		// every tenth object drifts up to 0.25 m per axis and frame, like a fleet of trams
+		unsigned int moves = 0, reinserts = 0;
+		double refitTime = 0.0;
+		for (unsigned int frame = 0; frame < REFIT_FRAMES; frame++)
+		{
+			vector<glm::vec3> displacements;
+			for (unsigned int i = 0; i < n; i += 10)
+				displacements.push_back((glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * 0.5f);
+			start = benchmarkClock();
+			for (unsigned int i = 0, m = 0; i < n; i += 10, m++)
+			{
+				boxes[i].min += displacements[m];
+				boxes[i].max += displacements[m];
+				reinserts += tree.moveProxy(proxies[i], boxes[i], displacements[m]);
+			}
+			refitTime += benchmarkClock() - start;
+			moves += (unsigned int)displacements.size();
+		}
+		// still the same answers after the refits
+		for (unsigned int i = 0; i < n; i++)
+			fatBoxes[i] = tree.getFatAABB(proxies[i]);
+		unsigned int treeAfter = 0, bruteAfter = 0;
+		tree.queryFrustum(frusta[0], [&](int) { treeAfter++; return true; });
+		for (unsigned int i = 0; i < n; i++)
+			bruteAfter += frustumContainsAABB(frusta[0], fatBoxes[i]);
+		mismatches += treeAfter != bruteAfter;
+
+		std::cout << "BVH:: " << n << " objects, height " << tree.getHeight() << ", build " << buildTime * 1e3 << " ms" << std::endl;
+		std::cout << "BVH::   frustum query " << treeFrustumTime * 1e3 / QUERIES << " ms (brute force " << bruteFrustumTime * 1e3 / QUERIES
+			<< " ms), box query " << treeBoxTime * 1e3 / QUERIES << " ms (brute force " << bruteBoxTime * 1e3 / QUERIES << " ms)" << std::endl;
+		std::cout << "BVH::   refit " << refitTime * 1e3 / REFIT_FRAMES << " ms per frame for " << moves / REFIT_FRAMES << " moves, "
+			<< reinserts << " of " << moves << " reinserted" << std::endl;
+	}
+	if (mismatches)
+		std::cout << "ERROR::BVH:: " << mismatches << " queries differ from brute force" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Runs every batch kernel of MathKernels at each SIMD level the CPU has, on 1k and 100k elements, and reports
+// millions of elements per second. About 10M elements go through each kernel per size, so both sizes take
+// similar time and 1k stays in cache while 100k does not. Results are checked against the scalar path; non zero
+// if a wider path disagrees.
+// ---------------------------------------------------------------------------------------------------------
+int benchmarkMathKernels()
+{
+	const size_t sizes[] = { 1000, 100000 };
+	const size_t ELEMENTS_PER_KERNEL = 10000000;
+	const char *levelNames[] = { "scalar", "SSE4.1", "AVX", "AVX2" };
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	unsigned int mismatches = 0;
+
+	for (unsigned int s = 0; s < 2; s++)
+	{
+		size_t n = sizes[s];
+		size_t repeats = ELEMENTS_PER_KERNEL / n;
+		Mat4Array a(n), b(n), product(n), reference(n);
+		vector<AABB> boxes(n), transformed(n), referenceBoxes(n);
+		vector<glm::vec3> points(n);
+		vector<glm::vec4> pointsOut(n), spheres(n);
+		vector<unsigned char> visible(n), referenceVisible(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			glm::vec3 position(unit(random) * 50.0f, unit(random) * 5.0f, unit(random) * 50.0f);
+			a[i] = glm::rotate(glm::translate(glm::mat4(1), position), unit(random) * 3.14f, glm::vec3(0.0f, 1.0f, 0.0f));
+			b[i] = glm::scale(glm::translate(glm::mat4(1), glm::vec3(unit(random), unit(random), unit(random))), glm::vec3(1.0f + unit(random) * 0.5f));
+			glm::vec3 half(1.0f + unit(random) * 0.5f);
+			boxes[i] = AABB(-half, half);
+			points[i] = position;
+			spheres[i] = glm::vec4(position, 1.0f + unit(random) * 0.5f);
+		}
+		glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f)
+			* glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		Frustum frustum = extractFrustum(viewProjection);
+
+		MathKernels kernels;
+		for (int level = SIMD_SCALAR; level <= bestSimdLevel(); level++)
+		{
+			kernels.setSimdLevel((SimdLevel)level);
+			double times[4];
+			double start = benchmarkClock();
+			for (size_t r = 0; r < repeats; r++)
+				kernels.multiply(a.data(), b.data(), product.data(), n);
+			times[0] = benchmarkClock() - start;
+			start = benchmarkClock();
+			for (size_t r = 0; r < repeats; r++)
+				kernels.transformAABBs(product.data(), boxes.data(), transformed.data(), n);
+			times[1] = benchmarkClock() - start;
+			start = benchmarkClock();
+			for (size_t r = 0; r < repeats; r++)
+				kernels.transformPoints(viewProjection, points.data(), pointsOut.data(), n);
+			times[2] = benchmarkClock() - start;
+			start = benchmarkClock();
+			for (size_t r = 0; r < repeats; r++)
+				kernels.testSpheres(frustum, spheres.data(), visible.data(), n);
+			times[3] = benchmarkClock() - start;
+
+			if (level == SIMD_SCALAR)
+			{
+				reference = product;
+				referenceBoxes = transformed;
+				referenceVisible = visible;
+			}
+			// wider paths only reorder the same float operations (or fuse them), so allow some rounding
+			for (size_t i = 0; i < n; i++)
+			{
+				bool same = visible[i] == referenceVisible[i];
+				for (int c = 0; c < 4; c++)
+					same = same && glm::all(glm::lessThan(glm::abs(product[i][c] - reference[i][c]), glm::vec4(1e-3f)));
+				same = same && glm::all(glm::lessThan(glm::abs(transformed[i].min - referenceBoxes[i].min), glm::vec3(1e-3f)))
+					&& glm::all(glm::lessThan(glm::abs(transformed[i].max - referenceBoxes[i].max), glm::vec3(1e-3f)));
+				mismatches += !same;
+			}
+
+			double elements = (double)repeats * n / 1e6;
+			std::cout << "SIMD:: " << n << " elements, " << levelNames[level] << ": mat4 multiply " << elements / times[0]
+				<< ", AABB transform " << elements / times[1] << ", point transform " << elements / times[2]
+				<< ", sphere test " << elements / times[3] << " M/s" << std::endl;
+		}
+	}
+	if (mismatches)
+		std::cout << "ERROR::SIMD:: " << mismatches << " results differ from the scalar path" << std::endl;
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Scheduling overhead of the JobSystem. Empty jobs are started in batches of 1000 and joined, once on the main
+// thread alone (queueing cost only) and once with every core (adds stealing and wake-ups); the time per job is
+// the overhead a job has to amortize. parallelFor then runs a light loop body over 1M items at several grains
+// against the same loop run serially.
+// ---------------------------------------------------------------------------------------------------------
+int benchmarkJobSystem()
+{
+	const unsigned int BATCHES = 200, BATCH_SIZE = 1000;
+	const unsigned int ITEMS = 1 << 20, REPEATS = 50;
+	const unsigned int grains[] = { 64, 256, 1024, 4096, 16384, 65536 };
+
+	unsigned int threadCounts[2] = { 1, 0 };
+	for (unsigned int t = 0; t < 2; t++)
+	{
+		JobSystem jobs(threadCounts[t]);
+		double start = benchmarkClock();
+		for (unsigned int b = 0; b < BATCHES; b++)
+		{
+			JobCounter counter;
+			for (unsigned int j = 0; j < BATCH_SIZE; j++)
+				jobs.run(counter, []() {});
+			jobs.wait(counter);
+		}
+		double elapsed = benchmarkClock() - start;
+		std::cout << "JOBS:: " << jobs.threadCount() << " threads: " << elapsed * 1e9 / (BATCHES * BATCH_SIZE) << " ns per empty job" << std::endl;
+	}
+
+	JobSystem jobs;
+	vector<float> input(ITEMS), output(ITEMS);
+	for (unsigned int i = 0; i < ITEMS; i++)
+		input[i] = (float)i;
+	auto body = [&](unsigned int first, unsigned int last) {
+		for (unsigned int i = first; i < last; i++)
+			output[i] = sqrtf(input[i]) * 0.5f + 1.0f;
+	};
+	double start = benchmarkClock();
+	for (unsigned int r = 0; r < REPEATS; r++)
+		body(0, ITEMS);
+	double serial = (benchmarkClock() - start) / REPEATS;
+	std::cout << "JOBS:: parallelFor over " << ITEMS << " items, serial " << serial * 1e3 << " ms" << std::endl;
+	for (unsigned int g = 0; g < sizeof(grains) / sizeof(grains[0]); g++)
+	{
+		start = benchmarkClock();
+		for (unsigned int r = 0; r < REPEATS; r++)
+			jobs.parallelFor(0, ITEMS, grains[g], body);
+		double parallel = (benchmarkClock() - start) / REPEATS;
+		unsigned int chunks = (ITEMS + grains[g] - 1) / grains[g];
+		// thread time spent beyond the serial loop, spread over the jobs
+		std::cout << "JOBS::   grain " << grains[g] << " (" << chunks << " jobs): " << parallel * 1e3 << " ms, "
+			<< serial / parallel << "x serial, " << std::max(parallel * jobs.threadCount() - serial, 0.0) * 1e9 / chunks << " ns overhead per job" << std::endl;
+	}
+	// every item was written by exactly one chunk
+	for (unsigned int i = 0; i < ITEMS; i++)
+		if (output[i] != sqrtf(input[i]) * 0.5f + 1.0f)
+		{
+			std::cout << "ERROR::JOBS:: parallelFor missed item " << i << std::endl;
+			return 1;
+		}
 	return 0;
 }
 
@@ -1003,31 +1459,30 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
-unsigned int loadTexture(char const * path)
+Texture2D loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
+	Texture2D texture = Texture2D::create();
+	unsigned int textureID = texture.id();
 
 	int width, height, nrComponents;
 	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
 	if (data)
 	{
-		GLenum format;
+		// storage needs a sized format
+		GLenum format = GL_RGBA, internalFormat = GL_RGBA8;
 		if (nrComponents == 1)
-			format = GL_RED;
+			format = GL_RED, internalFormat = GL_R8;
 		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
+			format = GL_RGB, internalFormat = GL_RGB8;
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		textureStorage(textureID, GL_TEXTURE_2D, mipLevels(width, height), internalFormat, width, height);
+		textureSubImage(textureID, GL_TEXTURE_2D, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
+		generateTextureMipmap(textureID, GL_TEXTURE_2D);
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		textureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		textureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		textureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		textureParameter(textureID, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 		stbi_image_free(data);
 	}
@@ -1037,7 +1492,7 @@ unsigned int loadTexture(char const * path)
 		stbi_image_free(data);
 	}
 
-	return textureID;
+	return texture;
 }
 
 // loads a cubemap texture from 6 individual texture faces
@@ -1049,19 +1504,23 @@ unsigned int loadTexture(char const * path)
 // +Z (front) 
 // -Z (back)
 // -------------------------------------------------------
-unsigned int loadCubemap(vector<std::string> faces)
+TextureCube loadCubemap(vector<std::string> faces)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	TextureCube texture = TextureCube::create();
+	unsigned int textureID = texture.id();
 
+	// all faces share one size, allocated with the first face that loads
+	bool allocated = false;
 	int width, height, nrComponents;
 	for (unsigned int i = 0; i < faces.size(); i++)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
+		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 3);
 		if (data)
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+			if (!allocated)
+				textureStorage(textureID, GL_TEXTURE_CUBE_MAP, 1, GL_RGB8, width, height);
+			allocated = true;
+			textureSubImage(textureID, GL_TEXTURE_CUBE_MAP, 0, i, width, height, GL_RGB, GL_UNSIGNED_BYTE, data);
 			stbi_image_free(data);
 		}
 		else
@@ -1070,12 +1529,12 @@ unsigned int loadCubemap(vector<std::string> faces)
 			stbi_image_free(data);
 		}
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	textureParameter(textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	textureParameter(textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	textureParameter(textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	textureParameter(textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	textureParameter(textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	return textureID;
+	return texture;
 }
 
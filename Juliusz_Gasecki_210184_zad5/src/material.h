@@ -0,0 +1,231 @@
+#pragma once
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include "gl_handles.h"
+#include "gl_resources.h"
+#include "gpu_block.h"
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+enum MaterialMap {
+	MAP_DIFFUSE,
+	MAP_SPECULAR,
+	MAP_NORMAL,
+	MAP_HEIGHT,
+	MATERIAL_MAP_COUNT
+};
+
+// a material as the model file describes it, two equal descriptions end up as one material
+struct MaterialDesc {
+	glm::vec4 diffuse;		// rgb + opacity
+	glm::vec4 specular;		// rgb + shininess
+	string maps[MATERIAL_MAP_COUNT];	// image paths, empty when the material has no such map
+
+	MaterialDesc() : diffuse(1.0f), specular(0.0f, 0.0f, 0.0f, 32.0f) {}
+
+	bool operator==(const MaterialDesc &other) const
+	{
+		for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+			if (maps[i] != other.maps[i])
+				return false;
+		return diffuse == other.diffuse && specular == other.specular;
+	}
+};
+
+// Materials block in cubemap1.fs/cubemap2.fs, std140 (64 bytes). A map is (texture array, layer), -1 = none.
+struct GpuMaterial {
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+	glm::ivec4 diffuseSpecularMaps;
+	glm::ivec4 normalHeightMaps;
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.add(prefix + "diffuse", base + offsetof(GpuMaterial, diffuse));
+		members.add(prefix + "specular", base + offsetof(GpuMaterial, specular));
+		members.add(prefix + "diffuseSpecularMaps", base + offsetof(GpuMaterial, diffuseSpecularMaps));
+		members.add(prefix + "normalHeightMaps", base + offsetof(GpuMaterial, normalHeightMaps));
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuMaterial, specular, diffuse);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuMaterial, diffuseSpecularMaps, specular);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuMaterial, normalHeightMaps, diffuseSpecularMaps);
+GPU_BLOCK_STRUCT_SIZE(GpuMaterial);
+
+// Every material of every model, resolved once at load time. Images of the same size are layers of one
+// GL_TEXTURE_2D_ARRAY, the material table lives in one uniform buffer, so drawing only passes a material
+// index: bind() once per frame replaces the per-mesh texture setup, and meshes with different materials can
+// share a multi-draw. Material 0 is the default (white, no maps).
+class MaterialLibrary
+{
+public:
+	static const unsigned int MAX_MATERIALS = 256;	// MAX_MATERIALS in the shaders
+	static const unsigned int MAX_TEXTURE_ARRAYS = 4;	// one per distinct image size
+	static const GLuint UNIFORM_BINDING = 0;
+	static const GLuint TEXTURE_UNIT = 1;	// arrays use units TEXTURE_UNIT.., unit 0 stays the skybox's
+
+	MaterialLibrary()
+	{
+		add(MaterialDesc());
+	}
+
+	// index of the material, shared with every earlier equal one
+	unsigned int add(const MaterialDesc &desc)
+	{
+		for (unsigned int i = 0; i < descs.size(); i++)
+			if (descs[i] == desc)
+				return i;
+		if (descs.size() == MAX_MATERIALS)
+		{
+			cout << "ERROR::MATERIAL:: more than " << MAX_MATERIALS << " materials, using the default one" << endl;
+			return 0;
+		}
+		descs.push_back(desc);
+		return (unsigned int)descs.size() - 1;
+	}
+
+	// loads the images of all materials added so far into texture arrays and uploads the material table
+	void upload()
+	{
+		map<string, glm::ivec2> placed;
+		vector<glm::ivec2> sizes;
+		vector<vector<string> > layers;
+		for (unsigned int m = 0; m < descs.size(); m++)
+			for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+			{
+				const string &path = descs[m].maps[i];
+				if (path.empty() || placed.count(path))
+					continue;
+				placed[path] = place(path, sizes, layers);
+			}
+
+		arrays.clear();
+		for (unsigned int a = 0; a < sizes.size(); a++)
+			arrays.push_back(loadArray(sizes[a], layers[a]));
+
+		gpuMaterials.resize(descs.size());
+		for (unsigned int m = 0; m < descs.size(); m++)
+		{
+			glm::ivec2 maps[MATERIAL_MAP_COUNT];
+			for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+				maps[i] = descs[m].maps[i].empty() ? glm::ivec2(-1) : placed[descs[m].maps[i]];
+			gpuMaterials[m].diffuse = descs[m].diffuse;
+			gpuMaterials[m].specular = descs[m].specular;
+			gpuMaterials[m].diffuseSpecularMaps = glm::ivec4(maps[MAP_DIFFUSE], maps[MAP_SPECULAR]);
+			gpuMaterials[m].normalHeightMaps = glm::ivec4(maps[MAP_NORMAL], maps[MAP_HEIGHT]);
+		}
+
+		// the block declares MAX_MATERIALS entries, the buffer covers all of them
+		uniforms = GpuBuffer::create();
+		vector<GpuMaterial> table(gpuMaterials);
+		table.resize(MAX_MATERIALS);
+		bufferStorage(uniforms.id(), table.size() * sizeof(GpuMaterial), table.data(), false);
+	}
+
+	// once per program: points its Materials block and materialTextures samplers at the library's bindings
+	void attach(GLuint program) const
+	{
+		GLuint block = glGetUniformBlockIndex(program, "Materials");
+		if (block != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(program, block, UNIFORM_BINDING);
+			GpuBlockMembers members;
+			members.addStructArray<GpuMaterial>("materials", 0, MAX_MATERIALS);
+			verifyUniformBlock(program, "Materials", members, MAX_MATERIALS * sizeof(GpuMaterial));
+		}
+		glUseProgram(program);
+		for (unsigned int i = 0; i < MAX_TEXTURE_ARRAYS; i++)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "materialTextures[%u]", i);
+			GLint location = glGetUniformLocation(program, name);
+			if (location >= 0)
+				glUniform1i(location, TEXTURE_UNIT + i);
+		}
+	}
+
+	// once per frame, before the first draw that uses materials
+	void bind() const
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING, uniforms.id());
+		for (unsigned int i = 0; i < arrays.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT + i);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i].id());
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	unsigned int count() const { return (unsigned int)descs.size(); }
+	unsigned int arrayCount() const { return (unsigned int)arrays.size(); }
+	// valid after upload()
+	const GpuMaterial &get(unsigned int material) const { return gpuMaterials[material]; }
+
+private:
+	vector<MaterialDesc> descs;
+	vector<GpuMaterial> gpuMaterials;
+	vector<TextureArray> arrays;
+	GpuBuffer uniforms;
+
+	// array and layer the image goes to, (-1, -1) when it cannot be read or there is no array left for its size
+	static glm::ivec2 place(const string &path, vector<glm::ivec2> &sizes, vector<vector<string> > &layers)
+	{
+		int width, height, components;
+		if (!stbi_info(path.c_str(), &width, &height, &components))
+		{
+			cout << "ERROR::MATERIAL:: " << path << ": " << stbi_failure_reason() << endl;
+			return glm::ivec2(-1);
+		}
+		glm::ivec2 size(width, height);
+		unsigned int a = 0;
+		while (a < sizes.size() && sizes[a] != size)
+			a++;
+		if (a == sizes.size())
+		{
+			if (sizes.size() == MAX_TEXTURE_ARRAYS)
+			{
+				cout << "ERROR::MATERIAL:: " << path << ": more than " << MAX_TEXTURE_ARRAYS << " texture sizes" << endl;
+				return glm::ivec2(-1);
+			}
+			sizes.push_back(size);
+			layers.push_back(vector<string>());
+		}
+		layers[a].push_back(path);
+		return glm::ivec2((int)a, (int)layers[a].size() - 1);
+	}
+
+	// every image as RGBA8, mipmapped
+	static TextureArray loadArray(const glm::ivec2 &size, const vector<string> &paths)
+	{
+		TextureArray array = TextureArray::create();
+		textureStorage(array.id(), GL_TEXTURE_2D_ARRAY, mipLevels(size.x, size.y), GL_RGBA8, size.x, size.y, (GLsizei)paths.size());
+		for (unsigned int layer = 0; layer < paths.size(); layer++)
+		{
+			int width, height, components;
+			unsigned char *data = stbi_load(paths[layer].c_str(), &width, &height, &components, 4);
+			if (data && width == size.x && height == size.y)
+				textureSubImage(array.id(), GL_TEXTURE_2D_ARRAY, 0, layer, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			else
+				cout << "ERROR::MATERIAL:: " << paths[layer] << " failed to load" << endl;
+			stbi_image_free(data);
+		}
+		generateTextureMipmap(array.id(), GL_TEXTURE_2D_ARRAY);
+		textureParameter(array.id(), GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		textureParameter(array.id(), GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		textureParameter(array.id(), GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		textureParameter(array.id(), GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		return array;
+	}
+};
+#endif
@@ -7,6 +7,10 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "bounds.h"
+#include "gl_handles.h"
+#include "vertex_layout.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -27,10 +31,61 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
-struct Texture {
-	unsigned int id;
-	string type;
-	string path;
+// vertex shader input locations of the Vertex members, the same in every model shader
+enum VertexAttribute {
+	ATTRIBUTE_POSITION,
+	ATTRIBUTE_NORMAL,
+	ATTRIBUTE_TEXCOORDS,
+	ATTRIBUTE_TANGENT,
+	ATTRIBUTE_BITANGENT,
+	VERTEX_ATTRIBUTE_COUNT
+};
+
+// Vertex as the shaders see it, in the order of the VertexAttribute locations
+typedef AttributeLayout<
+	Attribute<ATTRIBUTE_POSITION, SEMANTIC_POSITION, GLfloat, 3>,
+	Attribute<ATTRIBUTE_NORMAL, SEMANTIC_NORMAL, GLfloat, 3>,
+	Attribute<ATTRIBUTE_TEXCOORDS, SEMANTIC_TEXCOORDS, GLfloat, 2>,
+	Attribute<ATTRIBUTE_TANGENT, SEMANTIC_TANGENT, GLfloat, 3>,
+	Attribute<ATTRIBUTE_BITANGENT, SEMANTIC_BITANGENT, GLfloat, 3>
+> ModelVertexLayout;
+static_assert(ModelVertexLayout::stride == sizeof(Vertex), "ModelVertexLayout and Vertex differ in size");
+static_assert(ModelVertexLayout::offset(ATTRIBUTE_NORMAL) == offsetof(Vertex, Normal)
+	&& ModelVertexLayout::offset(ATTRIBUTE_TEXCOORDS) == offsetof(Vertex, TexCoords)
+	&& ModelVertexLayout::offset(ATTRIBUTE_TANGENT) == offsetof(Vertex, Tangent)
+	&& ModelVertexLayout::offset(ATTRIBUTE_BITANGENT) == offsetof(Vertex, Bitangent), "ModelVertexLayout and Vertex differ in offsets");
+
+// set of VertexAttribute locations, bit n = location n
+typedef unsigned int VertexAttributeMask;
+const VertexAttributeMask ALL_VERTEX_ATTRIBUTES = (1u << VERTEX_ATTRIBUTE_COUNT) - 1;
+const VertexAttributeMask TANGENT_SPACE_ATTRIBUTES = (1u << ATTRIBUTE_TANGENT) | (1u << ATTRIBUTE_BITANGENT);
+
+// the Vertex locations a linked program really reads; inputs the compiler dropped as unused are not active
+inline VertexAttributeMask activeVertexAttributes(GLuint program)
+{
+	VertexAttributeMask mask = 0;
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveAttrib(program, (GLuint)i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+		// built-ins such as gl_VertexID have no location
+		GLint location = glGetAttribLocation(program, name.data());
+		if (location >= 0 && location < VERTEX_ATTRIBUTE_COUNT)
+			mask |= 1u << location;
+	}
+	return mask;
+}
+
+// location of a mesh inside shared geometry buffers (GeometryArena), drawn with glDrawElementsBaseVertex
+struct MeshRange {
+	GLuint count;
+	GLuint firstIndex;
+	GLint  baseVertex;
 };
 
 class Mesh {
@@ -38,101 +93,64 @@ public:
 	/*  Mesh Data  */
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
-	vector<Texture> textures;
-	unsigned int VAO;
+	unsigned int material;	// index in the MaterialLibrary, 0 = default
+	unsigned int allocation;	// GeometryArena allocation, ~0u when the mesh has its own buffers
+	VertexArray VAO;
+	// object space bounds, filled by Model::processMesh
+	AABB bounds;
+	BoundingSphere sphere;
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// constructor, pass the vectors with std::move to hand their storage over instead of copying it; without
+	// own buffers the caller puts the data into a GeometryArena and sets allocation
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, unsigned int material = 0, bool ownBuffers = true)
+		: vertices(std::move(vertices)), indices(std::move(indices)), material(material), allocation(~0u)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		if (ownBuffers)
+			setupMesh();
 	}
 
-	// render the mesh
-	void Draw(GLuint shaderID)
+	// owns its GL objects: movable, not copyable
+	Mesh(Mesh &&) = default;
+	Mesh &operator=(Mesh &&) = default;
+	Mesh(const Mesh &) = delete;
+	Mesh &operator=(const Mesh &) = delete;
+
+	// render the mesh from its own buffers; textures come from the bound MaterialLibrary, the shader only needs
+	// the material index (materialLoc, -1 when the shader has none)
+	void Draw(GLint materialLoc)
 	{
-		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-											  // retrieve texture number (the N in diffuse_textureN)
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
-			else if (name == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-													 // now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shaderID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
-		}
-
-		// draw mesh
-		glBindVertexArray(VAO);
+		if (materialLoc >= 0)
+			glUniform1i(materialLoc, (GLint)material);
+		glBindVertexArray(VAO.id());
 		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
 	}
 
 private:
 	/*  Render data  */
-	unsigned int VBO, EBO;
+	GpuBuffer VBO, EBO;
 
 	/*  Functions    */
 	// initializes all the buffer objects/arrays
 	void setupMesh()
 	{
 		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		VAO = VertexArray::create();
+		VBO = GpuBuffer::create();
+		EBO = GpuBuffer::create();
 
-		glBindVertexArray(VAO);
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
 		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		bufferStorage(VBO.id(), vertices.size() * sizeof(Vertex), vertices.data(), false);
+		bufferStorage(EBO.id(), indices.size() * sizeof(unsigned int), indices.data(), false);
 
-		glBindVertexArray(0);
+		// set the vertex attribute pointers: positions, normals, texture coords, tangents, bitangents
+		vertexArrayElements(VAO.id(), EBO.id());
+		ModelVertexLayout::attach(VAO.id(), VBO.id());
 	}
 };
 #endif
\ No newline at end of file
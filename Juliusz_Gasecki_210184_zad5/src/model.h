@@ -12,6 +12,8 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "material.h"
+#include "geometry_arena.h"
 
 #include <string>
 #include <fstream>
@@ -21,39 +23,101 @@
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
-
 class Model
 {
 public:
 	/*  Model Data */
-	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	vector<Mesh> meshes;
 	string directory;
 	bool gammaCorrection;
+	// union of the mesh bounds in object space
+	AABB bounds;
 
 	/*  Functions   */
-	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// constructor, expects a filepath to a 3D model. Its materials go to the library (shared with the other models
+	// loaded into it, MaterialLibrary::upload() once all are loaded), without one every mesh gets material 0.
+	// With a geometry arena the meshes are allocated in it instead of getting buffers of their own, and only the
+	// attributes it keeps are worth computing: tangents are generated only when it keeps them and some material
+	// of the file has a normal map, otherwise they are left zero.
+	Model(string const &path, MaterialLibrary *materials = NULL, GeometryArena *geometry = NULL, bool gamma = false)
+		: gammaCorrection(gamma), materials(materials), geometry(geometry)
 	{
 		loadModel(path);
 	}
 
-	// draws the model, and thus all its meshes
+	// hands the meshes' arena ranges back, their own buffers are deleted with them
+	~Model()
+	{
+		releaseGeometry();
+	}
+
+	// owns the meshes' buffers or arena ranges: movable, not copyable
+	Model(Model &&) = default;
+	Model &operator=(Model &&other)
+	{
+		if (this != &other)
+		{
+			releaseGeometry();
+			meshes = std::move(other.meshes);
+			other.meshes.clear();
+			directory = std::move(other.directory);
+			gammaCorrection = other.gammaCorrection;
+			bounds = other.bounds;
+			materials = other.materials;
+			geometry = other.geometry;
+		}
+		return *this;
+	}
+	Model(const Model &) = delete;
+	Model &operator=(const Model &) = delete;
+
+	// draws the model, and thus all its meshes; the material library has to be bound
 	void Draw(GLuint shaderID)
 	{
+		GLint materialLoc = glGetUniformLocation(shaderID, "materialIndex");
+		// arena meshes share one VAO, each is a base-vertex range of it
+		if (geometry)
+			glBindVertexArray(geometry->VAO.id());
 		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderID);
+		{
+			// consecutive meshes of one material leave the uniform alone
+			bool sameMaterial = i > 0 && meshes[i].material == meshes[i - 1].material;
+			if (!geometry)
+			{
+				meshes[i].Draw(sameMaterial ? -1 : materialLoc);
+				continue;
+			}
+			if (!sameMaterial && materialLoc >= 0)
+				glUniform1i(materialLoc, (GLint)meshes[i].material);
+			MeshRange range = geometry->range(meshes[i].allocation);
+			glDrawElementsBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(range.firstIndex * sizeof(unsigned int)), range.baseVertex);
+		}
+		if (geometry)
+			glBindVertexArray(0);
 	}
 
 private:
+	MaterialLibrary *materials;
+	GeometryArena *geometry;
+
+	void releaseGeometry()
+	{
+		if (geometry)
+			for (unsigned int i = 0; i < meshes.size(); i++)
+				geometry->release(meshes[i].allocation);
+	}
+
 	/*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(string const &path)
 	{
 		// read file via ASSIMP
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		// tangent space is one of the slower steps, and without a normal map to use it with nobody reads it
+		VertexAttributeMask attributes = geometry ? geometry->attributes() : ALL_VERTEX_ATTRIBUTES;
+		if (scene && (attributes & TANGENT_SPACE_ATTRIBUTES) && hasNormalMaps(scene))
+			scene = importer.ApplyPostProcessing(aiProcess_CalcTangentSpace);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
@@ -62,11 +126,22 @@ private:
 		}
 		// retrieve the directory path of the filepath
 		directory = path.substr(0, path.find_last_of('/'));
+		// a mesh referenced by several nodes is the only case this undercounts
+		meshes.reserve(scene->mNumMeshes);
 
 		// process ASSIMP's root node recursively
 		processNode(scene->mRootNode, scene);
 	}
 
+	// whether any material has the map readMaterial() takes as MAP_NORMAL
+	static bool hasNormalMaps(const aiScene *scene)
+	{
+		for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+			if (scene->mMaterials[i]->GetTextureCount(aiTextureType_HEIGHT) > 0)
+				return true;
+		return false;
+	}
+
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
 	void processNode(aiNode *node, const aiScene *scene)
 	{
@@ -76,7 +151,8 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			meshes.push_back(processMesh(mesh, scene));	// moved in, no copy of the vertex data
+			bounds.expand(meshes.back().bounds);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
@@ -91,7 +167,9 @@ private:
 		// data to fill
 		vector<Vertex> vertices;
 		vector<unsigned int> indices;
-		vector<Texture> textures;
+		AABB bounds;
+		vertices.reserve(mesh->mNumVertices);
+		indices.reserve(mesh->mNumFaces * 3);	// triangulated
 
 		// Walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -103,6 +181,7 @@ private:
 			vector.y = mesh->mVertices[i].y;
 			vector.z = mesh->mVertices[i].z;
 			vertex.Position = vector;
+			bounds.expand(vector);
 			// normals
 			vector.x = mesh->mNormals[i].x;
 			vector.y = mesh->mNormals[i].y;
@@ -120,16 +199,25 @@ private:
 			}
 			else
 				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-			// tangent
-			vector.x = mesh->mTangents[i].x;
-			vector.y = mesh->mTangents[i].y;
-			vector.z = mesh->mTangents[i].z;
-			vertex.Tangent = vector;
-			// bitangent
-			vector.x = mesh->mBitangents[i].x;
-			vector.y = mesh->mBitangents[i].y;
-			vector.z = mesh->mBitangents[i].z;
-			vertex.Bitangent = vector;
+			// tangent space, only there when it was generated (and the mesh has normals and texture coordinates)
+			if (mesh->mTangents && mesh->mBitangents)
+			{
+				// tangent
+				vector.x = mesh->mTangents[i].x;
+				vector.y = mesh->mTangents[i].y;
+				vector.z = mesh->mTangents[i].z;
+				vertex.Tangent = vector;
+				// bitangent
+				vector.x = mesh->mBitangents[i].x;
+				vector.y = mesh->mBitangents[i].y;
+				vector.z = mesh->mBitangents[i].z;
+				vertex.Bitangent = vector;
+			}
+			else
+			{
+				vertex.Tangent = glm::vec3(0.0f);
+				vertex.Bitangent = glm::vec3(0.0f);
+			}
 			vertices.push_back(vertex);
 		}
 		// now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
@@ -141,214 +229,49 @@ private:
 				indices.push_back(face.mIndices[j]);
 		}
 		// process materials
-		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-		// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
-		// Same applies to other texture as the following list summarizes:
-		// diffuse: texture_diffuseN
-		// specular: texture_specularN
-		// normal: texture_normalN
+		unsigned int material = materials ? materials->add(readMaterial(scene->mMaterials[mesh->mMaterialIndex])) : 0;
 
-		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
-	}
-
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
-	{
-		vector<Texture> textures;
-		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+		// bounding sphere around the box center, needs a second pass once the box is known
+		glm::vec3 center = bounds.center();
+		float radius2 = 0.0f;
+		for (unsigned int i = 0; i < vertices.size(); i++)
 		{
-			aiString str;
-			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			glm::vec3 d = vertices[i].Position - center;
+			radius2 = glm::max(radius2, glm::dot(d, d));
 		}
-		return textures;
-	}
-};
 
-
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-	string filename = string(path);
-	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (!data) {
-		cout << "ERROR: " << stbi_failure_reason() << endl;
-		//throw stbi_failure_reason();
+		// return a mesh object created from the extracted mesh data
+		Mesh result(std::move(vertices), std::move(indices), material, geometry == NULL);
+		if (geometry)
+			result.allocation = geometry->allocate(result.vertices, result.indices);
+		result.bounds = bounds;
+		result.sphere = BoundingSphere(center, sqrtf(radius2));
+		return result;
 	}
-		
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-		stbi_image_free(data);
-	}
-	else
+	// colours and the first map of every kind, paths relative to the model file
+	MaterialDesc readMaterial(aiMaterial *material)
 	{
-		std::cout << "Texture failed to load at path: " << filename << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
-}
-
-class DrawObject {
-
-	public :
-		virtual void draw() = 0;
-};
-
-class DrawModel : public DrawObject {
-	public:
-		Model *model;
-		GLuint shaderProgram;
-
-		DrawModel(Model *model, GLuint shaderProgram) {
-			this->model = model;
-			this->shaderProgram = shaderProgram;
+		MaterialDesc desc;
+		aiColor3D color;
+		float value;
+		if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+			desc.diffuse = glm::vec4(color.r, color.g, color.b, desc.diffuse.a);
+		if (material->Get(AI_MATKEY_OPACITY, value) == AI_SUCCESS)
+			desc.diffuse.a = value;
+		if (material->Get(AI_MATKEY_COLOR_SPECULAR, color) == AI_SUCCESS)
+			desc.specular = glm::vec4(color.r, color.g, color.b, desc.specular.a);
+		if (material->Get(AI_MATKEY_SHININESS, value) == AI_SUCCESS)
+			desc.specular.a = value;
+		// the same assimp texture types the old texture_diffuseN .. texture_heightN samplers were read from
+		const aiTextureType types[MATERIAL_MAP_COUNT] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+		for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+		{
+			aiString path;
+			if (material->GetTextureCount(types[i]) > 0 && material->GetTexture(types[i], 0, &path) == AI_SUCCESS)
+				desc.maps[i] = directory + '/' + path.C_Str();
 		}
-	void draw(){
-		this->model->Draw(shaderProgram);
-	}
-};
-
-class DrawCam : public DrawObject {
-public:
-	Model * model;
-	GLuint shaderProgram;
-
-	DrawCam(Model * model, GLuint shaderProgram) {
-		this->model = model;
-		this->shaderProgram = shaderProgram;
-	}
-	void draw() {}
-};
-
-class DrawGeneratedObject : public DrawObject {
-public:
-	GLuint VAO;
-	GLuint VBO;
-	GLuint shaderProgram;
-	float *points;
-	DrawGeneratedObject(GLuint VAO, GLuint VBO, GLuint shaderProgram, float *points) {
-		this->VAO = VAO;
-		this->VBO = VBO;
-		this->shaderProgram = shaderProgram;
-		this->points = points;
-	}
-	void draw() {
-		
+		return desc;
 	}
 };
-
-
-class GraphNode
-{
-	private:
-		vector<GraphNode*> children;
-		glm::mat4 parentTransform;
-		glm::mat4 localTransform;
-		DrawObject *model;
-		GLuint modelUniformLoc;
-		GLuint shaderProgram;
-
-	public:
-		GraphNode(glm::mat4 localTransform, DrawObject *model, GLuint modelUniformLoc, GLuint shaderProgram) {
-			this->model = model;
-			this->localTransform = localTransform;
-			this->parentTransform = glm::mat4(1);
-			this->modelUniformLoc = modelUniformLoc;
-			this->shaderProgram = shaderProgram;
-		}
-		void addChildren(GraphNode *children) {
-			children->parentTransform = this->parentTransform * this->localTransform;
-			this->children.push_back(children);	
-		}
-		void draw() {
-			glUseProgram(this->shaderProgram);
-			glUniformMatrix4fv(modelUniformLoc, 1, GL_FALSE, glm::value_ptr(parentTransform * localTransform));
-			this->model->draw();
-			for each (GraphNode *child in this->children)
-			{
-				child->parentTransform = this->parentTransform * this->localTransform;
-				child->draw();
-			}
-		}
-		glm::mat4 getLocalTransform() {
-			for (int i = 0; i < 4; i++) {
-				for (int j = 0; j < 4; j++) {
-					std::cout << parentTransform[i][j] << " ";
-				}
-				cout << endl;
-			}
-			
-			return localTransform;
-		}
-		glm::mat4 getTransform() {
-			return this->parentTransform * this->localTransform;
-		}
-		void setLocalTransform(glm::mat4 localTransform) {
-			this->localTransform = localTransform;
-			for each (GraphNode *child in this->children)
-			{
-				child->parentTransform = this->parentTransform * this->localTransform;
-			}
-		}
-
-
-};
 #endif
\ No newline at end of file
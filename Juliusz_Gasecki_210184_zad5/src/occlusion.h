@@ -0,0 +1,385 @@
+#pragma once
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "cpu_features.h"
+#include "simd_math.h"
+#include "job_system.h"
+
+#include <vector>
+using namespace std;
+
+struct OcclusionStats {
+	unsigned int occluderTriangles;
+	unsigned int tested;
+	unsigned int occluded;
+};
+
+// Software occlusion culling on the CPU.
+// Occluders are transformed, near-clipped and rasterized into a small depth buffer that keeps the nearest occluder
+// depth per pixel. The screen is split into horizontal bands rasterized as jobs, so no two threads ever write the
+// same row. A min/max depth pyramid is then built over the buffer and occludee boxes are tested against
+// it coarse to fine: a texel whose max depth is nearer than the box rejects it, a texel whose min depth is farther
+// accepts it, only the texels in between are refined. Nothing here touches OpenGL.
+class OcclusionCuller
+{
+public:
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+
+	OcclusionStats stats;
+
+	explicit OcclusionCuller(JobSystem &jobs) : level(bestSimdLevel()), jobs(jobs)
+	{
+		// two bands per thread so a thread stuck with a dense band is balanced out by stealing
+		bandCount = glm::clamp(jobs.threadCount() * 2, 1u, (unsigned int)HEIGHT / 8);
+		depth.resize(WIDTH * HEIGHT);
+
+		// pyramid level 0 is the depth buffer itself, every further level halves both sides down to one row
+		int w = WIDTH, h = HEIGHT;
+		while (h >= 1)
+		{
+			PyramidLevel l;
+			l.width = w;
+			l.height = h;
+			l.minDepth.resize(w * h);
+			l.maxDepth.resize(w * h);
+			pyramid.push_back(l);
+			if (h == 1)
+				break;
+			w /= 2;
+			h /= 2;
+		}
+		resetStats();
+	}
+
+	void beginFrame(const glm::mat4 &viewProjection)
+	{
+		this->viewProjection = viewProjection;
+		triangles.clear();
+		resetStats();
+	}
+
+	// positions/indices describe a triangle list in object space
+	void addOccluder(const glm::vec3 *positions, const unsigned int *indices, size_t indexCount, const glm::mat4 &model)
+	{
+		glm::mat4 mvp = viewProjection * model;
+		// every referenced vertex goes to clip space once in a batch, triangles then only gather
+		unsigned int vertexCount = 0;
+		for (size_t i = 0; i < indexCount; i++)
+			vertexCount = glm::max(vertexCount, indices[i] + 1);
+		clipVertices.resize(vertexCount);
+		mathKernels().transformPoints(mvp, positions, clipVertices.data(), vertexCount);
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			glm::vec4 clip[3];
+			for (int k = 0; k < 3; k++)
+				clip[k] = clipVertices[indices[i + k]];
+			addClipTriangle(clip);
+		}
+	}
+
+	// a solid box, used for the buildings and the simplified tram hull
+	void addOccluderBox(const AABB &box, const glm::mat4 &model = glm::mat4(1.0f))
+	{
+		static const unsigned int boxIndices[36] = {
+			0, 1, 2, 2, 3, 0,	4, 6, 5, 6, 4, 7,
+			0, 4, 5, 5, 1, 0,	3, 2, 6, 6, 7, 3,
+			0, 3, 7, 7, 4, 0,	1, 5, 6, 6, 2, 1
+		};
+		glm::vec3 corners[8] = {
+			glm::vec3(box.min.x, box.min.y, box.min.z), glm::vec3(box.max.x, box.min.y, box.min.z),
+			glm::vec3(box.max.x, box.max.y, box.min.z), glm::vec3(box.min.x, box.max.y, box.min.z),
+			glm::vec3(box.min.x, box.min.y, box.max.z), glm::vec3(box.max.x, box.min.y, box.max.z),
+			glm::vec3(box.max.x, box.max.y, box.max.z), glm::vec3(box.min.x, box.max.y, box.max.z)
+		};
+		addOccluder(corners, boxIndices, 36, model);
+	}
+
+	// rasterizes every occluder added this frame and rebuilds the depth pyramid
+	void rasterize()
+	{
+		stats.occluderTriangles = (unsigned int)triangles.size();
+		jobs.parallelFor(0, bandCount, 1, [this](unsigned int first, unsigned int last) {
+			for (unsigned int band = first; band < last; band++)
+				rasterizeBand(band);
+		});
+		buildPyramid();
+	}
+
+	// conservative: anything touching the near plane or off screen counts as visible
+	bool isVisible(const AABB &box)
+	{
+		stats.tested++;
+		if (box.empty())
+			return true;
+
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+			glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+			if (clip.w <= 1e-4f || clip.z < -clip.w)
+				return true;
+			glm::vec3 screen = toScreen(clip);
+			minX = glm::min(minX, screen.x); maxX = glm::max(maxX, screen.x);
+			minY = glm::min(minY, screen.y); maxY = glm::max(maxY, screen.y);
+			minZ = glm::min(minZ, screen.z);
+		}
+
+		int x0 = glm::max((int)floorf(minX), 0);
+		int y0 = glm::max((int)floorf(minY), 0);
+		int x1 = glm::min((int)ceilf(maxX), WIDTH) - 1;
+		int y1 = glm::min((int)ceilf(maxY), HEIGHT) - 1;
+		if (x0 > x1 || y0 > y1)
+			return true;
+
+		// start at the level where the rectangle spans at most a couple of texels
+		int start = 0;
+		while (start + 1 < (int)pyramid.size() && ((x1 >> start) - (x0 >> start) > 1 || (y1 >> start) - (y0 >> start) > 1))
+			start++;
+
+		for (int ty = y0 >> start; ty <= (y1 >> start); ty++)
+			for (int tx = x0 >> start; tx <= (x1 >> start); tx++)
+				if (regionVisible(start, tx, ty, x0, y0, x1, y1, minZ))
+					return true;
+		stats.occluded++;
+		return false;
+	}
+
+	const vector<float> &depthBuffer() const { return depth; }
+	SimdLevel simdLevel() const { return level; }
+	void setSimdLevel(SimdLevel simd) { level = simd < bestSimdLevel() ? simd : bestSimdLevel(); }
+
+private:
+	struct ScreenTriangle {
+		float x[3], y[3], z[3];
+		int minY, maxY;
+	};
+
+	struct PyramidLevel {
+		int width, height;
+		vector<float> minDepth;
+		vector<float> maxDepth;
+	};
+
+	SimdLevel level;
+	glm::mat4 viewProjection;
+	vector<ScreenTriangle> triangles;
+	vector<glm::vec4> clipVertices;
+	vector<float> depth;
+	vector<PyramidLevel> pyramid;
+
+	JobSystem &jobs;
+	unsigned int bandCount;
+
+	void resetStats()
+	{
+		stats.occluderTriangles = stats.tested = stats.occluded = 0;
+	}
+
+	static glm::vec3 toScreen(const glm::vec4 &clip)
+	{
+		float invW = 1.0f / clip.w;
+		return glm::vec3((clip.x * invW * 0.5f + 0.5f) * WIDTH, (clip.y * invW * 0.5f + 0.5f) * HEIGHT, clip.z * invW * 0.5f + 0.5f);
+	}
+
+	// clips against the near plane (z >= -w) and fans the result into screen triangles
+	void addClipTriangle(const glm::vec4 clip[3])
+	{
+		glm::vec4 polygon[4];
+		int count = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec4 &a = clip[i];
+			const glm::vec4 &b = clip[(i + 1) % 3];
+			float da = a.z + a.w;
+			float db = b.z + b.w;
+			if (da >= 0.0f)
+				polygon[count++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				polygon[count++] = a + (b - a) * (da / (da - db));
+		}
+		for (int i = 1; i + 1 < count; i++)
+		{
+			glm::vec3 v[3] = { toScreen(polygon[0]), toScreen(polygon[i]), toScreen(polygon[i + 1]) };
+			ScreenTriangle t;
+			float minY = FLT_MAX, maxY = -FLT_MAX, minX = FLT_MAX, maxX = -FLT_MAX;
+			for (int k = 0; k < 3; k++)
+			{
+				t.x[k] = v[k].x;
+				t.y[k] = v[k].y;
+				t.z[k] = glm::clamp(v[k].z, 0.0f, 1.0f);
+				minX = glm::min(minX, v[k].x); maxX = glm::max(maxX, v[k].x);
+				minY = glm::min(minY, v[k].y); maxY = glm::max(maxY, v[k].y);
+			}
+			if (maxX < 0.0f || minX >= WIDTH || maxY < 0.0f || minY >= HEIGHT)
+				continue;
+			t.minY = glm::max((int)floorf(minY), 0);
+			t.maxY = glm::min((int)ceilf(maxY), HEIGHT - 1);
+			triangles.push_back(t);
+		}
+	}
+
+	void rasterizeBand(unsigned int band)
+	{
+		int rowsPerBand = (HEIGHT + bandCount - 1) / bandCount;
+		int bandY0 = band * rowsPerBand;
+		int bandY1 = glm::min(bandY0 + rowsPerBand, HEIGHT) - 1;
+		for (int y = bandY0; y <= bandY1; y++)
+			for (int x = 0; x < WIDTH; x++)
+				depth[y * WIDTH + x] = 1.0f;
+
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			const ScreenTriangle &t = triangles[i];
+			int y0 = glm::max(t.minY, bandY0);
+			int y1 = glm::min(t.maxY, bandY1);
+			if (y0 > y1)
+				continue;
+			if (level >= SIMD_AVX2)
+				rasterizeAVX2(t, y0, y1);
+			else
+				rasterizeScalar(t, y0, y1);
+		}
+	}
+
+	// edge function coefficients so that w_k(x, y) = a[k] * x + b[k] * y + c[k] is >= 0 inside
+	static bool setupEdges(const ScreenTriangle &t, float a[3], float b[3], float c[3], float &invArea)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int i = (k + 1) % 3, j = (k + 2) % 3;
+			a[k] = t.y[i] - t.y[j];
+			b[k] = t.x[j] - t.x[i];
+			c[k] = t.x[i] * t.y[j] - t.x[j] * t.y[i];
+		}
+		float area = c[0] + c[1] + c[2];
+		if (fabsf(area) < 1e-6f)
+			return false;
+		// both windings are occluders, flip clockwise ones
+		if (area < 0.0f)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				a[k] = -a[k]; b[k] = -b[k]; c[k] = -c[k];
+			}
+			area = -area;
+		}
+		invArea = 1.0f / area;
+		return true;
+	}
+
+	static void triangleXRange(const ScreenTriangle &t, int &x0, int &x1)
+	{
+		float minX = glm::min(t.x[0], glm::min(t.x[1], t.x[2]));
+		float maxX = glm::max(t.x[0], glm::max(t.x[1], t.x[2]));
+		x0 = glm::max((int)floorf(minX), 0);
+		x1 = glm::min((int)ceilf(maxX), WIDTH - 1);
+	}
+
+	void rasterizeScalar(const ScreenTriangle &t, int y0, int y1)
+	{
+		float a[3], b[3], c[3], invArea;
+		if (!setupEdges(t, a, b, c, invArea))
+			return;
+		int x0, x1;
+		triangleXRange(t, x0, x1);
+		for (int y = y0; y <= y1; y++)
+		{
+			float py = y + 0.5f;
+			float *row = &depth[y * WIDTH];
+			for (int x = x0; x <= x1; x++)
+			{
+				float px = x + 0.5f;
+				float w0 = a[0] * px + b[0] * py + c[0];
+				float w1 = a[1] * px + b[1] * py + c[1];
+				float w2 = a[2] * px + b[2] * py + c[2];
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+				float z = (w0 * t.z[0] + w1 * t.z[1] + w2 * t.z[2]) * invArea;
+				row[x] = glm::min(row[x], z);
+			}
+		}
+	}
+
+	// 8 pixels per step, spans start 8 aligned so every load and store stays inside the 256 wide rows
+	PAG_TARGET_AVX2 void rasterizeAVX2(const ScreenTriangle &t, int y0, int y1)
+	{
+		float a[3], b[3], c[3], invArea;
+		if (!setupEdges(t, a, b, c, invArea))
+			return;
+		int x0, x1;
+		triangleXRange(t, x0, x1);
+		x0 &= ~7;
+
+		const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 a0 = _mm256_set1_ps(a[0]), a1 = _mm256_set1_ps(a[1]), a2 = _mm256_set1_ps(a[2]);
+		// z as a plane in the edge weights: z = (w0 z0 + w1 z1 + w2 z2) / area
+		__m256 z0 = _mm256_set1_ps(t.z[0] * invArea), z1 = _mm256_set1_ps(t.z[1] * invArea), z2 = _mm256_set1_ps(t.z[2] * invArea);
+		for (int y = y0; y <= y1; y++)
+		{
+			float py = y + 0.5f;
+			float *row = &depth[y * WIDTH];
+			for (int x = x0; x <= x1; x += 8)
+			{
+				__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+				__m256 w0 = _mm256_fmadd_ps(a0, px, _mm256_set1_ps(b[0] * py + c[0]));
+				__m256 w1 = _mm256_fmadd_ps(a1, px, _mm256_set1_ps(b[1] * py + c[1]));
+				__m256 w2 = _mm256_fmadd_ps(a2, px, _mm256_set1_ps(b[2] * py + c[2]));
+				__m256 inside = _mm256_and_ps(_mm256_cmp_ps(w0, zero, _CMP_GE_OQ),
+					_mm256_and_ps(_mm256_cmp_ps(w1, zero, _CMP_GE_OQ), _mm256_cmp_ps(w2, zero, _CMP_GE_OQ)));
+				if (_mm256_testz_ps(inside, inside))
+					continue;
+				__m256 z = _mm256_fmadd_ps(w0, z0, _mm256_fmadd_ps(w1, z1, _mm256_mul_ps(w2, z2)));
+				__m256 old = _mm256_loadu_ps(row + x);
+				_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), inside));
+			}
+		}
+	}
+
+	void buildPyramid()
+	{
+		PyramidLevel &base = pyramid[0];
+		base.minDepth = depth;
+		base.maxDepth = depth;
+		for (size_t l = 1; l < pyramid.size(); l++)
+		{
+			const PyramidLevel &src = pyramid[l - 1];
+			PyramidLevel &dst = pyramid[l];
+			for (int y = 0; y < dst.height; y++)
+			{
+				for (int x = 0; x < dst.width; x++)
+				{
+					int s0 = (2 * y) * src.width + 2 * x;
+					int s1 = s0 + src.width;
+					dst.minDepth[y * dst.width + x] = glm::min(glm::min(src.minDepth[s0], src.minDepth[s0 + 1]), glm::min(src.minDepth[s1], src.minDepth[s1 + 1]));
+					dst.maxDepth[y * dst.width + x] = glm::max(glm::max(src.maxDepth[s0], src.maxDepth[s0 + 1]), glm::max(src.maxDepth[s1], src.maxDepth[s1 + 1]));
+				}
+			}
+		}
+	}
+
+	// texel (tx, ty) of level l, restricted to the pixel rectangle [x0, x1] x [y0, y1]
+	bool regionVisible(int l, int tx, int ty, int x0, int y0, int x1, int y1, float minZ) const
+	{
+		const PyramidLevel &p = pyramid[l];
+		int index = ty * p.width + tx;
+		if (minZ > p.maxDepth[index])
+			return false;
+		if (minZ <= p.minDepth[index] || l == 0)
+			return true;
+		int cx0 = glm::max(tx * 2, x0 >> (l - 1)), cx1 = glm::min(tx * 2 + 1, x1 >> (l - 1));
+		int cy0 = glm::max(ty * 2, y0 >> (l - 1)), cy1 = glm::min(ty * 2 + 1, y1 >> (l - 1));
+		for (int cy = cy0; cy <= cy1; cy++)
+			for (int cx = cx0; cx <= cx1; cx++)
+				if (regionVisible(l - 1, cx, cy, x0, y0, x1, y1, minZ))
+					return true;
+		return false;
+	}
+};
+#endif
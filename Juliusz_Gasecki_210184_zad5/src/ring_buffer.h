@@ -0,0 +1,167 @@
+#pragma once
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "gl_handles.h"
+
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+// A piece of the ring written this frame. buffer/offset are what glBindBufferRange, glVertexAttribPointer
+// or the indirect offset need; data is only valid until commit().
+struct RingAllocation {
+	void *data;
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size;
+
+	bool valid() const { return data != NULL; }
+};
+
+// Streaming buffer for per-frame GPU data, split into REGIONS frame regions. A region is only written again
+// after the fence placed behind its last use has signalled, so the CPU never overwrites data in flight and the
+// driver never has to copy or orphan. GL 4.4 maps the whole buffer once (persistent + coherent); on 3.3 every
+// allocation maps its range unsynchronized, which is safe for the same reason.
+class GpuRingBuffer
+{
+public:
+	static const unsigned int REGIONS = 3;
+	// number of frames beginFrame() had to wait for the GPU
+	unsigned int stalls;
+	// number of allocations refused because the frame region was full
+	unsigned int overflows;
+
+	explicit GpuRingBuffer(GLsizeiptr regionSize)
+		: stalls(0), overflows(0), regionSize(regionSize), region(0), head(0), mapped(NULL)
+	{
+		for (unsigned int i = 0; i < REGIONS; i++)
+			fences[i] = 0;
+		persistentMapping = GLAD_GL_VERSION_4_4 != 0;
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		uniformOffsetAlignment = alignment;
+		alignment = 256;
+		if (GLAD_GL_VERSION_4_3)
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		storageOffsetAlignment = alignment;
+
+		buffer = GpuBuffer::create();
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id());
+		if (persistentMapping)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * REGIONS, NULL, flags);
+			mapped = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * REGIONS, flags);
+			if (!mapped)
+				cout << "ERROR::RING_BUFFER:: persistent mapping failed" << endl;
+		}
+		else
+			glBufferData(GL_COPY_WRITE_BUFFER, regionSize * REGIONS, NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// the buffer goes with its handle, deleting it also unmaps it
+	~GpuRingBuffer()
+	{
+		for (unsigned int i = 0; i < REGIONS; i++)
+			if (fences[i])
+				glDeleteSync(fences[i]);
+	}
+
+	// waits until the GPU is done with the region this frame writes to
+	void beginFrame()
+	{
+		head = 0;
+		if (!fences[region])
+			return;
+		GLenum result = glClientWaitSync(fences[region], 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			stalls++;
+			do
+				result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			while (result == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fences[region]);
+		fences[region] = 0;
+	}
+
+	// call after the last draw reading this frame's allocations
+	void endFrame()
+	{
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		region = (region + 1) % REGIONS;
+	}
+
+	// Reserves size bytes at the given alignment in this frame's region, invalid when the region is full. Callers
+	// fall back to a buffer of their own then; a full region is counted in overflows and only the first one is
+	// reported, a scene that outgrows the ring would otherwise print every frame.
+	// Has to be followed by commit() before anything draws from it; on 3.3 only one allocation may be open at a time.
+	RingAllocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16)
+	{
+		RingAllocation allocation = { NULL, buffer.id(), 0, size };
+		GLsizeiptr offset = (head + alignment - 1) / alignment * alignment;
+		if (offset + size > regionSize || size <= 0)
+		{
+			if (size > 0 && overflows++ == 0)
+				cout << "ERROR::RING_BUFFER:: frame region of " << regionSize << " bytes is full, later overflows are only counted" << endl;
+			return allocation;
+		}
+		head = offset + size;
+		allocation.offset = region * regionSize + offset;
+		if (persistentMapping)
+			allocation.data = mapped ? mapped + allocation.offset : NULL;
+		else
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id());
+			allocation.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, allocation.offset, size,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		return allocation;
+	}
+
+	// coherent persistent writes are visible to the next command already, the 3.3 path unmaps the range
+	void commit(const RingAllocation &allocation)
+	{
+		if (persistentMapping || !allocation.valid())
+			return;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.id());
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// allocate + copy + commit
+	RingAllocation upload(const void *data, GLsizeiptr size, GLsizeiptr alignment = 16)
+	{
+		RingAllocation allocation = allocate(size, alignment);
+		if (allocation.valid())
+		{
+			memcpy(allocation.data, data, size);
+			commit(allocation);
+		}
+		return allocation;
+	}
+
+	// offset alignments the GL requires for glBindBufferRange on each target
+	GLsizeiptr uniformAlignment() const { return uniformOffsetAlignment; }
+	GLsizeiptr storageAlignment() const { return storageOffsetAlignment; }
+
+	bool persistent() const { return persistentMapping; }
+	GLuint id() const { return buffer.id(); }
+	GLsizeiptr bytesUsed() const { return head; }
+
+private:
+	GpuBuffer buffer;
+	GLsizeiptr regionSize;
+	unsigned int region;
+	GLsizeiptr head;
+	char *mapped;
+	bool persistentMapping;
+	GLsync fences[REGIONS];
+	GLsizeiptr uniformOffsetAlignment, storageOffsetAlignment;
+};
+#endif
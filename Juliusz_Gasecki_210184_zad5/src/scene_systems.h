@@ -0,0 +1,101 @@
+#pragma once
+#ifndef SCENE_SYSTEMS_H
+#define SCENE_SYSTEMS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "world.h"
+#include "model.h"
+#include "transform.h"
+#include "bvh.h"
+#include "job_system.h"
+#include "simd_math.h"
+
+// Systems over the scene World. Each walks the component arrays of the matching chunks front to back; the
+// ones that only write their own rows run the chunks on the job system.
+
+// copies the world matrices that changed in the last TransformHierarchy::update() and refreshes the world bounds
+// of those entities (and of those whose local box was replaced)
+inline void updateTransformsSystem(World &world, const TransformHierarchy &transforms, JobSystem &jobs)
+{
+	world.forEachChunk(jobs, componentBit<Transform>(), [&transforms](Chunk &chunk) {
+		Transform *transform = chunk.array<Transform>();
+		Bounds *bounds = (chunk.mask() & componentBit<Bounds>()) ? chunk.array<Bounds>() : NULL;
+		for (unsigned int i = 0; i < chunk.size(); i++)
+		{
+			unsigned int version = transforms.getVersion(transform[i].node);
+			if (version != transform[i].version)
+			{
+				transform[i].world = transforms.getWorld(transform[i].node);
+				transform[i].version = version;
+				if (bounds)
+					bounds[i].dirty = 1;
+			}
+			if (bounds && bounds[i].dirty)
+			{
+				bounds[i].world = transformAABB(bounds[i].local, transform[i].world);
+				bounds[i].dirty = 0;
+			}
+		}
+	});
+}
+
+// keeps the scene index proxies on the entities' world bounds, displacement lets the tree enlarge the fat boxes
+// in the direction of travel
+inline void moveProxiesSystem(World &world, DynamicAabbTree &index, const glm::vec3 &displacement)
+{
+	world.forEachChunk(componentBit<Bounds>() | componentBit<Visibility>(), [&](Chunk &chunk) {
+		const Bounds *bounds = chunk.array<Bounds>();
+		const Visibility *visibility = chunk.array<Visibility>();
+		for (unsigned int i = 0; i < chunk.size(); i++)
+			if (visibility[i].proxy >= 0)
+				index.moveProxy(visibility[i].proxy, bounds[i].world, displacement);
+	});
+}
+
+inline void clearVisibilitySystem(World &world)
+{
+	world.forEachChunk(componentBit<Visibility>(), [](Chunk &chunk) {
+		Visibility *visibility = chunk.array<Visibility>();
+		for (unsigned int i = 0; i < chunk.size(); i++)
+			visibility[i].visible = 0;
+	});
+}
+
+// one world matrix per mesh, at MeshRef::firstMesh onwards, for the batched per-mesh bounds transform
+inline void meshModelsSystem(World &world, Mat4Array &models)
+{
+	world.forEachChunk(componentBit<Transform>() | componentBit<MeshRef>(), [&models](Chunk &chunk) {
+		const Transform *transform = chunk.array<Transform>();
+		const MeshRef *mesh = chunk.array<MeshRef>();
+		for (unsigned int i = 0; i < chunk.size(); i++)
+			for (unsigned int m = 0; m < mesh[i].model->meshes.size(); m++)
+				models[mesh[i].firstMesh + m] = transform[i].world;
+	});
+}
+
+// draws the visible entities one model at a time, the path without the render queue; returns how many were drawn
+inline unsigned int drawSystem(World &world)
+{
+	unsigned int drawn = 0;
+	world.forEachChunk(componentBit<Transform>() | componentBit<MeshRef>() | componentBit<Material>() | componentBit<Visibility>(), [&drawn](Chunk &chunk) {
+		const Transform *transform = chunk.array<Transform>();
+		const MeshRef *mesh = chunk.array<MeshRef>();
+		const Material *material = chunk.array<Material>();
+		const Visibility *visibility = chunk.array<Visibility>();
+		for (unsigned int i = 0; i < chunk.size(); i++)
+		{
+			if (!visibility[i].visible)
+				continue;
+			glUseProgram(material[i].program);
+			glUniformMatrix4fv(material[i].modelUniform, 1, GL_FALSE, glm::value_ptr(transform[i].world));
+			mesh[i].model->Draw(material[i].program);
+			drawn++;
+		}
+	});
+	return drawn;
+}
+#endif
@@ -13,9 +13,10 @@ class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly, vertexInputs (e.g. a vertex layout's declarations()) go into the
+	// vertex shader right after its #version line
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string &vertexInputs = std::string())
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -57,6 +58,12 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		if (!vertexInputs.empty())
+		{
+			size_t version = vertexCode.find("#version");
+			size_t lineEnd = version == std::string::npos ? std::string::npos : vertexCode.find('\n', version);
+			vertexCode.insert(lineEnd == std::string::npos ? 0 : lineEnd + 1, vertexInputs);
+		}
 		const char* vShaderCode = vertexCode.c_str();
 		const char * fShaderCode = fragmentCode.c_str();
 		// 2. compile shaders
@@ -96,69 +103,124 @@ public:
 			glDeleteShader(geometry);
 
 	}
+	// constructor for a compute program (GL 4.3)
+	// ------------------------------------------------------------------------
+	explicit Shader(const char* computePath)
+	{
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
+		}
+		catch (std::ifstream::failure e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		const char* cShaderCode = computeCode.c_str();
+		unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &cShaderCode, NULL);
+		glCompileShader(compute);
+		checkCompileErrors(compute, "COMPUTE");
+		ID = glCreateProgram();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+		glDeleteShader(compute);
+	}
+	// the program is deleted with the Shader, so it is move-only like the handles in gl_handles.h and the
+	// context must still be current when it dies
+	// ------------------------------------------------------------------------
+	~Shader()
+	{
+		if (ID)
+			glDeleteProgram(ID);
+	}
+	Shader(Shader &&other) noexcept : ID(other.ID)
+	{
+		other.ID = 0;
+	}
+	Shader &operator=(Shader &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (ID)
+				glDeleteProgram(ID);
+			ID = other.ID;
+			other.ID = 0;
+		}
+		return *this;
+	}
+	Shader(const Shader &) = delete;
+	Shader &operator=(const Shader &) = delete;
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
 	{
 		glUseProgram(ID);
 	}
-	// utility uniform functions
+	// utility uniform functions, names are C strings so a literal costs no std::string per call
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(const char *name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(glGetUniformLocation(ID, name), (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(const char *name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(glGetUniformLocation(ID, name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(const char *name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(glGetUniformLocation(ID, name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(const char *name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(glGetUniformLocation(ID, name), 1, &value[0]);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(const char *name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(glGetUniformLocation(ID, name), x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(const char *name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(glGetUniformLocation(ID, name), 1, &value[0]);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec3(const char *name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(glGetUniformLocation(ID, name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(const char *name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(glGetUniformLocation(ID, name), 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(const char *name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(glGetUniformLocation(ID, name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(const char *name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(const char *name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat4(const char *name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE, &mat[0][0]);
 	}
 
 private:
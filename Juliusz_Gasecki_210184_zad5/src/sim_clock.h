@@ -0,0 +1,52 @@
+#pragma once
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+// Fixed-rate simulation clock. Real frame time goes into an accumulator and comes out as whole steps of
+// 1/rate seconds, so the simulation advances the same at any frame rate. What is left in the accumulator
+// (alpha) is how far rendering sits between the last two simulated states.
+class SimClock
+{
+public:
+	explicit SimClock(double rate = 60.0, unsigned int maxStepsPerFrame = 8)
+		: accumulator(0.0), ticks(0), maxSteps(maxStepsPerFrame)
+	{
+		setRate(rate);
+	}
+
+	void setRate(double rate)
+	{
+		stepLength = 1.0 / rate;
+	}
+
+	// returns how many fixed steps to run this frame; after a long stall (loading, breakpoint) the
+	// backlog is dropped instead of fast forwarding through it
+	unsigned int advance(double frameTime)
+	{
+		if (frameTime > 0.0)
+			accumulator += frameTime;
+		unsigned int steps = 0;
+		while (accumulator >= stepLength && steps < maxSteps)
+		{
+			accumulator -= stepLength;
+			steps++;
+		}
+		if (steps == maxSteps && accumulator >= stepLength)
+			accumulator = 0.0;
+		ticks += steps;
+		return steps;
+	}
+
+	// 0 = previous state, 1 = current state
+	float alpha() const { return (float)(accumulator / stepLength); }
+	double step() const { return stepLength; }
+	double rate() const { return 1.0 / stepLength; }
+	unsigned long long tick() const { return ticks; }
+
+private:
+	double stepLength;
+	double accumulator;
+	unsigned long long ticks;
+	unsigned int maxSteps;
+};
+#endif
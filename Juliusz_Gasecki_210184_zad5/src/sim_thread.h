@@ -0,0 +1,159 @@
+#pragma once
+#ifndef SIM_THREAD_H
+#define SIM_THREAD_H
+
+#include "sim_clock.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+using namespace std;
+
+// Lock-free single producer / single consumer handoff. The writer fills its back buffer and swaps it with the
+// middle one, the reader swaps its front buffer with the middle one when something new was published.
+// Neither side ever waits; the reader simply keeps the last snapshot until a newer one exists.
+template <typename T>
+class TripleBuffer
+{
+public:
+	explicit TripleBuffer(const T &initial) : middle(1), back(0), front(2)
+	{
+		for (int i = 0; i < 3; i++)
+			buffers[i] = initial;
+	}
+
+	// writer side
+	T &writeBuffer() { return buffers[back]; }
+	void publish() { back = middle.exchange(back | FRESH) & INDEX; }
+
+	// reader side, returns true when readBuffer() changed
+	bool acquire()
+	{
+		if (!(middle.load() & FRESH))
+			return false;
+		front = middle.exchange(front) & INDEX;
+		return true;
+	}
+	const T &readBuffer() const { return buffers[front]; }
+
+private:
+	static const unsigned int INDEX = 3;
+	static const unsigned int FRESH = 4;
+	T buffers[3];
+	atomic<unsigned int> middle;
+	unsigned int back;
+	unsigned int front;
+};
+
+// what one simulation step hands to rendering: the last two states to blend between and when the newer was made
+template <typename State>
+struct SimSnapshot {
+	State previous;
+	State current;
+	double time;
+	unsigned long long tick;
+};
+
+// Runs a fixed-rate step function on its own thread and publishes an immutable snapshot after every batch of
+// steps. The step function owns all simulation state; the render thread only ever sees snapshots.
+template <typename State>
+class SimulationThread
+{
+public:
+	typedef function<void(State &)> StepFunction;
+
+	SimulationThread(double rate, const State &initial, StepFunction step)
+		: clock(rate), step(step), state(initial), previous(initial), snapshots(makeSnapshot(initial, initial, now(), 0)), running(false)
+	{
+	}
+
+	~SimulationThread()
+	{
+		stop();
+	}
+
+	void start()
+	{
+		if (running.exchange(true))
+			return;
+		worker = thread(&SimulationThread::run, this);
+	}
+
+	void stop()
+	{
+		if (!running.exchange(false))
+			return;
+		worker.join();
+	}
+
+	// render side, never blocks
+	const SimSnapshot<State> &latest()
+	{
+		snapshots.acquire();
+		return snapshots.readBuffer();
+	}
+
+	// blend factor for the snapshot returned by latest(); rendering runs one step behind the simulation
+	float alpha(double time) const
+	{
+		double t = (time - snapshots.readBuffer().time) / clock.step();
+		return (float)(t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t));
+	}
+
+	// same time base as SimSnapshot::time
+	static double now()
+	{
+		return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+private:
+	SimClock clock;
+	StepFunction step;
+	State state;
+	State previous;
+	TripleBuffer<SimSnapshot<State> > snapshots;
+	atomic<bool> running;
+	thread worker;
+
+	static SimSnapshot<State> makeSnapshot(const State &previous, const State &current, double time, unsigned long long tick)
+	{
+		SimSnapshot<State> snapshot;
+		snapshot.previous = previous;
+		snapshot.current = current;
+		snapshot.time = time;
+		snapshot.tick = tick;
+		return snapshot;
+	}
+
+	void run()
+	{
+		double last = now();
+		while (running.load())
+		{
+			double time = now();
+			unsigned int steps = clock.advance(time - last);
+			last = time;
+			if (steps)
+			{
+				for (unsigned int i = 0; i < steps; i++)
+				{
+					previous = state;
+					step(state);
+				}
+				// assigned member by member so the buffers' containers keep their storage, stamped with the time
+				// the state is exact for, not when the steps ran
+				SimSnapshot<State> &snapshot = snapshots.writeBuffer();
+				snapshot.previous = previous;
+				snapshot.current = state;
+				snapshot.time = time - clock.alpha() * clock.step();
+				snapshot.tick = clock.tick();
+				snapshots.publish();
+			}
+			// sleep until the next step is due
+			double wait = (1.0 - clock.alpha()) * clock.step();
+			this_thread::sleep_for(chrono::duration<double>(wait));
+		}
+	}
+};
+#endif
@@ -0,0 +1,324 @@
+#pragma once
+#ifndef SIMD_MATH_H
+#define SIMD_MATH_H
+
+#include <glm/glm.hpp>
+
+#include "cpu_features.h"
+#include "bounds.h"
+#include "frustum.h"
+
+#include <cstddef>
+#include <new>
+#include <vector>
+using namespace std;
+
+// Allocator for the batch arrays, every glm::mat4 starts on a 32 byte boundary so no 128/256 bit load of a
+// column pair splits a cache line. glm itself stays in its default scalar configuration: enabling its intrinsics would raise
+// alignof(glm::mat4) above what C++11 operator new guarantees.
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	typedef T value_type;
+	template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	T *allocate(size_t n)
+	{
+		void *p = _mm_malloc(n * sizeof(T), Alignment);
+		if (!p)
+			throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T *p, size_t) { _mm_free(p); }
+};
+template <typename T, typename U, size_t A>
+bool operator==(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return false; }
+
+typedef vector<glm::mat4, AlignedAllocator<glm::mat4, 32> > Mat4Array;
+
+// Batch math over glm types. Each call picks the widest path the CPU supports (or the level forced with
+// setSimdLevel); the scalar path is plain glm and is the reference the others are checked against.
+class MathKernels
+{
+public:
+	MathKernels() : level(bestSimdLevel()) {}
+
+	SimdLevel simdLevel() const { return level; }
+	void setSimdLevel(SimdLevel simd) { level = simd < bestSimdLevel() ? simd : bestSimdLevel(); }
+
+	// out[i] = a[i] * b[i], out may alias a or b
+	void multiply(const glm::mat4 *a, const glm::mat4 *b, glm::mat4 *out, size_t n) const
+	{
+		if (level >= SIMD_AVX2)
+			multiplyAVX2(a, NULL, b, out, n);
+		else if (level >= SIMD_SSE41)
+			multiplySSE(a, NULL, b, out, n);
+		else
+			for (size_t i = 0; i < n; i++)
+				out[i] = a[i] * b[i];
+	}
+
+	// out[i] = parents[parentIndex[i]] * locals[i], one depth level of a transform hierarchy
+	void multiplyIndexed(const glm::mat4 *parents, const int *parentIndex, const glm::mat4 *locals, glm::mat4 *out, size_t n) const
+	{
+		if (level >= SIMD_AVX2)
+			multiplyAVX2(parents, parentIndex, locals, out, n);
+		else if (level >= SIMD_SSE41)
+			multiplySSE(parents, parentIndex, locals, out, n);
+		else
+			for (size_t i = 0; i < n; i++)
+				out[i] = parents[parentIndex[i]] * locals[i];
+	}
+
+	// out[i] = transformAABB(boxes[i], models[i]) (Arvo), empty boxes stay empty
+	void transformAABBs(const glm::mat4 *models, const AABB *boxes, AABB *out, size_t n) const
+	{
+		if (level >= SIMD_AVX2)
+			transformAABBsAVX2(models, boxes, out, n);
+		else if (level >= SIMD_SSE41)
+			transformAABBsSSE(models, boxes, out, n);
+		else
+			for (size_t i = 0; i < n; i++)
+				out[i] = transformAABB(boxes[i], models[i]);
+	}
+
+	// out[i] = m * vec4(points[i], 1)
+	void transformPoints(const glm::mat4 &m, const glm::vec3 *points, glm::vec4 *out, size_t n) const
+	{
+		if (level >= SIMD_AVX2)
+			transformPointsAVX2(m, points, out, n);
+		else if (level >= SIMD_SSE41)
+			transformPointsSSE(m, points, out, n);
+		else
+			for (size_t i = 0; i < n; i++)
+				out[i] = m * glm::vec4(points[i], 1.0f);
+	}
+
+	// visible[i] = sphere (xyz center, w radius) is not fully behind any plane of the frustum
+	void testSpheres(const Frustum &frustum, const glm::vec4 *spheres, unsigned char *visible, size_t n) const
+	{
+		size_t i = 0;
+		if (level >= SIMD_AVX)
+			i = testSpheresAVX(frustum, spheres, visible, n);
+		else if (level >= SIMD_SSE41)
+			i = testSpheresSSE(frustum, spheres, visible, n);
+		for (; i < n; i++)
+			visible[i] = frustumContainsSphere(frustum, BoundingSphere(glm::vec3(spheres[i]), spheres[i].w)) ? 1 : 0;
+	}
+
+private:
+	SimdLevel level;
+
+	// column j of a*b is a * b[j], one broadcast multiply-add per column of a
+	PAG_TARGET_SSE41 static void multiplySSE(const glm::mat4 *a, const int *aIndex, const glm::mat4 *b, glm::mat4 *out, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			const float *pa = &(aIndex ? a[aIndex[i]] : a[i])[0][0];
+			const float *pb = &b[i][0][0];
+			__m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4), a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+			__m128 r[4];
+			for (int j = 0; j < 4; j++)
+			{
+				__m128 col = _mm_loadu_ps(pb + j * 4);
+				r[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_shuffle_ps(col, col, 0x00)), _mm_mul_ps(a1, _mm_shuffle_ps(col, col, 0x55))),
+					_mm_add_ps(_mm_mul_ps(a2, _mm_shuffle_ps(col, col, 0xAA)), _mm_mul_ps(a3, _mm_shuffle_ps(col, col, 0xFF))));
+			}
+			float *po = &out[i][0][0];
+			for (int j = 0; j < 4; j++)
+				_mm_storeu_ps(po + j * 4, r[j]);
+		}
+	}
+
+	// two columns of the result per 256 bit register
+	PAG_TARGET_AVX2 static void multiplyAVX2(const glm::mat4 *a, const int *aIndex, const glm::mat4 *b, glm::mat4 *out, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			const float *pa = &(aIndex ? a[aIndex[i]] : a[i])[0][0];
+			const float *pb = &b[i][0][0];
+			__m256 a0 = _mm256_broadcast_ps((const __m128*)pa), a1 = _mm256_broadcast_ps((const __m128*)(pa + 4));
+			__m256 a2 = _mm256_broadcast_ps((const __m128*)(pa + 8)), a3 = _mm256_broadcast_ps((const __m128*)(pa + 12));
+			__m256 b01 = _mm256_loadu_ps(pb), b23 = _mm256_loadu_ps(pb + 8);
+			__m256 r01 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, 0x00));
+			__m256 r23 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b23, b23, 0x00));
+			r01 = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(b01, b01, 0x55), r01);
+			r23 = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(b23, b23, 0x55), r23);
+			r01 = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(b01, b01, 0xAA), r01);
+			r23 = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(b23, b23, 0xAA), r23);
+			r01 = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(b01, b01, 0xFF), r01);
+			r23 = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(b23, b23, 0xFF), r23);
+			float *po = &out[i][0][0];
+			_mm256_storeu_ps(po, r01);
+			_mm256_storeu_ps(po + 8, r23);
+		}
+	}
+
+	PAG_TARGET_SSE41 static void transformAABBsSSE(const glm::mat4 *models, const AABB *boxes, AABB *out, size_t n)
+	{
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		for (size_t i = 0; i < n; i++)
+		{
+			const AABB &box = boxes[i];
+			if (box.empty())
+			{
+				out[i] = box;
+				continue;
+			}
+			const float *m = &models[i][0][0];
+			__m128 bmin = _mm_set_ps(0.0f, box.min.z, box.min.y, box.min.x);
+			__m128 bmax = _mm_set_ps(0.0f, box.max.z, box.max.y, box.max.x);
+			__m128 c = _mm_mul_ps(_mm_add_ps(bmin, bmax), half);
+			__m128 e = _mm_mul_ps(_mm_sub_ps(bmax, bmin), half);
+			__m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m + 4), m2 = _mm_loadu_ps(m + 8), m3 = _mm_loadu_ps(m + 12);
+			__m128 wc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_shuffle_ps(c, c, 0x00)), _mm_mul_ps(m1, _mm_shuffle_ps(c, c, 0x55))),
+				_mm_add_ps(_mm_mul_ps(m2, _mm_shuffle_ps(c, c, 0xAA)), m3));
+			__m128 we = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, m0), _mm_shuffle_ps(e, e, 0x00)),
+				_mm_mul_ps(_mm_andnot_ps(signMask, m1), _mm_shuffle_ps(e, e, 0x55))), _mm_mul_ps(_mm_andnot_ps(signMask, m2), _mm_shuffle_ps(e, e, 0xAA)));
+			float lo[4], hi[4];
+			_mm_storeu_ps(lo, _mm_sub_ps(wc, we));
+			_mm_storeu_ps(hi, _mm_add_ps(wc, we));
+			out[i].min = glm::vec3(lo[0], lo[1], lo[2]);
+			out[i].max = glm::vec3(hi[0], hi[1], hi[2]);
+		}
+	}
+
+	// two boxes per iteration, one per 128 bit lane
+	PAG_TARGET_AVX2 static void transformAABBsAVX2(const glm::mat4 *models, const AABB *boxes, AABB *out, size_t n)
+	{
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		size_t i = 0;
+		for (; i + 1 < n; i += 2)
+		{
+			const AABB &b0 = boxes[i], &b1 = boxes[i + 1];
+			const float *m = &models[i][0][0], *k = &models[i + 1][0][0];
+			__m256 bmin = _mm256_set_ps(0.0f, b1.min.z, b1.min.y, b1.min.x, 0.0f, b0.min.z, b0.min.y, b0.min.x);
+			__m256 bmax = _mm256_set_ps(0.0f, b1.max.z, b1.max.y, b1.max.x, 0.0f, b0.max.z, b0.max.y, b0.max.x);
+			__m256 c = _mm256_mul_ps(_mm256_add_ps(bmin, bmax), half);
+			__m256 e = _mm256_mul_ps(_mm256_sub_ps(bmax, bmin), half);
+			__m256 m0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(m)), _mm_loadu_ps(k), 1);
+			__m256 m1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(m + 4)), _mm_loadu_ps(k + 4), 1);
+			__m256 m2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(m + 8)), _mm_loadu_ps(k + 8), 1);
+			__m256 m3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(m + 12)), _mm_loadu_ps(k + 12), 1);
+			__m256 wc = _mm256_fmadd_ps(m0, _mm256_shuffle_ps(c, c, 0x00), m3);
+			wc = _mm256_fmadd_ps(m1, _mm256_shuffle_ps(c, c, 0x55), wc);
+			wc = _mm256_fmadd_ps(m2, _mm256_shuffle_ps(c, c, 0xAA), wc);
+			__m256 we = _mm256_mul_ps(_mm256_andnot_ps(signMask, m0), _mm256_shuffle_ps(e, e, 0x00));
+			we = _mm256_fmadd_ps(_mm256_andnot_ps(signMask, m1), _mm256_shuffle_ps(e, e, 0x55), we);
+			we = _mm256_fmadd_ps(_mm256_andnot_ps(signMask, m2), _mm256_shuffle_ps(e, e, 0xAA), we);
+			float lo[8], hi[8];
+			_mm256_storeu_ps(lo, _mm256_sub_ps(wc, we));
+			_mm256_storeu_ps(hi, _mm256_add_ps(wc, we));
+			out[i].min = glm::vec3(lo[0], lo[1], lo[2]);
+			out[i].max = glm::vec3(hi[0], hi[1], hi[2]);
+			out[i + 1].min = glm::vec3(lo[4], lo[5], lo[6]);
+			out[i + 1].max = glm::vec3(hi[4], hi[5], hi[6]);
+			// empty input boxes went through the math as well, put them back
+			if (b0.empty())
+				out[i] = b0;
+			if (b1.empty())
+				out[i + 1] = b1;
+		}
+		if (i < n)
+			transformAABBsSSE(models + i, boxes + i, out + i, n - i);
+	}
+
+	PAG_TARGET_SSE41 static void transformPointsSSE(const glm::mat4 &matrix, const glm::vec3 *points, glm::vec4 *out, size_t n)
+	{
+		const float *m = &matrix[0][0];
+		__m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m + 4), m2 = _mm_loadu_ps(m + 8), m3 = _mm_loadu_ps(m + 12);
+		for (size_t i = 0; i < n; i++)
+		{
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(points[i].x)), _mm_mul_ps(m1, _mm_set1_ps(points[i].y))),
+				_mm_add_ps(_mm_mul_ps(m2, _mm_set1_ps(points[i].z)), m3));
+			_mm_storeu_ps(&out[i].x, r);
+		}
+	}
+
+	PAG_TARGET_AVX2 static void transformPointsAVX2(const glm::mat4 &matrix, const glm::vec3 *points, glm::vec4 *out, size_t n)
+	{
+		const float *m = &matrix[0][0];
+		__m256 m0 = _mm256_broadcast_ps((const __m128*)m), m1 = _mm256_broadcast_ps((const __m128*)(m + 4));
+		__m256 m2 = _mm256_broadcast_ps((const __m128*)(m + 8)), m3 = _mm256_broadcast_ps((const __m128*)(m + 12));
+		size_t i = 0;
+		for (; i + 1 < n; i += 2)
+		{
+			const glm::vec3 &p = points[i], &q = points[i + 1];
+			__m256 x = _mm256_set_m128(_mm_set1_ps(q.x), _mm_set1_ps(p.x));
+			__m256 y = _mm256_set_m128(_mm_set1_ps(q.y), _mm_set1_ps(p.y));
+			__m256 z = _mm256_set_m128(_mm_set1_ps(q.z), _mm_set1_ps(p.z));
+			__m256 r = _mm256_fmadd_ps(m0, x, _mm256_fmadd_ps(m1, y, _mm256_fmadd_ps(m2, z, m3)));
+			_mm256_storeu_ps(&out[i].x, r);
+		}
+		if (i < n)
+			transformPointsSSE(matrix, points + i, out + i, n - i);
+	}
+
+	// four spheres per iteration, transposed to x/y/z/radius registers
+	PAG_TARGET_SSE41 static size_t testSpheresSSE(const Frustum &frustum, const glm::vec4 *spheres, unsigned char *visible, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 3 < n; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&spheres[i].x), y = _mm_loadu_ps(&spheres[i + 1].x);
+			__m128 z = _mm_loadu_ps(&spheres[i + 2].x), r = _mm_loadu_ps(&spheres[i + 3].x);
+			_MM_TRANSPOSE4_PS(x, y, z, r);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			__m128 negR = _mm_sub_ps(_mm_setzero_ps(), r);
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &pl = frustum.planes[p];
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.x), x), _mm_mul_ps(_mm_set1_ps(pl.y), y)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl.z), z), _mm_set1_ps(pl.w)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for (int k = 0; k < 4; k++)
+				visible[i + k] = (unsigned char)((mask >> k) & 1);
+		}
+		return i;
+	}
+
+	PAG_TARGET_AVX static size_t testSpheresAVX(const Frustum &frustum, const glm::vec4 *spheres, unsigned char *visible, size_t n)
+	{
+		size_t i = 0;
+		for (; i + 7 < n; i += 8)
+		{
+			__m128 x0 = _mm_loadu_ps(&spheres[i].x), y0 = _mm_loadu_ps(&spheres[i + 1].x);
+			__m128 z0 = _mm_loadu_ps(&spheres[i + 2].x), r0 = _mm_loadu_ps(&spheres[i + 3].x);
+			__m128 x1 = _mm_loadu_ps(&spheres[i + 4].x), y1 = _mm_loadu_ps(&spheres[i + 5].x);
+			__m128 z1 = _mm_loadu_ps(&spheres[i + 6].x), r1 = _mm_loadu_ps(&spheres[i + 7].x);
+			_MM_TRANSPOSE4_PS(x0, y0, z0, r0);
+			_MM_TRANSPOSE4_PS(x1, y1, z1, r1);
+			__m256 x = _mm256_set_m128(x1, x0), y = _mm256_set_m128(y1, y0);
+			__m256 z = _mm256_set_m128(z1, z0), negR = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_set_m128(r1, r0));
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &pl = frustum.planes[p];
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pl.x), x), _mm256_mul_ps(_mm256_set1_ps(pl.y), y)),
+					_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(pl.z), z), _mm256_set1_ps(pl.w)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negR, _CMP_GE_OQ));
+			}
+			int mask = _mm256_movemask_ps(inside);
+			for (int k = 0; k < 8; k++)
+				visible[i + k] = (unsigned char)((mask >> k) & 1);
+		}
+		return i;
+	}
+};
+
+// shared instance, detection runs once
+inline MathKernels &mathKernels()
+{
+	static MathKernels kernels;
+	return kernels;
+}
+#endif
@@ -0,0 +1,212 @@
+#pragma once
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "gl_handles.h"
+#include "gl_resources.h"
+#include "job_system.h"
+#include "vertex_layout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+// vertex of the unlit colour shaders (normalCubeShader, budynki), position already in world space
+struct StaticVertex {
+	glm::vec3 position;
+	glm::vec3 color;
+};
+static_assert(ColoredVertexLayout::stride == sizeof(StaticVertex) && ColoredVertexLayout::offset(1) == offsetof(StaticVertex, color),
+	"ColoredVertexLayout and StaticVertex differ");
+
+// one merged draw: every static object of one material whose center falls into one grid cell
+struct StaticBatch {
+	GLuint material;	// program
+	int cellX, cellZ;
+	GLuint count;
+	GLuint firstIndex;
+	GLint baseVertex;
+	AABB bounds;		// world space, for culling the whole cell at once
+};
+
+// Objects that never move, merged once at scene load. Each object's vertices are transformed to world space on
+// the job system, then objects are grouped by material and by the cell of a square grid on the ground their
+// center falls into, and every group becomes one range of a single vertex/index buffer. Drawing then costs one
+// glDrawElementsBaseVertex per visible (material, cell) pair, no matter how many objects the cell holds.
+class StaticBatcher
+{
+public:
+	vector<StaticBatch> batches;
+
+	explicit StaticBatcher(float cellSize = 64.0f) : cellSize(cellSize), vertexCount(0), indexCount(0), identity(1.0f) {}
+
+	// vertices are position + colour, 6 floats each; without indices every three vertices are a triangle.
+	// The arrays are read during build() and must live until then.
+	void add(GLuint material, const float *vertices, unsigned int count, const glm::mat4 &model,
+		const unsigned int *indices = NULL, unsigned int indexCount = 0)
+	{
+		Source source;
+		source.material = material;
+		source.vertices = vertices;
+		source.vertexCount = count;
+		source.indices = indices;
+		source.indexCount = indices ? indexCount : count;
+		source.model = model;
+		sources.push_back(source);
+	}
+
+	// merges everything added so far into the GL buffers, replacing earlier batches
+	void build(JobSystem &jobs)
+	{
+		// the cell of an object is decided by its box, the exact bounds come out of the transform below
+		for (unsigned int i = 0; i < sources.size(); i++)
+		{
+			Source &source = sources[i];
+			AABB local;
+			for (unsigned int v = 0; v < source.vertexCount; v++)
+				local.expand(glm::vec3(source.vertices[v * 6], source.vertices[v * 6 + 1], source.vertices[v * 6 + 2]));
+			glm::vec3 center = transformAABB(local, source.model).center();
+			source.cellX = (int)floorf(center.x / cellSize);
+			source.cellZ = (int)floorf(center.z / cellSize);
+		}
+
+		vector<unsigned int> order(sources.size());
+		for (unsigned int i = 0; i < order.size(); i++)
+			order[i] = i;
+		const vector<Source> &all = sources;
+		stable_sort(order.begin(), order.end(), [&all](unsigned int a, unsigned int b) {
+			if (all[a].material != all[b].material)
+				return all[a].material < all[b].material;
+			if (all[a].cellX != all[b].cellX)
+				return all[a].cellX < all[b].cellX;
+			return all[a].cellZ < all[b].cellZ;
+		});
+
+		// one batch per run of equal keys; every object gets its slice of the merged arrays
+		batches.clear();
+		vertexCount = 0;
+		indexCount = 0;
+		for (unsigned int o = 0; o < order.size(); o++)
+		{
+			Source &source = sources[order[o]];
+			if (batches.empty() || batches.back().material != source.material
+				|| batches.back().cellX != source.cellX || batches.back().cellZ != source.cellZ)
+			{
+				StaticBatch batch;
+				batch.material = source.material;
+				batch.cellX = source.cellX;
+				batch.cellZ = source.cellZ;
+				batch.count = 0;
+				batch.firstIndex = indexCount;
+				batch.baseVertex = (GLint)vertexCount;
+				batches.push_back(batch);
+			}
+			StaticBatch &batch = batches.back();
+			source.batch = (unsigned int)batches.size() - 1;
+			source.firstVertex = vertexCount;
+			source.firstIndex = indexCount;
+			batch.count += source.indexCount;
+			vertexCount += source.vertexCount;
+			indexCount += source.indexCount;
+		}
+
+		vector<StaticVertex> vertices(vertexCount);
+		vector<unsigned int> indices(indexCount);
+		vector<AABB> objectBounds(sources.size());
+		StaticVertex *vertexData = vertices.data();
+		unsigned int *indexData = indices.data();
+		AABB *boundsData = objectBounds.data();
+		const StaticBatch *batchData = batches.data();
+		jobs.parallelFor(0, (unsigned int)sources.size(), 16, [&all, vertexData, indexData, boundsData, batchData](unsigned int first, unsigned int last) {
+			for (unsigned int i = first; i < last; i++)
+			{
+				const Source &source = all[i];
+				AABB bounds;
+				StaticVertex *out = vertexData + source.firstVertex;
+				for (unsigned int v = 0; v < source.vertexCount; v++)
+				{
+					const float *in = source.vertices + v * 6;
+					out[v].position = glm::vec3(source.model * glm::vec4(in[0], in[1], in[2], 1.0f));
+					out[v].color = glm::vec3(in[3], in[4], in[5]);
+					bounds.expand(out[v].position);
+				}
+				// indices are relative to the batch's base vertex
+				unsigned int offset = source.firstVertex - (unsigned int)batchData[source.batch].baseVertex;
+				unsigned int *outIndices = indexData + source.firstIndex;
+				for (unsigned int n = 0; n < source.indexCount; n++)
+					outIndices[n] = offset + (source.indices ? source.indices[n] : n);
+				boundsData[i] = bounds;
+			}
+		});
+		for (unsigned int i = 0; i < sources.size(); i++)
+			batches[sources[i].batch].bounds.expand(objectBounds[i]);
+
+		VAO = VertexArray::create();
+		VBO = GpuBuffer::create();
+		EBO = GpuBuffer::create();
+		bufferStorage(VBO.id(), vertices.size() * sizeof(StaticVertex), vertices.data(), false);
+		bufferStorage(EBO.id(), indices.size() * sizeof(unsigned int), indices.data(), false);
+		vertexArrayElements(VAO.id(), EBO.id());
+		ColoredVertexLayout::attach(VAO.id(), VBO.id());
+	}
+
+	unsigned int objectCount() const { return (unsigned int)sources.size(); }
+	unsigned int totalVertices() const { return vertexCount; }
+
+	// Draws the batches with visible[b] set, grouped so each material's program is used once. The caller sets
+	// view/projection on every material; "model" is set to identity since the vertices are already in world space.
+	template <typename Visible>
+	unsigned int draw(Visible visible)
+	{
+		unsigned int drawn = 0;
+		GLuint program = 0;
+		glBindVertexArray(VAO.id());
+		for (unsigned int b = 0; b < batches.size(); b++)
+		{
+			const StaticBatch &batch = batches[b];
+			if (!visible(b))
+				continue;
+			if (batch.material != program)
+			{
+				program = batch.material;
+				glUseProgram(program);
+				glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &identity[0][0]);
+			}
+			glDrawElementsBaseVertex(GL_TRIANGLES, batch.count, GL_UNSIGNED_INT,
+				(void*)(batch.firstIndex * sizeof(unsigned int)), batch.baseVertex);
+			drawn++;
+		}
+		glBindVertexArray(0);
+		return drawn;
+	}
+
+private:
+	struct Source {
+		GLuint material;
+		const float *vertices;
+		unsigned int vertexCount;
+		const unsigned int *indices;
+		unsigned int indexCount;
+		glm::mat4 model;
+		int cellX, cellZ;
+		unsigned int batch;
+		unsigned int firstVertex;
+		unsigned int firstIndex;
+	};
+
+	float cellSize;
+	vector<Source> sources;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	glm::mat4 identity;
+	VertexArray VAO;
+	GpuBuffer VBO, EBO;
+};
+#endif
@@ -0,0 +1,191 @@
+#pragma once
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm.hpp>
+
+#include "simd_math.h"
+
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+// Flattened transform hierarchy. Local and world matrices live in contiguous arrays sorted by depth, every
+// parent therefore sits before its children and update() resolves all world matrices in one forward pass.
+// Nodes are addressed by stable handles, slots only change when the hierarchy is re-sorted (create, setParent).
+class TransformHierarchy
+{
+public:
+	TransformHierarchy() : firstDirty(0), updated(0) {}
+
+	// returns the handle of the new node, parent is a handle or -1 for a root
+	int create(const glm::mat4 &local, int parent = -1)
+	{
+		int node = (int)slotOfNode.size();
+		slotOfNode.push_back((int)nodeOfSlot.size());
+		nodeOfSlot.push_back(node);
+		parentNodes.push_back(parent);
+		parents.push_back(-1);
+		depths.push_back(0);
+		locals.push_back(local);
+		worlds.push_back(local);
+		dirty.push_back(1);
+		changed.push_back(0);
+		versions.push_back(0);
+		resort();
+		return node;
+	}
+
+	void setParent(int node, int parent)
+	{
+		parentNodes[node] = parent;
+		resort();
+	}
+
+	// marks the node dirty only when the matrix really changed, so setting the same pose every frame is free
+	void setLocal(int node, const glm::mat4 &local)
+	{
+		int slot = slotOfNode[node];
+		if (locals[slot] == local)
+			return;
+		locals[slot] = local;
+		markDirty(slot);
+	}
+
+	const glm::mat4 &getLocal(int node) const { return locals[slotOfNode[node]]; }
+	// valid after update()
+	const glm::mat4 &getWorld(int node) const { return worlds[slotOfNode[node]]; }
+	int getParent(int node) const { return parentNodes[node]; }
+	// incremented every time the world matrix of the node is recomputed, lets dependants cache derived data
+	unsigned int getVersion(int node) const { return versions[slotOfNode[node]]; }
+	unsigned int size() const { return (unsigned int)locals.size(); }
+	// number of world matrices recomputed by the last update()
+	unsigned int updatedCount() const { return updated; }
+
+	// Recomputes dirty nodes and everything below them. Clean nodes in front of the first dirty slot are
+	// skipped entirely, after it a node is only multiplied when it or its parent changed this pass.
+	// Consecutive recomputed slots of one depth level go to the batch kernel together.
+	unsigned int update()
+	{
+		updated = 0;
+		unsigned int count = (unsigned int)locals.size();
+		if (firstDirty >= count)
+			return 0;
+		unsigned int runStart = firstDirty, runLength = 0;
+		for (unsigned int slot = firstDirty; slot < count; slot++)
+		{
+			int parent = parents[slot];
+			bool recompute = dirty[slot] || (parent >= 0 && changed[parent]);
+			// a run ends at a clean node, a root or a new depth level (whose parents may sit in the run)
+			if (runLength && (!recompute || parent < 0 || depths[slot] != depths[runStart]))
+			{
+				flush(runStart, runLength);
+				runLength = 0;
+			}
+			if (!recompute)
+				continue;
+			dirty[slot] = 0;
+			changed[slot] = 1;
+			versions[slot]++;
+			updated++;
+			if (parent < 0)
+			{
+				worlds[slot] = locals[slot];
+				continue;
+			}
+			if (runLength == 0)
+				runStart = slot;
+			runLength++;
+		}
+		if (runLength)
+			flush(runStart, runLength);
+		// changed only describes this pass; slots before firstDirty were never set, so clearing from there
+		// leaves the whole array clear for the next one
+		fill(changed.begin() + firstDirty, changed.end(), 0);
+		firstDirty = count;
+		return updated;
+	}
+
+private:
+	// indexed by handle
+	vector<int> slotOfNode;
+	vector<int> parentNodes;
+	// indexed by slot, sorted by depth
+	vector<int> nodeOfSlot;
+	vector<int> parents;
+	vector<int> depths;
+	Mat4Array locals;
+	Mat4Array worlds;
+	vector<unsigned char> dirty;
+	vector<unsigned char> changed;
+	vector<unsigned int> versions;
+	unsigned int firstDirty;
+	unsigned int updated;
+
+	void flush(unsigned int start, unsigned int length)
+	{
+		mathKernels().multiplyIndexed(worlds.data(), &parents[start], &locals[start], &worlds[start], length);
+	}
+
+	void markDirty(int slot)
+	{
+		dirty[slot] = 1;
+		if ((unsigned int)slot < firstDirty)
+			firstDirty = slot;
+	}
+
+	int depthOf(int node) const
+	{
+		int depth = 0;
+		for (int parent = parentNodes[node]; parent >= 0; parent = parentNodes[parent])
+			depth++;
+		return depth;
+	}
+
+	// structural changes only happen while the scene is built, so a full stable re-sort is fine here
+	void resort()
+	{
+		unsigned int count = (unsigned int)slotOfNode.size();
+		vector<int> order(count);
+		vector<int> nodeDepth(count);
+		for (unsigned int node = 0; node < count; node++)
+		{
+			order[node] = node;
+			nodeDepth[node] = depthOf(node);
+		}
+		stable_sort(order.begin(), order.end(), [&](int a, int b) { return nodeDepth[a] < nodeDepth[b]; });
+
+		Mat4Array newLocals(count), newWorlds(count);
+		vector<unsigned char> newDirty(count);
+		vector<unsigned int> newVersions(count);
+		for (unsigned int slot = 0; slot < count; slot++)
+		{
+			int oldSlot = slotOfNode[order[slot]];
+			newLocals[slot] = locals[oldSlot];
+			newWorlds[slot] = worlds[oldSlot];
+			newDirty[slot] = dirty[oldSlot];
+			newVersions[slot] = versions[oldSlot];
+		}
+		for (unsigned int slot = 0; slot < count; slot++)
+		{
+			nodeOfSlot[slot] = order[slot];
+			slotOfNode[order[slot]] = slot;
+			depths[slot] = nodeDepth[order[slot]];
+		}
+		for (unsigned int slot = 0; slot < count; slot++)
+		{
+			int parent = parentNodes[nodeOfSlot[slot]];
+			parents[slot] = parent < 0 ? -1 : slotOfNode[parent];
+		}
+		locals.swap(newLocals);
+		worlds.swap(newWorlds);
+		dirty.swap(newDirty);
+		versions.swap(newVersions);
+
+		// a moved node may now hang below a different parent, recompute it on the next update
+		for (unsigned int slot = 0; slot < count; slot++)
+			dirty[slot] = 1;
+		firstDirty = 0;
+	}
+};
+#endif
@@ -0,0 +1,182 @@
+#pragma once
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glm/glm.hpp>
+
+#include "gpu_block.h"
+
+#include <string>
+using namespace std;
+
+// Frame block of the scene shaders (cubemap1, indirect, door_anim, normalCubeShader, budynki, material), std140
+// (144 bytes). Written once per frame instead of view/projection/cameraPos uniforms per program.
+struct GpuFrame {
+	static const GLuint BINDING = 1;	// 0 is MaterialLibrary::UNIFORM_BINDING
+
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec3 cameraPos;
+	float animationTime;	// seconds of simulation time, door_anim.vs
+
+	static const char *blockName() { return "Frame"; }
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.add(prefix + "view", base + offsetof(GpuFrame, view));
+		members.add(prefix + "projection", base + offsetof(GpuFrame, projection));
+		members.add(prefix + "cameraPos", base + offsetof(GpuFrame, cameraPos));
+		members.add(prefix + "animationTime", base + offsetof(GpuFrame, animationTime));
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuFrame, projection, view);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuFrame, cameraPos, projection);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuFrame, animationTime, cameraPos);
+GPU_BLOCK_STRUCT_SIZE(GpuFrame);
+
+// Material struct of material.fs
+struct GpuPhongMaterial {
+	glm::vec3 ambient;
+	float pad0;
+	glm::vec3 diffuse;
+	float pad1;
+	glm::vec3 specular;
+	float shininess;
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.add(prefix + "ambient", base + offsetof(GpuPhongMaterial, ambient));
+		members.add(prefix + "diffuse", base + offsetof(GpuPhongMaterial, diffuse));
+		members.add(prefix + "specular", base + offsetof(GpuPhongMaterial, specular));
+		members.add(prefix + "shininess", base + offsetof(GpuPhongMaterial, shininess));
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPhongMaterial, diffuse, ambient);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPhongMaterial, specular, diffuse);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPhongMaterial, shininess, specular);
+GPU_BLOCK_STRUCT_SIZE(GpuPhongMaterial);
+
+// DirLight of material.fs
+struct GpuDirLight {
+	glm::vec3 direction;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.add(prefix + "direction", base + offsetof(GpuDirLight, direction));
+		members.add(prefix + "ambient", base + offsetof(GpuDirLight, ambient));
+		members.add(prefix + "diffuse", base + offsetof(GpuDirLight, diffuse));
+		members.add(prefix + "specular", base + offsetof(GpuDirLight, specular));
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuDirLight, ambient, direction);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuDirLight, diffuse, ambient);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuDirLight, specular, diffuse);
+GPU_BLOCK_STRUCT_SIZE(GpuDirLight);
+
+// PointLight of material.fs
+struct GpuPointLight {
+	glm::vec3 position;
+	float constant;
+	float linear;
+	float quadratic;
+	float pad0[2];
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.add(prefix + "position", base + offsetof(GpuPointLight, position));
+		members.add(prefix + "constant", base + offsetof(GpuPointLight, constant));
+		members.add(prefix + "linear", base + offsetof(GpuPointLight, linear));
+		members.add(prefix + "quadratic", base + offsetof(GpuPointLight, quadratic));
+		members.add(prefix + "ambient", base + offsetof(GpuPointLight, ambient));
+		members.add(prefix + "diffuse", base + offsetof(GpuPointLight, diffuse));
+		members.add(prefix + "specular", base + offsetof(GpuPointLight, specular));
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPointLight, constant, position);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPointLight, linear, constant);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPointLight, quadratic, linear);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPointLight, ambient, quadratic);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPointLight, diffuse, ambient);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuPointLight, specular, diffuse);
+GPU_BLOCK_STRUCT_SIZE(GpuPointLight);
+
+// SpotLight of material.fs, angles as cosines
+struct GpuSpotLight {
+	glm::vec3 position;
+	float pad0;
+	glm::vec3 direction;
+	float cutOff;
+	float outerCutOff;
+	float constant;
+	float linear;
+	float quadratic;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.add(prefix + "position", base + offsetof(GpuSpotLight, position));
+		members.add(prefix + "direction", base + offsetof(GpuSpotLight, direction));
+		members.add(prefix + "cutOff", base + offsetof(GpuSpotLight, cutOff));
+		members.add(prefix + "outerCutOff", base + offsetof(GpuSpotLight, outerCutOff));
+		members.add(prefix + "constant", base + offsetof(GpuSpotLight, constant));
+		members.add(prefix + "linear", base + offsetof(GpuSpotLight, linear));
+		members.add(prefix + "quadratic", base + offsetof(GpuSpotLight, quadratic));
+		members.add(prefix + "ambient", base + offsetof(GpuSpotLight, ambient));
+		members.add(prefix + "diffuse", base + offsetof(GpuSpotLight, diffuse));
+		members.add(prefix + "specular", base + offsetof(GpuSpotLight, specular));
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, direction, position);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, cutOff, direction);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, outerCutOff, cutOff);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, constant, outerCutOff);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, linear, constant);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, quadratic, linear);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, ambient, quadratic);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, diffuse, ambient);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuSpotLight, specular, diffuse);
+GPU_BLOCK_STRUCT_SIZE(GpuSpotLight);
+
+// Lighting block of material.fs, std140 (384 bytes): the surface and every light in one write
+struct GpuLighting {
+	static const GLuint BINDING = 2;
+	static const unsigned int SPOT_LIGHTS = 2;	// NR_SPOT_LIGHTS in material.fs
+
+	GpuPhongMaterial material;
+	GpuDirLight dirLight;
+	GpuPointLight pointLight;
+	GpuSpotLight spotLights[SPOT_LIGHTS];
+
+	static const char *blockName() { return "Lighting"; }
+
+	static void describe(GpuBlockMembers &members, const string &prefix, size_t base)
+	{
+		members.addStruct<GpuPhongMaterial>(prefix + "material", base + offsetof(GpuLighting, material));
+		members.addStruct<GpuDirLight>(prefix + "dirLight", base + offsetof(GpuLighting, dirLight));
+		members.addStruct<GpuPointLight>(prefix + "pointLight", base + offsetof(GpuLighting, pointLight));
+		members.addStructArray<GpuSpotLight>(prefix + "spotLights", base + offsetof(GpuLighting, spotLights), SPOT_LIGHTS);
+	}
+};
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuLighting, dirLight, material);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuLighting, pointLight, dirLight);
+GPU_BLOCK_MEMBER_AFTER(Std140, GpuLighting, spotLights, pointLight);
+GPU_BLOCK_STRUCT_SIZE(GpuLighting);
+#endif
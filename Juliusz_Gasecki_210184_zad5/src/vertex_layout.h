@@ -0,0 +1,195 @@
+#pragma once
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+
+#include <cstddef>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// what an attribute means, which also names it in the shaders
+enum AttributeSemantic {
+	SEMANTIC_POSITION,
+	SEMANTIC_NORMAL,
+	SEMANTIC_TEXCOORDS,
+	SEMANTIC_TANGENT,
+	SEMANTIC_BITANGENT,
+	SEMANTIC_COLOR
+};
+
+inline const char *semanticName(AttributeSemantic semantic)
+{
+	static const char *names[] = { "aPos", "aNormal", "aTexCoords", "aTangent", "aBitangent", "aColor" };
+	return names[semantic];
+}
+
+// GL enum of a component type
+template <typename T> struct GlComponentType;
+template <> struct GlComponentType<GLfloat> { static const GLenum value = GL_FLOAT; };
+template <> struct GlComponentType<GLbyte> { static const GLenum value = GL_BYTE; };
+template <> struct GlComponentType<GLubyte> { static const GLenum value = GL_UNSIGNED_BYTE; };
+template <> struct GlComponentType<GLshort> { static const GLenum value = GL_SHORT; };
+template <> struct GlComponentType<GLushort> { static const GLenum value = GL_UNSIGNED_SHORT; };
+template <> struct GlComponentType<GLint> { static const GLenum value = GL_INT; };
+template <> struct GlComponentType<GLuint> { static const GLenum value = GL_UNSIGNED_INT; };
+
+// One vertex shader input: Count components of type T at a location. Integer components reach the shader as
+// floats, scaled to [0, 1] / [-1, 1] when Normalized, so a quantized attribute is declared like a float one.
+template <GLuint Location, AttributeSemantic Semantic, typename T, GLint Count, bool Normalized = false>
+struct Attribute {
+	static_assert(Count >= 1 && Count <= 4, "an attribute has 1 to 4 components");
+
+	static const GLuint location = Location;
+	static const AttributeSemantic semantic = Semantic;
+	static const GLenum type = GlComponentType<T>::value;
+	static const GLint components = Count;
+	static const bool normalized = Normalized;
+	static const GLsizei size = (GLsizei)(Count * sizeof(T));
+
+	static void attach(GLuint vao, GLuint buffer, GLsizei stride, size_t offset, GLuint divisor)
+	{
+		vertexArrayAttribute(vao, Location, Count, type, Normalized, buffer, stride, offset, divisor);
+	}
+};
+
+// Vertex of one buffer as a list of Attributes, in memory order and tightly packed. Stride, offsets and formats
+// are compile time constants, so declaring a vertex type once replaces the hand-counted glVertexAttribPointer
+// offsets, and a static_assert can hold the list to the C++ struct the data comes from. The i-th attribute's
+// properties are location(i), offset(i), ...
+template <typename... Attributes>
+struct AttributeLayout;
+
+template <>
+struct AttributeLayout<> {
+	static const unsigned int count = 0;
+	static const GLsizei stride = 0;
+	static const unsigned int locations = 0;
+
+	static constexpr GLuint location(unsigned int) { return ~0u; }
+	static constexpr AttributeSemantic semantic(unsigned int) { return SEMANTIC_POSITION; }
+	static constexpr GLenum type(unsigned int) { return GL_NONE; }
+	static constexpr GLint components(unsigned int) { return 0; }
+	static constexpr bool normalized(unsigned int) { return false; }
+	static constexpr GLsizei size(unsigned int) { return 0; }
+	static constexpr size_t offset(unsigned int) { return 0; }
+
+	static void attachFrom(GLuint, GLuint, GLsizei, size_t, GLuint) {}
+};
+
+template <typename First, typename... Rest>
+struct AttributeLayout<First, Rest...> {
+	typedef AttributeLayout<Rest...> Tail;
+
+	static const unsigned int count = 1 + Tail::count;
+	static const GLsizei stride = First::size + Tail::stride;
+	// bit n set when the layout feeds location n
+	static const unsigned int locations = (1u << First::location) | Tail::locations;
+	static_assert(!(Tail::locations & (1u << First::location)), "two attributes share a location");
+
+	static constexpr GLuint location(unsigned int i) { return i == 0 ? First::location : Tail::location(i - 1); }
+	static constexpr AttributeSemantic semantic(unsigned int i) { return i == 0 ? First::semantic : Tail::semantic(i - 1); }
+	static constexpr GLenum type(unsigned int i) { return i == 0 ? First::type : Tail::type(i - 1); }
+	static constexpr GLint components(unsigned int i) { return i == 0 ? First::components : Tail::components(i - 1); }
+	static constexpr bool normalized(unsigned int i) { return i == 0 ? First::normalized : Tail::normalized(i - 1); }
+	static constexpr GLsizei size(unsigned int i) { return i == 0 ? First::size : Tail::size(i - 1); }
+	static constexpr size_t offset(unsigned int i) { return i == 0 ? 0 : First::size + Tail::offset(i - 1); }
+
+	// Enables every attribute on the VAO, reading buffer, without binding either (gl_resources.h). A different
+	// stride/offset takes the attributes out of a larger vertex, a divisor makes them per instance.
+	static void attach(GLuint vao, GLuint buffer, GLsizei vertexStride = stride, size_t firstOffset = 0, GLuint divisor = 0)
+	{
+		attachFrom(vao, buffer, vertexStride, firstOffset, divisor);
+	}
+
+	static void attachFrom(GLuint vao, GLuint buffer, GLsizei vertexStride, size_t attributeOffset, GLuint divisor)
+	{
+		First::attach(vao, buffer, vertexStride, attributeOffset, divisor);
+		Tail::attachFrom(vao, buffer, vertexStride, attributeOffset + First::size, divisor);
+	}
+
+	// the "layout (location = n) in vecN aName;" lines of a vertex shader reading this layout, which Shader
+	// inserts after the #version line (shader.h), so the .vs files do not repeat the inputs
+	static string declarations()
+	{
+		ostringstream glsl;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glsl << "layout (location = " << location(i) << ") in ";
+			if (components(i) == 1)
+				glsl << "float";
+			else
+				glsl << "vec" << components(i);
+			glsl << " " << semanticName(semantic(i)) << ";\n";
+		}
+		return glsl.str();
+	}
+
+	// Whether every vertex input the linked program reads comes from this layout with as many components as the
+	// shader declares. Locations fed by other buffers (e.g. per-instance data) go into otherLocations. A mismatch
+	// is reported together with what the layout would have the shader declare.
+	static bool matches(GLuint program, unsigned int otherLocations = 0)
+	{
+		GLint active = 0, maxLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &active);
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+		vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+		bool valid = true;
+		for (GLint a = 0; a < active; a++)
+		{
+			GLint arraySize;
+			GLenum shaderType;
+			glGetActiveAttrib(program, (GLuint)a, (GLsizei)name.size(), NULL, &arraySize, &shaderType, name.data());
+			GLint shaderLocation = glGetAttribLocation(program, name.data());
+			if (shaderLocation < 0 || (shaderLocation < 32 && (otherLocations & (1u << shaderLocation))))
+				continue;
+			unsigned int i = 0;
+			while (i < count && location(i) != (GLuint)shaderLocation)
+				i++;
+			if (i == count)
+			{
+				cout << "ERROR::VERTEX_LAYOUT:: " << name.data() << " (location " << shaderLocation << ") has no attribute" << endl;
+				valid = false;
+			}
+			else if (shaderComponents(shaderType) && shaderComponents(shaderType) != components(i))
+			{
+				cout << "ERROR::VERTEX_LAYOUT:: " << name.data() << " reads " << shaderComponents(shaderType) << " components, the layout has " << components(i) << endl;
+				valid = false;
+			}
+		}
+		if (!valid)
+			cout << "ERROR::VERTEX_LAYOUT:: program " << program << " does not match the layout:\n" << declarations();
+		return valid;
+	}
+
+private:
+	// components of a float vertex input type, 0 for types not checked (matrices, integer inputs)
+	static GLint shaderComponents(GLenum shaderType)
+	{
+		switch (shaderType)
+		{
+		case GL_FLOAT: return 1;
+		case GL_FLOAT_VEC2: return 2;
+		case GL_FLOAT_VEC3: return 3;
+		case GL_FLOAT_VEC4: return 4;
+		default: return 0;
+		}
+	}
+};
+
+// a bare position, e.g. the skybox cube
+typedef AttributeLayout<
+	Attribute<0, SEMANTIC_POSITION, GLfloat, 3>
+> PositionVertexLayout;
+
+// position + colour, the unlit colour shaders (normalCubeShader, budynki)
+typedef AttributeLayout<
+	Attribute<0, SEMANTIC_POSITION, GLfloat, 3>,
+	Attribute<1, SEMANTIC_COLOR, GLfloat, 3>
+> ColoredVertexLayout;
+#endif
@@ -0,0 +1,360 @@
+#pragma once
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "job_system.h"
+#include "frame_arena.h"
+
+#include <cstring>
+#include <new>
+#include <vector>
+using namespace std;
+
+class Model;
+struct MeshRange;
+
+// Components are plain data, copied around with memcpy when entities move inside their chunk.
+
+// world matrix of a TransformHierarchy node, gathered once per frame when the node's version changed
+struct Transform {
+	glm::mat4 world;
+	int node;
+	unsigned int version;
+
+	Transform() : world(1.0f), node(-1), version(0) {}
+};
+
+// what is drawn: a model, its ranges in the geometry arena and where its meshes sit in the per-mesh arrays
+struct MeshRef {
+	Model *model;
+	const MeshRange *ranges;
+	unsigned int bucket;
+	unsigned int firstMesh;
+
+	MeshRef() : model(NULL), ranges(NULL), bucket(0), firstMesh(0) {}
+};
+
+// how it is drawn without the render queue
+struct Material {
+	GLuint program;
+	GLint modelUniform;
+	GLuint materialIndex;
+
+	Material() : program(0), modelUniform(-1), materialIndex(0) {}
+};
+
+// object space bounds and their world space box, recomputed when the transform or the local box changed
+struct Bounds {
+	AABB local;
+	AABB world;
+	unsigned int dirty;
+
+	Bounds() : dirty(1) {}
+};
+
+// Animator pose slot driving the entity, also the GPU door animation slot
+struct Animation {
+	int slot;
+
+	Animation() : slot(-1) {}
+};
+
+// proxy in the scene index and the result of this frame's query
+struct Visibility {
+	int proxy;
+	unsigned int visible;
+
+	Visibility() : proxy(-1), visible(0) {}
+};
+
+enum ComponentType {
+	COMPONENT_TRANSFORM,
+	COMPONENT_MESH,
+	COMPONENT_MATERIAL,
+	COMPONENT_BOUNDS,
+	COMPONENT_ANIMATION,
+	COMPONENT_VISIBILITY,
+	COMPONENT_COUNT
+};
+
+typedef unsigned int ComponentMask;
+
+template <typename T> struct ComponentId;
+template <> struct ComponentId<Transform> { static const ComponentType value = COMPONENT_TRANSFORM; };
+template <> struct ComponentId<MeshRef> { static const ComponentType value = COMPONENT_MESH; };
+template <> struct ComponentId<Material> { static const ComponentType value = COMPONENT_MATERIAL; };
+template <> struct ComponentId<Bounds> { static const ComponentType value = COMPONENT_BOUNDS; };
+template <> struct ComponentId<Animation> { static const ComponentType value = COMPONENT_ANIMATION; };
+template <> struct ComponentId<Visibility> { static const ComponentType value = COMPONENT_VISIBILITY; };
+
+template <typename T>
+inline ComponentMask componentBit() { return 1u << ComponentId<T>::value; }
+
+// size and default constructor of every component type, indexed by ComponentType
+struct ComponentInfo {
+	unsigned int size;
+	void (*construct)(void *);
+};
+
+template <typename T>
+inline void constructComponent(void *memory) { new (memory) T(); }
+
+inline const ComponentInfo &componentInfo(unsigned int type)
+{
+	static const ComponentInfo infos[COMPONENT_COUNT] = {
+		{ sizeof(Transform), constructComponent<Transform> },
+		{ sizeof(MeshRef), constructComponent<MeshRef> },
+		{ sizeof(Material), constructComponent<Material> },
+		{ sizeof(Bounds), constructComponent<Bounds> },
+		{ sizeof(Animation), constructComponent<Animation> },
+		{ sizeof(Visibility), constructComponent<Visibility> }
+	};
+	return infos[type];
+}
+
+struct Entity {
+	unsigned int index;
+	unsigned int generation;
+
+	Entity(unsigned int index = ~0u, unsigned int generation = 0) : index(index), generation(generation) {}
+	bool valid() const { return index != ~0u; }
+};
+
+// Fixed-size block of entities sharing one archetype. Every component of the archetype is one contiguous
+// array in the block (structure of arrays), rows 0..size()-1 are live, removal moves the last row into the gap.
+class Chunk
+{
+public:
+	static const unsigned int BYTES = 16 * 1024;
+
+	unsigned int size() const { return count; }
+	unsigned int capacity() const { return rows; }
+	ComponentMask mask() const { return components; }
+	Entity entity(unsigned int row) const { return entities[row]; }
+
+	// the archetype must contain T
+	template <typename T>
+	T *array() { return (T *)(data + offsets[ComponentId<T>::value]); }
+	template <typename T>
+	const T *array() const { return (const T *)(data + offsets[ComponentId<T>::value]); }
+
+private:
+	friend class World;
+
+	unsigned char *data;
+	unsigned int offsets[COMPONENT_COUNT];
+	ComponentMask components;
+	unsigned int rows;
+	unsigned int count;
+	vector<Entity> entities;
+};
+
+// Entity-component storage grouped by archetype (the set of components an entity has). Systems ask for the
+// chunks whose archetype contains the components they need and walk their arrays linearly; chunks are
+// independent, so a system can hand them to the job system. The component set is fixed at create().
+class World
+{
+public:
+	World() : freeList(~0u), living(0) {}
+
+	~World()
+	{
+		for (unsigned int a = 0; a < archetypes.size(); a++)
+		{
+			for (unsigned int c = 0; c < archetypes[a]->chunks.size(); c++)
+			{
+				::operator delete(archetypes[a]->chunks[c]->data);
+				delete archetypes[a]->chunks[c];
+			}
+			delete archetypes[a];
+		}
+	}
+
+	// components start default constructed
+	Entity create(ComponentMask components)
+	{
+		Archetype &archetype = archetypeFor(components);
+		Chunk *chunk = freeChunk(archetype);
+		unsigned int row = chunk->count++;
+		for (unsigned int type = 0; type < COMPONENT_COUNT; type++)
+			if (components & (1u << type))
+				componentInfo(type).construct(chunk->data + chunk->offsets[type] + row * componentInfo(type).size);
+
+		unsigned int index;
+		if (freeList != ~0u)
+		{
+			index = freeList;
+			freeList = records[index].row;
+		}
+		else
+		{
+			index = (unsigned int)records.size();
+			records.push_back(Record());
+		}
+		Record &record = records[index];
+		record.chunk = chunk;
+		record.row = row;
+		Entity entity(index, record.generation);
+		chunk->entities[row] = entity;
+		living++;
+		return entity;
+	}
+
+	void destroy(Entity entity)
+	{
+		if (!alive(entity))
+			return;
+		Record &record = records[entity.index];
+		Chunk *chunk = record.chunk;
+		unsigned int last = --chunk->count;
+		if (record.row != last)
+		{
+			for (unsigned int type = 0; type < COMPONENT_COUNT; type++)
+				if (chunk->components & (1u << type))
+				{
+					unsigned int size = componentInfo(type).size;
+					unsigned char *base = chunk->data + chunk->offsets[type];
+					memcpy(base + record.row * size, base + last * size, size);
+				}
+			Entity moved = chunk->entities[last];
+			chunk->entities[record.row] = moved;
+			records[moved.index].row = record.row;
+		}
+		record.chunk = NULL;
+		record.generation++;
+		record.row = freeList;
+		freeList = entity.index;
+		living--;
+	}
+
+	bool alive(Entity entity) const
+	{
+		return entity.index < records.size() && records[entity.index].chunk && records[entity.index].generation == entity.generation;
+	}
+
+	template <typename T>
+	bool has(Entity entity) const
+	{
+		return alive(entity) && (records[entity.index].chunk->components & componentBit<T>()) != 0;
+	}
+
+	// the entity must be alive and have T
+	template <typename T>
+	T &get(Entity entity)
+	{
+		const Record &record = records[entity.index];
+		return record.chunk->array<T>()[record.row];
+	}
+
+	unsigned int entityCount() const { return living; }
+
+	// appends every non-empty chunk whose archetype has all of the components
+	template <typename Chunks>
+	void query(ComponentMask components, Chunks &chunks) const
+	{
+		for (unsigned int a = 0; a < archetypes.size(); a++)
+			if ((archetypes[a]->mask & components) == components)
+				for (unsigned int c = 0; c < archetypes[a]->chunks.size(); c++)
+					if (archetypes[a]->chunks[c]->count)
+						chunks.push_back(archetypes[a]->chunks[c]);
+	}
+
+	// body(Chunk &) once per matching chunk, on the calling thread
+	template <typename Body>
+	void forEachChunk(ComponentMask components, Body body) const
+	{
+		for (unsigned int a = 0; a < archetypes.size(); a++)
+			if ((archetypes[a]->mask & components) == components)
+				for (unsigned int c = 0; c < archetypes[a]->chunks.size(); c++)
+					if (archetypes[a]->chunks[c]->count)
+						body(*archetypes[a]->chunks[c]);
+	}
+
+	// same, chunks spread over the job system; body must only touch its own chunk's rows
+	template <typename Body>
+	void forEachChunk(JobSystem &jobs, ComponentMask components, Body body) const
+	{
+		FrameVector<Chunk *> chunks;
+		query(components, chunks);
+		jobs.parallelFor(0, (unsigned int)chunks.size(), 1, [&](unsigned int first, unsigned int last) {
+			for (unsigned int c = first; c < last; c++)
+				body(*chunks[c]);
+		});
+	}
+
+private:
+	struct Archetype {
+		ComponentMask mask;
+		vector<Chunk *> chunks;
+	};
+
+	// chunk is NULL for a free slot, whose row then links the free list
+	struct Record {
+		Chunk *chunk;
+		unsigned int row;
+		unsigned int generation;
+
+		Record() : chunk(NULL), row(0), generation(0) {}
+	};
+
+	vector<Archetype *> archetypes;
+	vector<Record> records;
+	unsigned int freeList;
+	unsigned int living;
+
+	Archetype &archetypeFor(ComponentMask components)
+	{
+		for (unsigned int a = 0; a < archetypes.size(); a++)
+			if (archetypes[a]->mask == components)
+				return *archetypes[a];
+		Archetype *archetype = new Archetype();
+		archetype->mask = components;
+		archetypes.push_back(archetype);
+		return *archetype;
+	}
+
+	Chunk *freeChunk(Archetype &archetype)
+	{
+		for (unsigned int c = 0; c < archetype.chunks.size(); c++)
+			if (archetype.chunks[c]->count < archetype.chunks[c]->rows)
+				return archetype.chunks[c];
+
+		// as many rows as fit, every array starting on a 16 byte boundary
+		unsigned int rowBytes = 0;
+		for (unsigned int type = 0; type < COMPONENT_COUNT; type++)
+			if (archetype.mask & (1u << type))
+				rowBytes += componentInfo(type).size;
+		unsigned int rows = rowBytes ? Chunk::BYTES / rowBytes : Chunk::BYTES;
+		while (rows > 1 && layout(archetype.mask, rows, NULL) > Chunk::BYTES)
+			rows--;
+
+		Chunk *chunk = new Chunk();
+		chunk->components = archetype.mask;
+		chunk->rows = rows;
+		chunk->count = 0;
+		chunk->entities.resize(rows);
+		chunk->data = (unsigned char *)::operator new(layout(archetype.mask, rows, chunk->offsets));
+		archetype.chunks.push_back(chunk);
+		return chunk;
+	}
+
+	// bytes needed for rows entities, fills offsets when given
+	static unsigned int layout(ComponentMask components, unsigned int rows, unsigned int *offsets)
+	{
+		unsigned int bytes = 0;
+		for (unsigned int type = 0; type < COMPONENT_COUNT; type++)
+		{
+			if (offsets)
+				offsets[type] = bytes;
+			if (components & (1u << type))
+				bytes = (bytes + componentInfo(type).size * rows + 15) & ~15u;
+		}
+		return bytes > 0 ? bytes : 16;
+	}
+};
+#endif